@@ -0,0 +1,71 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "backoff.h"
+#include "misc.h"
+
+/* xorshift64*, good enough for jitter. */
+static uint64_t backoff_rand(struct xc_backoff *bo)
+{
+	bo->bo_rand ^= bo->bo_rand >> 12;
+	bo->bo_rand ^= bo->bo_rand << 25;
+	bo->bo_rand ^= bo->bo_rand >> 27;
+
+	return bo->bo_rand * 0x2545f4914f6cdd1dULL;
+}
+
+void xc_backoff_init(struct xc_backoff *bo,
+		     uint64_t           min,
+		     uint64_t           max,
+		     unsigned           tries,
+		     uint64_t           seed)
+{
+	bo->bo_min = MAX(min, 1);
+	bo->bo_max = MAX(max, bo->bo_min);
+	bo->bo_tries = tries;
+	/* The generator must not be seeded with zero. */
+	bo->bo_rand = seed != 0 ? seed : 0x9e3779b97f4a7c15ULL;
+	xc_backoff_reset(bo);
+}
+
+void xc_backoff_reset(struct xc_backoff *bo)
+{
+	bo->bo_prev = bo->bo_min;
+	bo->bo_attempts = 0;
+}
+
+bool xc_backoff_next(struct xc_backoff *bo, uint64_t *delay)
+{
+	uint64_t high;
+
+	if (bo->bo_tries != 0 && bo->bo_attempts >= bo->bo_tries)
+		return false;
+
+	if (bo->bo_attempts++ == 0) {
+		*delay = 0;
+		return true;
+	}
+	high = MIN(bo->bo_prev * 3, bo->bo_max);
+	*delay = high > bo->bo_min ?
+		 bo->bo_min + backoff_rand(bo) % (high - bo->bo_min + 1) :
+		 bo->bo_min;
+	bo->bo_prev = *delay;
+
+	return true;
+}
@@ -0,0 +1,54 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XC_BACKOFF_H__
+#define __XC_BACKOFF_H__
+
+#include <stdbool.h>	/* bool */
+#include <stdint.h>	/* uint64_t */
+
+/*
+ * Exponential backoff with decorrelated jitter for reconnects. The first
+ * retry is immediate, every next delay is random between the minimum and
+ * three times the previous delay and is capped by the maximum. So clients
+ * which lose connections at the same moment spread their retries.
+ */
+struct xc_backoff {
+	/* Delays in milliseconds. */
+	uint64_t bo_min;
+	uint64_t bo_max;
+	uint64_t bo_prev;
+	/* State of the pseudo-random generator. */
+	uint64_t bo_rand;
+	/* Max number of retries, 0 for unlimited. */
+	unsigned bo_tries;
+	unsigned bo_attempts;
+};
+
+void xc_backoff_init(struct xc_backoff *bo,
+		     uint64_t           min,
+		     uint64_t           max,
+		     unsigned           tries,
+		     uint64_t           seed);
+/* Called when a connection is established. */
+void xc_backoff_reset(struct xc_backoff *bo);
+/* Returns false when retries are exhausted. */
+bool xc_backoff_next(struct xc_backoff *bo, uint64_t *delay);
+
+#endif /* __XC_BACKOFF_H__ */
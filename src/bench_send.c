@@ -0,0 +1,222 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Microbenchmark of splitting a message which re-opens the stream, as
+ * xc_send_buf() does before it passes the slices to libstrophe.
+ *
+ * The legacy splitter runs strstr() for <stream:stream, <? and >, copies
+ * the prefix to a temporary buffer and passes both parts through the "%s"
+ * path of xmpp_send_raw_string(), which is reproduced here: vsnprintf(3)
+ * measures the data, formats it into a heap buffer and the result is
+ * queued. The current splitter is xc_framer_find_stream() and its slices
+ * are queued as they are, like with xmpp_send_raw(). Queueing is a copy to
+ * the same buffer in both cases, no data is sent.
+ *
+ * Usage: bench_send [MESSAGE_KIB [ITERATIONS]]
+ */
+
+#include "framer.h"
+#include "misc.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MSG_KIB 4096
+#define BENCH_ITERATIONS 50
+
+static const char bench_header[] =
+	"<?xml version='1.0'?><stream:stream to='example.com' "
+	"xmlns='jabber:client' "
+	"xmlns:stream='http://etherx.jabber.org/streams' version='1.0'>";
+
+/* Send queue of the connection. */
+static char   *bench_queue;
+static size_t  bench_queued;
+
+static void bench_send_raw(const char *data, size_t len)
+{
+	memcpy(bench_queue + bench_queued, data, len);
+	bench_queued += len;
+}
+
+/* The same steps as xmpp_send_raw_string() of libstrophe. */
+static void bench_send_raw_string(const char *fmt, ...)
+{
+	va_list  ap;
+	char     buf[1024];
+	char    *bigbuf;
+	size_t   len;
+
+	va_start(ap, fmt);
+	len = (size_t)vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (len < sizeof(buf)) {
+		bench_send_raw(buf, len);
+		return;
+	}
+	bigbuf = malloc(len + 1);
+	if (bigbuf == NULL)
+		return;
+	va_start(ap, fmt);
+	vsnprintf(bigbuf, len + 1, fmt, ap);
+	va_end(ap);
+	bench_send_raw(bigbuf, len);
+	free(bigbuf);
+}
+
+static void bench_split_legacy(const char *msg)
+{
+	const char *tag_stream;
+	const char *tag_xml;
+	const char *ptr;
+	char       *buf;
+	size_t      len;
+
+	tag_stream = strstr(msg, "<stream:stream");
+	if (tag_stream == NULL) {
+		bench_send_raw_string("%s", msg);
+		return;
+	}
+	tag_xml = strstr(msg, "<?");
+	ptr = tag_xml != NULL && tag_xml < tag_stream ? tag_xml : tag_stream;
+	if (msg < ptr) {
+		len = (size_t)(ptr - msg);
+		buf = malloc(len + 1);
+		if (buf != NULL) {
+			strncpy(buf, msg, len);
+			buf[len] = '\0';
+			bench_send_raw_string("%s", buf);
+			free(buf);
+		}
+	}
+	ptr = strstr(tag_stream, ">");
+	if (ptr != NULL && *(ptr + 1) != '\0')
+		bench_send_raw_string("%s", ptr + 1);
+}
+
+static void bench_split(const char *msg, size_t len)
+{
+	size_t start;
+	size_t end;
+
+	if (!xc_framer_find_stream(msg, len, &start, &end)) {
+		bench_send_raw(msg, len);
+		return;
+	}
+	bench_send_raw(msg, start);
+	bench_send_raw(msg + end, len - end);
+}
+
+/*
+ * Builds a paste of a large stanza with base64 payload, the stream is
+ * re-opened in the middle of it as in the worst case for the scans.
+ */
+static char *bench_message(size_t size)
+{
+	static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdef"
+				  "ghijklmnopqrstuvwxyz0123456789+/";
+	static const char head[] = "<iq type='set' id='v1'><vCard "
+				   "xmlns='vcard-temp'><PHOTO><BINVAL>";
+	static const char tail[] = "</BINVAL></PHOTO></vCard></iq>";
+	size_t            half = size / 2;
+	size_t            pos = 0;
+	size_t            i;
+	char             *msg;
+
+	msg = malloc(size + sizeof(bench_header) + 2 * sizeof(head) +
+		     2 * sizeof(tail));
+	if (msg == NULL)
+		return NULL;
+	for (i = 0; i < 2; ++i) {
+		memcpy(msg + pos, head, sizeof(head) - 1);
+		pos += sizeof(head) - 1;
+		for (; pos < half * (i + 1); ++pos)
+			msg[pos] = b64[pos % (sizeof(b64) - 1)];
+		memcpy(msg + pos, tail, sizeof(tail) - 1);
+		pos += sizeof(tail) - 1;
+		if (i == 0) {
+			memcpy(msg + pos, bench_header,
+			       sizeof(bench_header) - 1);
+			pos += sizeof(bench_header) - 1;
+		}
+	}
+	msg[pos] = '\0';
+	return msg;
+}
+
+static double bench_rate(size_t bytes, uint64_t ns)
+{
+	return (double)bytes / (1024 * 1024) / ((double)ns / 1000000000);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long kib = argc > 1 ? strtoul(argv[1], NULL, 10) :
+				       BENCH_MSG_KIB;
+	unsigned long iterations = argc > 2 ? strtoul(argv[2], NULL, 10) :
+					      BENCH_ITERATIONS;
+	uint64_t      legacy;
+	uint64_t      current;
+	uint64_t      start;
+	size_t        len;
+	unsigned long i;
+	char         *msg;
+
+	if (kib == 0 || iterations == 0) {
+		fprintf(stderr, "Usage: %s [MESSAGE_KIB [ITERATIONS]]\n",
+			argv[0]);
+		return 1;
+	}
+	msg = bench_message(kib * 1024);
+	if (msg == NULL)
+		return 1;
+	len = strlen(msg);
+	bench_queue = malloc(len);
+	if (bench_queue == NULL) {
+		free(msg);
+		return 1;
+	}
+
+	start = xc_time_ns();
+	for (i = 0; i < iterations; ++i) {
+		bench_queued = 0;
+		bench_split_legacy(msg);
+	}
+	legacy = xc_time_ns() - start;
+
+	start = xc_time_ns();
+	for (i = 0; i < iterations; ++i) {
+		bench_queued = 0;
+		bench_split(msg, len);
+	}
+	current = xc_time_ns() - start;
+
+	printf("message %zu bytes, %lu iterations, %zu bytes queued\n", len,
+	       iterations, bench_queued);
+	printf("legacy:  %10.1f MiB/s\n", bench_rate(len * iterations, legacy));
+	printf("current: %10.1f MiB/s\n",
+	       bench_rate(len * iterations, current));
+
+	free(bench_queue);
+	free(msg);
+	return 0;
+}
@@ -0,0 +1,639 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "capture.h"
+#include "misc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Number of records which are written by a single writev(2). */
+#define CAPTURE_BATCH 64
+
+static const char capture_pad[XC_CAP_ALIGN];
+
+void xc_capture_header_init(struct xc_cap_header *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	memcpy(hdr->ch_magic, XC_CAP_MAGIC, sizeof(XC_CAP_MAGIC));
+	hdr->ch_version = XC_CAP_VERSION;
+	hdr->ch_byte_order = XC_CAP_BYTE_ORDER;
+}
+
+void xc_capture_block_init(struct xc_cap_block    *blk,
+			   const struct xc_record *rec,
+			   uint64_t                time_offset)
+{
+	blk->cb_type = XC_CAP_RECORD;
+	blk->cb_len = rec->rec_len;
+	blk->cb_time = rec->rec_time + time_offset;
+	blk->cb_conn = rec->rec_conn;
+	blk->cb_dir = (uint32_t)rec->rec_dir;
+}
+
+uint64_t xc_capture_time_offset(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec -
+	       xc_time_ns();
+}
+
+int xc_capture_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t n;
+
+	while (iovcnt > 0) {
+		n = writev(fd, iov, iovcnt);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -errno;
+		while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= (ssize_t)iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= (size_t)n;
+		}
+	}
+	return 0;
+}
+
+static int capture_dump_fd(int fd, struct xc_store *store)
+{
+	struct xc_cap_header    hdr;
+	struct xc_cap_block     blks[CAPTURE_BATCH];
+	struct iovec            iov[CAPTURE_BATCH * 3 + 1];
+	const struct xc_record *rec;
+	uint64_t                time_offset = xc_capture_time_offset();
+	uint64_t                seq = xc_store_first(store);
+	uint64_t                next = xc_store_next(store);
+	size_t                  pad;
+	int                     iovcnt;
+	int                     rc;
+	int                     i;
+
+	xc_capture_header_init(&hdr);
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iovcnt = 1;
+
+	do {
+		for (i = 0; i < CAPTURE_BATCH && seq < next; ++i, ++seq) {
+			rec = xc_store_get(store, seq);
+			xc_capture_block_init(&blks[i], rec, time_offset);
+			iov[iovcnt].iov_base = &blks[i];
+			iov[iovcnt].iov_len = sizeof(blks[i]);
+			iov[iovcnt + 1].iov_base =
+				(void *)xc_store_payload(store, rec);
+			iov[iovcnt + 1].iov_len = rec->rec_len;
+			iovcnt += 2;
+			pad = XC_CAP_PAD(rec->rec_len);
+			if (pad > 0) {
+				iov[iovcnt].iov_base = (void *)capture_pad;
+				iov[iovcnt].iov_len = pad;
+				++iovcnt;
+			}
+		}
+		rc = xc_capture_writev(fd, iov, iovcnt);
+		iovcnt = 0;
+	} while (rc == 0 && seq < next);
+
+	if (rc == 0 && fsync(fd) != 0)
+		rc = -errno;
+
+	return rc;
+}
+
+int xc_capture_dump(const char *path, struct xc_store *store)
+{
+	char *tmp;
+	int   fd;
+	int   rc;
+
+	tmp = malloc(strlen(path) + sizeof(".tmp"));
+	if (tmp == NULL)
+		return -ENOMEM;
+	sprintf(tmp, "%s.tmp", path);
+
+	/* The traffic may contain credentials. */
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	rc = fd < 0 ? -errno : capture_dump_fd(fd, store);
+	if (fd >= 0 && close(fd) != 0 && rc == 0)
+		rc = -errno;
+	if (rc == 0 && rename(tmp, path) != 0)
+		rc = -errno;
+	if (rc != 0 && fd >= 0)
+		(void)unlink(tmp);
+	free(tmp);
+
+	return rc;
+}
+
+static int capture_write(struct xc_capture *cap, struct iovec *iov,
+			 int iovcnt, size_t len)
+{
+	int rc;
+
+	/* After an error the writer only drains the ring. */
+	if (cap->cap_error != 0)
+		return cap->cap_error;
+
+	rc = xc_capture_writev(cap->cap_fd, iov, iovcnt);
+	if (rc == 0)
+		cap->cap_pos += len;
+	else
+		cap->cap_error = rc;
+
+	return rc;
+}
+
+static int capture_index_write(struct xc_capture *cap)
+{
+	struct xc_cap_block blk;
+	struct xc_cap_index idx;
+	struct iovec        iov[3];
+	size_t              entries_len;
+	uint64_t            pos = cap->cap_pos;
+	int                 rc;
+
+	entries_len = cap->cap_index_nr * sizeof(cap->cap_index[0]);
+	memset(&blk, 0, sizeof(blk));
+	blk.cb_type = XC_CAP_INDEX;
+	blk.cb_len = (uint32_t)(sizeof(idx) + entries_len);
+	blk.cb_time = cap->cap_index_nr > 0 ? cap->cap_index[0].ce_time : 0;
+	idx.ci_prev = cap->cap_index_prev;
+	idx.ci_entries_nr = cap->cap_index_nr;
+
+	iov[0] = (struct iovec){ .iov_base = &blk, .iov_len = sizeof(blk) };
+	iov[1] = (struct iovec){ .iov_base = &idx, .iov_len = sizeof(idx) };
+	iov[2] = (struct iovec){ .iov_base = cap->cap_index,
+				 .iov_len = entries_len };
+	rc = capture_write(cap, iov, 3, sizeof(blk) + blk.cb_len);
+	if (rc == 0)
+		cap->cap_index_prev = pos;
+	cap->cap_index_nr = 0;
+
+	return rc;
+}
+
+static int capture_trailer_write(struct xc_capture *cap)
+{
+	struct xc_cap_block   blk;
+	struct xc_cap_trailer trl;
+	struct iovec          iov[2];
+
+	memset(&blk, 0, sizeof(blk));
+	blk.cb_type = XC_CAP_TRAILER;
+	blk.cb_len = sizeof(trl);
+	trl.ct_index = cap->cap_index_prev;
+	trl.ct_records_nr = cap->cap_records_nr;
+
+	iov[0] = (struct iovec){ .iov_base = &blk, .iov_len = sizeof(blk) };
+	iov[1] = (struct iovec){ .iov_base = &trl, .iov_len = sizeof(trl) };
+
+	return capture_write(cap, iov, 2, sizeof(blk) + sizeof(trl));
+}
+
+/*
+ * Writes up to CAPTURE_BATCH records straight from the ring with a single
+ * writev(2). Returns number of the written records.
+ */
+static size_t capture_batch(struct xc_capture *cap)
+{
+	struct xc_cap_block *blk;
+	struct iovec         iov[CAPTURE_BATCH];
+	size_t               len;
+	size_t               total = 0;
+	int                  iovcnt = 0;
+
+	while (iovcnt < CAPTURE_BATCH) {
+		blk = xc_ring_peek(&cap->cap_ring, &len);
+		if (blk == NULL)
+			break;
+		if (cap->cap_records_nr % XC_CAP_INDEX_STEP == 0) {
+			cap->cap_index[cap->cap_index_nr].ce_time =
+				blk->cb_time;
+			cap->cap_index[cap->cap_index_nr].ce_offset =
+				cap->cap_pos + total;
+			++cap->cap_index_nr;
+		}
+		iov[iovcnt].iov_base = blk;
+		iov[iovcnt].iov_len = len;
+		++iovcnt;
+		total += len;
+		++cap->cap_records_nr;
+		if (cap->cap_records_nr % XC_CAP_INDEX_PERIOD == 0)
+			break;
+	}
+	if (iovcnt == 0)
+		return 0;
+
+	(void)capture_write(cap, iov, iovcnt, total);
+	xc_ring_release(&cap->cap_ring);
+
+	if (cap->cap_records_nr % XC_CAP_INDEX_PERIOD == 0)
+		(void)capture_index_write(cap);
+
+	cap->cap_unsynced += (uint64_t)iovcnt;
+	if (cap->cap_sync_period > 0 &&
+	    cap->cap_unsynced >= cap->cap_sync_period &&
+	    cap->cap_error == 0) {
+		if (fsync(cap->cap_fd) != 0)
+			cap->cap_error = -errno;
+		cap->cap_unsynced = 0;
+	}
+
+	return (size_t)iovcnt;
+}
+
+static void *capture_thread(void *arg)
+{
+	struct xc_capture *cap = arg;
+
+	while (1) {
+		if (capture_batch(cap) > 0)
+			continue;
+		if (atomic_load(&cap->cap_stop) &&
+		    xc_ring_is_empty(&cap->cap_ring))
+			break;
+
+		/*
+		 * Pairs with the fence in xc_capture_add(): either the
+		 * producer sees cap_sleeping or we see the new record.
+		 */
+		pthread_mutex_lock(&cap->cap_lock);
+		atomic_store(&cap->cap_sleeping, true);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (xc_ring_is_empty(&cap->cap_ring) &&
+		    !atomic_load(&cap->cap_stop))
+			pthread_cond_wait(&cap->cap_cond, &cap->cap_lock);
+		atomic_store(&cap->cap_sleeping, false);
+		pthread_mutex_unlock(&cap->cap_lock);
+	}
+
+	return NULL;
+}
+
+static void capture_kick(struct xc_capture *cap)
+{
+	pthread_mutex_lock(&cap->cap_lock);
+	pthread_cond_signal(&cap->cap_cond);
+	pthread_mutex_unlock(&cap->cap_lock);
+}
+
+int xc_capture_open(struct xc_capture *cap,
+		    const char        *path,
+		    unsigned           sync_period)
+{
+	struct xc_cap_header hdr;
+	struct iovec         iov;
+	sigset_t             set;
+	sigset_t             oldset;
+	int                  rc;
+
+	memset(cap, 0, sizeof(*cap));
+	atomic_init(&cap->cap_sleeping, false);
+	atomic_init(&cap->cap_stop, false);
+	atomic_init(&cap->cap_dropped, 0);
+	cap->cap_sync_period = sync_period;
+	cap->cap_time_offset = xc_capture_time_offset();
+
+	rc = xc_ring_init(&cap->cap_ring, XC_CAPTURE_RING_SIZE);
+	if (rc != 0)
+		return rc;
+
+	/* The traffic may contain credentials. */
+	cap->cap_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			   0600);
+	if (cap->cap_fd < 0) {
+		rc = -errno;
+		goto ring_fini;
+	}
+
+	xc_capture_header_init(&hdr);
+	iov.iov_base = &hdr;
+	iov.iov_len = sizeof(hdr);
+	rc = capture_write(cap, &iov, 1, sizeof(hdr));
+	if (rc != 0)
+		goto fd_close;
+
+	pthread_mutex_init(&cap->cap_lock, NULL);
+	pthread_cond_init(&cap->cap_cond, NULL);
+
+	/* Signals must be delivered to the event loop thread. */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	rc = -pthread_create(&cap->cap_thread, NULL, capture_thread, cap);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (rc != 0)
+		goto cond_fini;
+
+	return 0;
+
+cond_fini:
+	pthread_cond_destroy(&cap->cap_cond);
+	pthread_mutex_destroy(&cap->cap_lock);
+fd_close:
+	close(cap->cap_fd);
+ring_fini:
+	xc_ring_fini(&cap->cap_ring);
+
+	return rc;
+}
+
+int xc_capture_close(struct xc_capture *cap)
+{
+	int rc;
+
+	atomic_store(&cap->cap_stop, true);
+	capture_kick(cap);
+	pthread_join(cap->cap_thread, NULL);
+
+	if (cap->cap_index_nr > 0)
+		(void)capture_index_write(cap);
+	(void)capture_trailer_write(cap);
+	rc = cap->cap_error;
+	if (rc == 0 && fsync(cap->cap_fd) != 0)
+		rc = -errno;
+	if (close(cap->cap_fd) != 0 && rc == 0)
+		rc = -errno;
+
+	pthread_cond_destroy(&cap->cap_cond);
+	pthread_mutex_destroy(&cap->cap_lock);
+	xc_ring_fini(&cap->cap_ring);
+
+	return rc;
+}
+
+void xc_capture_add(struct xc_capture      *cap,
+		    const struct xc_record *rec,
+		    const char             *payload)
+{
+	struct xc_cap_block *blk;
+	size_t               pad = XC_CAP_PAD(rec->rec_len);
+	size_t               len = sizeof(*blk) + rec->rec_len + pad;
+
+	blk = xc_ring_fits(&cap->cap_ring, len) ?
+	      xc_ring_reserve(&cap->cap_ring, len) : NULL;
+	if (blk == NULL) {
+		/* The writer can't keep up, don't block the event loop. */
+		atomic_fetch_add_explicit(&cap->cap_dropped, 1,
+					  memory_order_relaxed);
+		return;
+	}
+	xc_capture_block_init(blk, rec, cap->cap_time_offset);
+	memcpy(blk + 1, payload, rec->rec_len);
+	memset((char *)(blk + 1) + rec->rec_len, 0, pad);
+	xc_ring_commit(&cap->cap_ring, len);
+
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&cap->cap_sleeping, memory_order_relaxed))
+		capture_kick(cap);
+}
+
+size_t xc_capture_dropped(struct xc_capture *cap)
+{
+	return atomic_load_explicit(&cap->cap_dropped, memory_order_relaxed);
+}
+
+/* Returns the block at 'pos' if it is complete and has the type. */
+static const struct xc_cap_block *
+capture_file_block(struct xc_capture_file *cf, uint64_t pos, uint32_t type)
+{
+	const struct xc_cap_block *blk;
+
+	if (pos < sizeof(struct xc_cap_header) || pos % XC_CAP_ALIGN != 0 ||
+	    pos > cf->cf_size || cf->cf_size - pos < sizeof(*blk))
+		return NULL;
+	blk = (const struct xc_cap_block *)(cf->cf_map + pos);
+	if (blk->cb_type != type ||
+	    cf->cf_size - pos - sizeof(*blk) < blk->cb_len)
+		return NULL;
+
+	return blk;
+}
+
+/*
+ * Copies the index blocks which the trailer points to. Index block N points
+ * to records [N * PERIOD, (N + 1) * PERIOD), entries are checked by seek.
+ */
+static int capture_file_index_load(struct xc_capture_file *cf)
+{
+	const struct xc_cap_block       *blk;
+	const struct xc_cap_trailer     *trl;
+	const struct xc_cap_index       *idx;
+	const struct xc_cap_index_entry *entries;
+	uint64_t                         blocks_nr;
+	uint64_t                         left;
+	uint64_t                         pos;
+	size_t                           len;
+	size_t                           nr;
+	size_t                           i;
+
+	len = sizeof(*blk) + sizeof(*trl);
+	blk = cf->cf_size < len ? NULL :
+	      capture_file_block(cf, cf->cf_size - len, XC_CAP_TRAILER);
+	if (blk == NULL || blk->cb_len != sizeof(*trl))
+		return -EINVAL;
+	trl = (const struct xc_cap_trailer *)(blk + 1);
+	/* Every record takes a block header at least. */
+	if (trl->ct_records_nr > cf->cf_size / sizeof(*blk))
+		return -EINVAL;
+
+	cf->cf_records_nr = trl->ct_records_nr;
+	cf->cf_index_nr = (size_t)((cf->cf_records_nr + XC_CAP_INDEX_STEP - 1) /
+				   XC_CAP_INDEX_STEP);
+	cf->cf_index = malloc((cf->cf_index_nr + 1) * sizeof(*cf->cf_index));
+	if (cf->cf_index == NULL)
+		return -ENOMEM;
+
+	blocks_nr = (cf->cf_records_nr + XC_CAP_INDEX_PERIOD - 1) /
+		    XC_CAP_INDEX_PERIOD;
+	pos = trl->ct_index;
+	while (blocks_nr > 0) {
+		--blocks_nr;
+		left = cf->cf_records_nr - blocks_nr * XC_CAP_INDEX_PERIOD;
+		nr = (size_t)((MIN(left, XC_CAP_INDEX_PERIOD) +
+			       XC_CAP_INDEX_STEP - 1) / XC_CAP_INDEX_STEP);
+		blk = capture_file_block(cf, pos, XC_CAP_INDEX);
+		if (blk == NULL || blk->cb_len < sizeof(*idx))
+			return -EINVAL;
+		idx = (const struct xc_cap_index *)(blk + 1);
+		if (idx->ci_entries_nr != nr ||
+		    blk->cb_len < sizeof(*idx) + nr * sizeof(*entries))
+			return -EINVAL;
+		entries = (const struct xc_cap_index_entry *)(idx + 1);
+		for (i = 0; i < nr; ++i) {
+			cf->cf_index[blocks_nr * (XC_CAP_INDEX_PERIOD /
+						  XC_CAP_INDEX_STEP) + i] =
+				entries[i].ce_offset;
+		}
+		pos = idx->ci_prev;
+	}
+
+	return 0;
+}
+
+/*
+ * Builds the index of a file without the trailer, for example, a flight
+ * recorder dump or a capture which wasn't closed. Only block headers are
+ * read.
+ */
+static int capture_file_index_scan(struct xc_capture_file *cf)
+{
+	const struct xc_cap_block *blk;
+	uint64_t                  *index;
+	uint64_t                   pos = sizeof(struct xc_cap_header);
+	size_t                     size = 0;
+
+	cf->cf_records_nr = 0;
+	cf->cf_index_nr = 0;
+	while (pos <= cf->cf_size && cf->cf_size - pos >= sizeof(*blk)) {
+		blk = (const struct xc_cap_block *)(cf->cf_map + pos);
+		/* A truncated block ends the file. */
+		if (cf->cf_size - pos - sizeof(*blk) < blk->cb_len)
+			break;
+		if (blk->cb_type == XC_CAP_RECORD &&
+		    cf->cf_records_nr++ % XC_CAP_INDEX_STEP == 0) {
+			if (cf->cf_index_nr == size) {
+				size = size == 0 ? XC_CAP_INDEX_PERIOD /
+						   XC_CAP_INDEX_STEP :
+						   size * 2;
+				index = realloc(cf->cf_index,
+						size * sizeof(*index));
+				if (index == NULL)
+					return -ENOMEM;
+				cf->cf_index = index;
+			}
+			cf->cf_index[cf->cf_index_nr++] = pos;
+		}
+		pos += sizeof(*blk) + blk->cb_len + XC_CAP_PAD(blk->cb_len);
+	}
+
+	return 0;
+}
+
+int xc_capture_file_open(struct xc_capture_file *cf, const char *path)
+{
+	const struct xc_cap_header *hdr;
+	struct stat                 st;
+	void                       *map;
+	int                         fd;
+	int                         rc = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (fstat(fd, &st) != 0)
+		rc = -errno;
+	else if ((size_t)st.st_size < sizeof(*hdr))
+		rc = -EINVAL;
+	if (rc != 0) {
+		close(fd);
+		return rc;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	rc = map == MAP_FAILED ? -errno : 0;
+	/* Mapping keeps a reference to the file. */
+	close(fd);
+	if (rc != 0)
+		return rc;
+
+	hdr = map;
+	if (memcmp(hdr->ch_magic, XC_CAP_MAGIC, sizeof(XC_CAP_MAGIC)) != 0 ||
+	    hdr->ch_version != XC_CAP_VERSION ||
+	    hdr->ch_byte_order != XC_CAP_BYTE_ORDER) {
+		munmap(map, (size_t)st.st_size);
+		return -EINVAL;
+	}
+
+	cf->cf_map = map;
+	cf->cf_size = (size_t)st.st_size;
+	cf->cf_pos = sizeof(*hdr);
+	cf->cf_nr = 0;
+	cf->cf_index = NULL;
+	rc = capture_file_index_load(cf);
+	if (rc == -EINVAL) {
+		free(cf->cf_index);
+		cf->cf_index = NULL;
+		rc = capture_file_index_scan(cf);
+	}
+	if (rc != 0)
+		xc_capture_file_close(cf);
+
+	return rc;
+}
+
+void xc_capture_file_close(struct xc_capture_file *cf)
+{
+	munmap((void *)cf->cf_map, cf->cf_size);
+	free(cf->cf_index);
+	cf->cf_map = NULL;
+	cf->cf_index = NULL;
+}
+
+const struct xc_cap_block *xc_capture_file_next(struct xc_capture_file *cf)
+{
+	const struct xc_cap_block *blk;
+
+	while (cf->cf_pos <= cf->cf_size &&
+	       cf->cf_size - cf->cf_pos >= sizeof(*blk)) {
+		blk = (const struct xc_cap_block *)(cf->cf_map + cf->cf_pos);
+		/* A truncated block ends the file. */
+		if (cf->cf_size - cf->cf_pos - sizeof(*blk) < blk->cb_len)
+			break;
+		cf->cf_pos += sizeof(*blk) + blk->cb_len +
+			      XC_CAP_PAD(blk->cb_len);
+		if (blk->cb_type == XC_CAP_RECORD) {
+			++cf->cf_nr;
+			return blk;
+		}
+	}
+	return NULL;
+}
+
+void xc_capture_file_seek(struct xc_capture_file *cf, uint64_t nr)
+{
+	size_t slot = (size_t)(nr / XC_CAP_INDEX_STEP);
+
+	cf->cf_pos = cf->cf_size;
+	cf->cf_nr = cf->cf_records_nr;
+	if (nr >= cf->cf_records_nr || slot >= cf->cf_index_nr ||
+	    capture_file_block(cf, cf->cf_index[slot], XC_CAP_RECORD) == NULL)
+		return;
+
+	cf->cf_pos = cf->cf_index[slot];
+	cf->cf_nr = (uint64_t)slot * XC_CAP_INDEX_STEP;
+	while (cf->cf_nr < nr && xc_capture_file_next(cf) != NULL)
+		;
+}
@@ -0,0 +1,186 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XC_CAPTURE_H__
+#define __XC_CAPTURE_H__
+
+#include "ring.h"
+#include "store.h"
+
+#include <pthread.h>	/* pthread_t */
+#include <stdatomic.h>	/* atomic_bool */
+#include <stddef.h>	/* size_t */
+#include <stdint.h>	/* uint32_t */
+#include <sys/uio.h>	/* struct iovec */
+
+/*
+ * Capture file of the XMPP traffic.
+ *
+ * The file starts with struct xc_cap_header followed by blocks. Every block
+ * is struct xc_cap_block and its payload padded to XC_CAP_ALIGN bytes.
+ * Integers are in the byte order of the host which wrote the file, readers
+ * detect it with ch_byte_order. Time is the wall clock in nanoseconds.
+ *
+ * A sparse index block follows every XC_CAP_INDEX_PERIOD records. It points
+ * to every XC_CAP_INDEX_STEP-th record and to the previous index block.
+ * A complete file ends with a trailer which points to the last index block,
+ * so a reader can seek by time without scanning the whole file. Index
+ * blocks and the trailer are optional, for example, flight recorder dumps
+ * don't have them.
+ */
+
+#define XC_CAP_MAGIC "XCCAP\r\n"
+#define XC_CAP_VERSION 1
+#define XC_CAP_BYTE_ORDER 0x01020304
+#define XC_CAP_ALIGN 8
+#define XC_CAP_PAD(len) ((XC_CAP_ALIGN - (len) % XC_CAP_ALIGN) % XC_CAP_ALIGN)
+
+struct xc_cap_header {
+	char     ch_magic[8];
+	uint32_t ch_version;
+	uint32_t ch_byte_order;
+};
+
+typedef enum {
+	/* Payload is a piece of the stream. */
+	XC_CAP_RECORD = 1,
+	/* Payload is struct xc_cap_index and its entries. */
+	XC_CAP_INDEX = 2,
+	/* Payload is struct xc_cap_trailer. */
+	XC_CAP_TRAILER = 3,
+} xc_cap_type_t;
+
+struct xc_cap_block {
+	uint32_t cb_type;
+	/* Length of the payload without padding. */
+	uint32_t cb_len;
+	uint64_t cb_time;
+	uint32_t cb_conn;
+	uint32_t cb_dir;
+};
+
+#define XC_CAP_INDEX_PERIOD 4096
+#define XC_CAP_INDEX_STEP 64
+
+struct xc_cap_index_entry {
+	uint64_t ce_time;
+	/* Offset of the record's block in the file. */
+	uint64_t ce_offset;
+};
+
+struct xc_cap_index {
+	/* Offset of the previous index block or 0. */
+	uint64_t ci_prev;
+	uint64_t ci_entries_nr;
+	/* Followed by ci_entries_nr of struct xc_cap_index_entry. */
+};
+
+struct xc_cap_trailer {
+	uint64_t ct_index;
+	uint64_t ct_records_nr;
+};
+
+/*
+ * Asynchronous writer of a capture file. The event loop only copies records
+ * to a lock-free ring and a writer thread writes them in batches with
+ * writev(2). Records are dropped when the ring is full, so the event loop
+ * never waits for the disk.
+ */
+struct xc_capture {
+	struct xc_ring             cap_ring;
+	pthread_t                  cap_thread;
+	pthread_mutex_t            cap_lock;
+	pthread_cond_t             cap_cond;
+	atomic_bool                cap_sleeping;
+	atomic_bool                cap_stop;
+	atomic_size_t              cap_dropped;
+	uint64_t                   cap_time_offset;
+	int                        cap_fd;
+	/* Number of records between fdatasync(2) calls, 0 disables them. */
+	unsigned                   cap_sync_period;
+	/* Following fields belong to the writer thread. */
+	int                        cap_error;
+	uint64_t                   cap_pos;
+	uint64_t                   cap_records_nr;
+	uint64_t                   cap_unsynced;
+	uint64_t                   cap_index_prev;
+	struct xc_cap_index_entry  cap_index[XC_CAP_INDEX_PERIOD /
+					     XC_CAP_INDEX_STEP];
+	size_t                     cap_index_nr;
+};
+
+#define XC_CAPTURE_RING_SIZE (32 * 1024 * 1024)
+
+/*
+ * Read-only capture file mapped to memory. Only block headers are read on
+ * open to build a sparse index, payloads are read by the kernel when they
+ * are accessed.
+ */
+struct xc_capture_file {
+	const char *cf_map;
+	size_t      cf_size;
+	/* Offset of the block which xc_capture_file_next() checks next. */
+	uint64_t    cf_pos;
+	/* Number of the record at cf_pos. */
+	uint64_t    cf_nr;
+	uint64_t    cf_records_nr;
+	/* Offsets of every XC_CAP_INDEX_STEP-th record. */
+	uint64_t   *cf_index;
+	size_t      cf_index_nr;
+};
+
+void xc_capture_header_init(struct xc_cap_header *hdr);
+void xc_capture_block_init(struct xc_cap_block    *blk,
+			   const struct xc_record *rec,
+			   uint64_t                time_offset);
+/* Offset which converts monotonic time of records to the wall clock. */
+uint64_t xc_capture_time_offset(void);
+/* Writes all the vectors, retrying on partial writes. */
+int xc_capture_writev(int fd, struct iovec *iov, int iovcnt);
+
+/*
+ * Writes records of the store to a new capture file. The file is replaced
+ * atomically, so readers never see a partial dump.
+ */
+int xc_capture_dump(const char *path, struct xc_store *store);
+
+int  xc_capture_open(struct xc_capture *cap,
+		     const char        *path,
+		     unsigned           sync_period);
+/* Writes the remaining records, the trailer and closes the file. */
+int  xc_capture_close(struct xc_capture *cap);
+/* Called from the event loop, never blocks. */
+void xc_capture_add(struct xc_capture      *cap,
+		    const struct xc_record *rec,
+		    const char             *payload);
+size_t xc_capture_dropped(struct xc_capture *cap);
+
+int  xc_capture_file_open(struct xc_capture_file *cf, const char *path);
+void xc_capture_file_close(struct xc_capture_file *cf);
+/*
+ * Positions the file at record 'nr', or at the end if there is no such
+ * record. The file's index blocks are used if it has the trailer, other
+ * files are indexed by a scan of block headers on open.
+ */
+void xc_capture_file_seek(struct xc_capture_file *cf, uint64_t nr);
+/* Returns the next record or NULL at the end of the file. */
+const struct xc_cap_block *
+xc_capture_file_next(struct xc_capture_file *cf);
+
+#endif /* __XC_CAPTURE_H__ */
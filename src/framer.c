@@ -0,0 +1,244 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "framer.h"
+
+#include <string.h>
+
+enum {
+	FRAMER_TEXT,
+	FRAMER_TAG,		/* Just after '<'. */
+	FRAMER_STAG,		/* Start or empty-element tag. */
+	FRAMER_ETAG,		/* End tag. */
+	FRAMER_PI,		/* <? ... ?> */
+	FRAMER_BANG,		/* Just after "<!". */
+	FRAMER_COMMENT,		/* <!-- ... --> */
+	FRAMER_CDATA,		/* <![CDATA[ ... ]]> */
+	FRAMER_DECL,		/* <!DOCTYPE ... > */
+};
+
+#define FRAMER_STREAM_TAG "stream:stream"
+
+void xc_framer_init(struct xc_framer *framer)
+{
+	memset(framer, 0, sizeof(*framer));
+	framer->f_state = FRAMER_TEXT;
+}
+
+static void framer_name_add(struct xc_framer *framer, char c)
+{
+	if (framer->f_name_len < XC_FRAMER_NAME_MAX)
+		framer->f_name[framer->f_name_len] = c;
+	++framer->f_name_len;
+}
+
+static int framer_is_stream(struct xc_framer *framer)
+{
+	return framer->f_name_len == sizeof(FRAMER_STREAM_TAG) - 1 &&
+	       memcmp(framer->f_name, FRAMER_STREAM_TAG,
+		      sizeof(FRAMER_STREAM_TAG) - 1) == 0;
+}
+
+/* Top-level markup which isn't an element belongs to the next element. */
+static void framer_prolog_end(struct xc_framer *framer)
+{
+	framer->f_state = FRAMER_TEXT;
+	if (framer->f_depth == 0)
+		framer->f_attach = true;
+}
+
+/* Matches terminating sequence 'seq' byte by byte. */
+static int framer_match(struct xc_framer *framer, char c, const char *seq)
+{
+	size_t len = strlen(seq);
+
+	if (c == seq[framer->f_match]) {
+		++framer->f_match;
+	} else {
+		/* All supported sequences repeat only their first char. */
+		framer->f_match = c == seq[0] ? 1 : 0;
+		if (framer->f_match == 1 && len > 2 && seq[1] == seq[0] &&
+		    framer->f_prev == seq[0])
+			framer->f_match = 2;
+	}
+	if (framer->f_match == len) {
+		framer->f_match = 0;
+		return 1;
+	}
+	return 0;
+}
+
+/* Stops at the first boundary if 'is_first' is set. */
+static size_t framer_scan(struct xc_framer *framer,
+			  const char       *buf,
+			  size_t            len,
+			  bool              is_first)
+{
+	size_t boundary = 0;
+	size_t i;
+	char   c;
+
+	for (i = 0; i < len; ++i) {
+		c = buf[i];
+		switch (framer->f_state) {
+		case FRAMER_TEXT:
+			if (c == '<') {
+				framer->f_state = FRAMER_TAG;
+				framer->f_name_len = 0;
+			} else if (c == '\n' && framer->f_depth == 0 &&
+				   !framer->f_attach) {
+				boundary = i + 1;
+			}
+			break;
+		case FRAMER_TAG:
+			if (c == '/') {
+				framer->f_state = FRAMER_ETAG;
+			} else if (c == '?') {
+				framer->f_state = FRAMER_PI;
+				framer->f_match = 0;
+			} else if (c == '!') {
+				framer->f_state = FRAMER_BANG;
+				framer->f_match = 0;
+			} else {
+				framer->f_state = FRAMER_STAG;
+				framer->f_quote = '\0';
+				framer->f_name_done = false;
+				framer_name_add(framer, c);
+			}
+			break;
+		case FRAMER_STAG:
+			if (framer->f_quote != '\0') {
+				if (c == framer->f_quote)
+					framer->f_quote = '\0';
+			} else if (c == '"' || c == '\'') {
+				framer->f_quote = c;
+				framer->f_name_done = true;
+			} else if (c == '>') {
+				framer->f_state = FRAMER_TEXT;
+				if (framer->f_prev == '/') {
+					/* Empty-element tag. */
+				} else if (framer->f_depth == 0 &&
+					   framer_is_stream(framer)) {
+					/* Stream header never closes. */
+				} else {
+					++framer->f_depth;
+				}
+				if (framer->f_depth == 0) {
+					boundary = i + 1;
+					framer->f_attach = false;
+				}
+			} else if (!framer->f_name_done) {
+				if (c == ' ' || c == '\t' || c == '\r' ||
+				    c == '\n' || c == '/')
+					framer->f_name_done = true;
+				else
+					framer_name_add(framer, c);
+			}
+			break;
+		case FRAMER_ETAG:
+			if (c == '>') {
+				framer->f_state = FRAMER_TEXT;
+				if (framer->f_depth > 0)
+					--framer->f_depth;
+				/* </stream:stream> closes at the top level. */
+				if (framer->f_depth == 0) {
+					boundary = i + 1;
+					framer->f_attach = false;
+				}
+			}
+			break;
+		case FRAMER_PI:
+			if (framer_match(framer, c, "?>"))
+				framer_prolog_end(framer);
+			break;
+		case FRAMER_BANG:
+			/* Distinguish "<!--", "<![CDATA[" and "<!DOCTYPE". */
+			if (c == '-' && framer->f_match == 0) {
+				framer->f_match = 1;
+			} else if (c == '-' && framer->f_match == 1) {
+				framer->f_state = FRAMER_COMMENT;
+				framer->f_match = 0;
+			} else if (c == '[') {
+				framer->f_state = FRAMER_CDATA;
+				framer->f_match = 0;
+			} else if (c == '>') {
+				framer_prolog_end(framer);
+			} else {
+				framer->f_state = FRAMER_DECL;
+			}
+			break;
+		case FRAMER_COMMENT:
+			if (framer_match(framer, c, "-->"))
+				framer_prolog_end(framer);
+			break;
+		case FRAMER_CDATA:
+			if (framer_match(framer, c, "]]>"))
+				framer->f_state = FRAMER_TEXT;
+			break;
+		case FRAMER_DECL:
+			if (c == '>')
+				framer_prolog_end(framer);
+			break;
+		}
+		framer->f_prev = c;
+		if (is_first && boundary > 0)
+			break;
+	}
+
+	return boundary;
+}
+
+size_t xc_framer_scan(struct xc_framer *framer, const char *buf, size_t len)
+{
+	return framer_scan(framer, buf, len, false);
+}
+
+size_t xc_framer_next(struct xc_framer *framer, const char *buf, size_t len)
+{
+	return framer_scan(framer, buf, len, true);
+}
+
+bool xc_framer_find_stream(const char *buf,
+			   size_t      len,
+			   size_t     *start,
+			   size_t     *end)
+{
+	static const char  tag[] = "<" FRAMER_STREAM_TAG;
+	const char        *last = buf + len;
+	const char        *tag_xml = NULL;
+	const char        *ptr = buf;
+
+	while ((ptr = memchr(ptr, '<', last - ptr)) != NULL) {
+		if (ptr + 1 < last && ptr[1] == '?') {
+			if (tag_xml == NULL)
+				tag_xml = ptr;
+		} else if ((size_t)(last - ptr) >= sizeof(tag) - 1 &&
+			   memcmp(ptr, tag, sizeof(tag) - 1) == 0) {
+			break;
+		}
+		++ptr;
+	}
+	if (ptr == NULL)
+		return false;
+
+	*start = (size_t)((tag_xml != NULL ? tag_xml : ptr) - buf);
+	ptr = memchr(ptr, '>', last - ptr);
+	*end = ptr != NULL ? (size_t)(ptr + 1 - buf) : len;
+	return true;
+}
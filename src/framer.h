@@ -0,0 +1,80 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XC_FRAMER_H__
+#define __XC_FRAMER_H__
+
+#include <stdbool.h>	/* bool */
+#include <stddef.h>	/* size_t */
+
+/*
+ * Incremental framer of an XML stream. It tracks depth of elements across
+ * chunks of input and finds boundaries of complete top-level elements.
+ * Opening and closing tags of <stream:stream> are considered as complete
+ * units, so a whole XMPP stream can be piped.
+ *
+ * Text outside of elements is a unit when it ends with a new line. XML
+ * declarations, comments and DOCTYPE at the top level are attached to the
+ * following element.
+ */
+
+#define XC_FRAMER_NAME_MAX 16
+
+struct xc_framer {
+	int          f_state;
+	unsigned     f_depth;
+	char         f_quote;
+	char         f_prev;
+	/* A declaration, comment or DOCTYPE waits for the next element. */
+	bool         f_attach;
+	/* Number of matched bytes of a terminating sequence. */
+	size_t       f_match;
+	/* Prefix of the current tag name. */
+	char         f_name[XC_FRAMER_NAME_MAX];
+	size_t       f_name_len;
+	bool         f_name_done;
+};
+
+void xc_framer_init(struct xc_framer *framer);
+
+/*
+ * Scans the next chunk of the stream. Returns offset within the chunk just
+ * after the last complete unit or 0 if the chunk doesn't complete any unit.
+ */
+size_t xc_framer_scan(struct xc_framer *framer, const char *buf, size_t len);
+
+/*
+ * Same as xc_framer_scan(), but stops just after the first complete unit,
+ * so the caller can walk the units one by one. The rest of the chunk is
+ * passed to the next call.
+ */
+size_t xc_framer_next(struct xc_framer *framer, const char *buf, size_t len);
+
+/*
+ * Finds the first <stream:stream> tag of a message with a single forward
+ * scan. 'start' is set to the XML declaration before the tag or to the tag
+ * itself, 'end' just after the tag or to 'len' if it isn't terminated.
+ * Returns false if the message doesn't open a stream.
+ */
+bool xc_framer_find_stream(const char *buf,
+			   size_t      len,
+			   size_t     *start,
+			   size_t     *end);
+
+#endif /* __XC_FRAMER_H__ */
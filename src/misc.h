@@ -20,12 +20,39 @@
 #ifndef __XMPPCONSOLE_MISC_H__
 #define __XMPPCONSOLE_MISC_H__
 
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 
 #ifndef ARRAY_SIZE
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 #endif
 
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
 #define xc_streq(s1, s2) (strcmp((s1), (s2)) == 0)
 
+/* Monotonic time in nanoseconds. */
+static inline uint64_t xc_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/* Monotonic time in milliseconds. */
+static inline uint64_t xc_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
 #endif /* __XMPPCONSOLE_MISC_H__ */
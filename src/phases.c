@@ -0,0 +1,132 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "misc.h"
+#include "phases.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/* Names of phases in the machine readable line. */
+static const char *phases_names[XC_PHASE_NR] = {
+	[XC_PHASE_START]       = "start",
+	[XC_PHASE_RESOLVED]    = "resolved",
+	[XC_PHASE_CONNECTED]   = "connected",
+	[XC_PHASE_FEATURES]    = "features",
+	[XC_PHASE_TLS_PROCEED] = "tls_proceed",
+	[XC_PHASE_TLS_DONE]    = "tls_done",
+	[XC_PHASE_PASSWD]      = "passwd",
+	[XC_PHASE_SASL]        = "sasl",
+	[XC_PHASE_READY]       = "ready",
+};
+
+/*
+ * Names of intervals which end with the phase in the breakdown for UI.
+ * Phases without a name are merged into the next interval.
+ */
+static const char *phases_steps[XC_PHASE_NR] = {
+	[XC_PHASE_START]       = NULL,
+	[XC_PHASE_RESOLVED]    = "dns",
+	[XC_PHASE_CONNECTED]   = "tcp",
+	[XC_PHASE_FEATURES]    = "stream",
+	[XC_PHASE_TLS_PROCEED] = NULL,
+	[XC_PHASE_TLS_DONE]    = "tls",
+	[XC_PHASE_PASSWD]      = "passwd",
+	[XC_PHASE_SASL]        = "sasl",
+	[XC_PHASE_READY]       = "bind",
+};
+
+void xc_phases_start(struct xc_phases *ph, uint32_t conn)
+{
+	struct timespec ts;
+
+	memset(ph, 0, sizeof(*ph));
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ph->ph_wall = (uint64_t)ts.tv_sec * 1000 +
+		      (uint64_t)ts.tv_nsec / 1000000;
+	ph->ph_conn = conn;
+	xc_phases_mark(ph, XC_PHASE_START);
+}
+
+void xc_phases_mark(struct xc_phases *ph, xc_phase_t phase)
+{
+	if (!ph->ph_is_done && ph->ph_time[phase] == 0)
+		ph->ph_time[phase] = xc_time_ns();
+}
+
+bool xc_phases_is_marked(struct xc_phases *ph, xc_phase_t phase)
+{
+	return ph->ph_time[phase] != 0;
+}
+
+static double phases_ms(uint64_t from, uint64_t to)
+{
+	return (double)(to - from) / 1000000;
+}
+
+void xc_phases_format(struct xc_phases *ph, char *buf, size_t size)
+{
+	uint64_t start = ph->ph_time[XC_PHASE_START];
+	uint64_t prev = start;
+	uint64_t last = start;
+	char     steps[96];
+	size_t   len = 0;
+	int      i;
+
+	steps[0] = '\0';
+	for (i = XC_PHASE_START + 1; i < XC_PHASE_NR; ++i) {
+		if (ph->ph_time[i] == 0)
+			continue;
+		last = ph->ph_time[i];
+		if (phases_steps[i] == NULL || len >= sizeof(steps))
+			continue;
+		len += (size_t)snprintf(steps + len, sizeof(steps) - len,
+					"%s%s %.0f", len > 0 ? " " : "",
+					phases_steps[i], phases_ms(prev, last));
+		prev = last;
+	}
+	snprintf(buf, size, "login %s%.0fms%s%s%s",
+		 xc_phases_is_marked(ph, XC_PHASE_READY) ? "" : "failed ",
+		 phases_ms(start, last), len > 0 ? " (" : "", steps,
+		 len > 0 ? ")" : "");
+}
+
+void xc_phases_format_line(struct xc_phases *ph, char *buf, size_t size)
+{
+	size_t len;
+	int    i;
+
+	len = (size_t)snprintf(buf, size, "conn=%u wall=%llu",
+			       (unsigned)ph->ph_conn,
+			       (unsigned long long)ph->ph_wall);
+	for (i = XC_PHASE_START + 1; i < XC_PHASE_NR && len < size; ++i) {
+		if (ph->ph_time[i] == 0)
+			continue;
+		len += (size_t)snprintf(buf + len, size - len, " %s=%.3f",
+					phases_names[i],
+					phases_ms(ph->ph_time[XC_PHASE_START],
+						  ph->ph_time[i]));
+	}
+	if (len < size) {
+		snprintf(buf + len, size - len, " result=%s",
+			 xc_phases_is_marked(ph, XC_PHASE_READY) ?
+			 "ok" : "failed");
+	}
+}
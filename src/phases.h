@@ -0,0 +1,78 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XC_PHASES_H__
+#define __XC_PHASES_H__
+
+#include <stdbool.h>	/* bool */
+#include <stddef.h>	/* size_t */
+#include <stdint.h>	/* uint64_t */
+
+/*
+ * Timestamps of the phases of a connection attempt. A phase is marked once
+ * per attempt, so it can be detected by several sources: raw mode handlers
+ * and taps which see the traffic of libstrophe's own negotiation. Marks
+ * of a finished attempt are ignored.
+ */
+
+typedef enum {
+	XC_PHASE_START,
+	/* Address is resolved and a socket is created. */
+	XC_PHASE_RESOLVED,
+	/* TCP connection is established. */
+	XC_PHASE_CONNECTED,
+	XC_PHASE_FEATURES,
+	XC_PHASE_TLS_PROCEED,
+	XC_PHASE_TLS_DONE,
+	/* Password is entered while the connection is prepared. */
+	XC_PHASE_PASSWD,
+	XC_PHASE_SASL,
+	/* Session is established or raw stream is open. */
+	XC_PHASE_READY,
+	XC_PHASE_NR,
+} xc_phase_t;
+
+struct xc_phases {
+	/* Monotonic time in nanoseconds, 0 if the phase isn't reached. */
+	uint64_t ph_time[XC_PHASE_NR];
+	/* Wall clock time of the start in milliseconds. */
+	uint64_t ph_wall;
+	uint32_t ph_conn;
+	bool     ph_is_done;
+};
+
+/* Number of the last connection attempts which are kept. */
+#define XC_PHASES_HISTORY 8
+
+void xc_phases_start(struct xc_phases *ph, uint32_t conn);
+void xc_phases_mark(struct xc_phases *ph, xc_phase_t phase);
+bool xc_phases_is_marked(struct xc_phases *ph, xc_phase_t phase);
+
+/*
+ * Human readable breakdown of the attempt, e.g.
+ * "login 182ms (dns 12 tcp 28 stream 20 tls 60 sasl 42 bind 20)".
+ */
+void xc_phases_format(struct xc_phases *ph, char *buf, size_t size);
+/*
+ * Machine readable line with offsets of the reached phases from the start
+ * in milliseconds, e.g. "conn=1 wall=<ms> resolved=12.022 ... result=ok".
+ */
+void xc_phases_format_line(struct xc_phases *ph, char *buf, size_t size);
+
+#endif /* __XC_PHASES_H__ */
@@ -0,0 +1,454 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pretty.h"
+#include "misc.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PRETTY_INDENT 2
+#define PRETTY_BUF_MIN 4096
+#define PRETTY_SPANS_MIN 64
+
+typedef enum {
+	PRETTY_TEXT,
+	PRETTY_START,
+	PRETTY_END,
+	/* Self-closing tag. */
+	PRETTY_EMPTY,
+	/* Comments, CDATA sections, PIs and DOCTYPE. */
+	PRETTY_OTHER,
+} pretty_token_t;
+
+struct pretty_token {
+	pretty_token_t t_type;
+	size_t         t_pos;
+	size_t         t_end;
+};
+
+void xc_pretty_init(struct xc_pretty *pretty)
+{
+	pretty->p_buf = NULL;
+	pretty->p_len = 0;
+	pretty->p_size = 0;
+	pretty->p_spans = NULL;
+	pretty->p_spans_nr = 0;
+	pretty->p_spans_size = 0;
+}
+
+void xc_pretty_fini(struct xc_pretty *pretty)
+{
+	free(pretty->p_buf);
+	free(pretty->p_spans);
+	xc_pretty_init(pretty);
+}
+
+static int pretty_reserve(struct xc_pretty *pretty, size_t len)
+{
+	size_t  size;
+	char   *buf;
+
+	/* Keep space for the terminating null character. */
+	if (pretty->p_len + len < pretty->p_size)
+		return 0;
+
+	size = MAX(pretty->p_size * 2, pretty->p_len + len + 1);
+	size = MAX(size, PRETTY_BUF_MIN);
+	buf = realloc(pretty->p_buf, size);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	pretty->p_buf = buf;
+	pretty->p_size = size;
+
+	return 0;
+}
+
+static int pretty_append(struct xc_pretty *pretty, const char *s, size_t len)
+{
+	int rc;
+
+	rc = pretty_reserve(pretty, len);
+	if (rc == 0) {
+		memcpy(pretty->p_buf + pretty->p_len, s, len);
+		pretty->p_len += len;
+		pretty->p_buf[pretty->p_len] = '\0';
+	}
+	return rc;
+}
+
+/* Adjacent spans of the same kind are merged. */
+static int pretty_span_add(struct xc_pretty *pretty,
+			   size_t            off,
+			   size_t            len,
+			   xc_pretty_kind_t  kind)
+{
+	struct xc_pretty_span *span;
+	size_t                 size;
+
+	if (len == 0)
+		return 0;
+
+	if (pretty->p_spans_nr > 0) {
+		span = &pretty->p_spans[pretty->p_spans_nr - 1];
+		if (span->ps_kind == kind &&
+		    span->ps_off + span->ps_len == off) {
+			span->ps_len += len;
+			return 0;
+		}
+	}
+	if (pretty->p_spans_nr == pretty->p_spans_size) {
+		size = MAX(pretty->p_spans_size * 2, PRETTY_SPANS_MIN);
+		span = realloc(pretty->p_spans, size * sizeof(*span));
+		if (span == NULL)
+			return -ENOMEM;
+		pretty->p_spans = span;
+		pretty->p_spans_size = size;
+	}
+	span = &pretty->p_spans[pretty->p_spans_nr++];
+	span->ps_off = off;
+	span->ps_len = len;
+	span->ps_kind = kind;
+
+	return 0;
+}
+
+static bool pretty_is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool pretty_is_name_end(char c)
+{
+	return pretty_is_space(c) || c == '=' || c == '>' || c == '/';
+}
+
+/* Splits a tag which starts at 'off' of the output into spans. */
+static int pretty_tag_spans(struct xc_pretty *pretty,
+			    size_t            off,
+			    const char       *tag,
+			    size_t            len)
+{
+	size_t i = 1;
+	size_t start;
+	char   quote;
+	int    rc;
+
+	if (i < len && tag[i] == '/')
+		++i;
+	while (i < len && !pretty_is_name_end(tag[i]))
+		++i;
+	rc = pretty_span_add(pretty, off, i, XC_PRETTY_TAG);
+
+	while (rc == 0 && i < len) {
+		start = i;
+		if (pretty_is_space(tag[i]) || tag[i] == '=') {
+			++i;
+		} else if (tag[i] == '"' || tag[i] == '\'') {
+			quote = tag[i++];
+			while (i < len && tag[i] != quote)
+				++i;
+			i = MIN(i + 1, len);
+			rc = pretty_span_add(pretty, off + start, i - start,
+					     XC_PRETTY_VALUE);
+		} else if (tag[i] == '>' || tag[i] == '/') {
+			rc = pretty_span_add(pretty, off + start, len - start,
+					     XC_PRETTY_TAG);
+			i = len;
+		} else {
+			while (i < len && !pretty_is_name_end(tag[i]))
+				++i;
+			rc = pretty_span_add(pretty, off + start, i - start,
+					     XC_PRETTY_ATTR);
+		}
+	}
+	return rc;
+}
+
+static int pretty_append_token(struct xc_pretty          *pretty,
+			       const char                *xml,
+			       const struct pretty_token *tok,
+			       unsigned                   flags)
+{
+	const char *s = xml + tok->t_pos;
+	size_t      len = tok->t_end - tok->t_pos;
+	size_t      off = pretty->p_len;
+	int         rc;
+
+	rc = pretty_append(pretty, s, len);
+	if (rc != 0 || !(flags & XC_PRETTY_SPANS))
+		return rc;
+
+	switch (tok->t_type) {
+	case PRETTY_TEXT:
+		break;
+	case PRETTY_START:
+	case PRETTY_END:
+	case PRETTY_EMPTY:
+		rc = pretty_tag_spans(pretty, off, s, len);
+		break;
+	case PRETTY_OTHER:
+		rc = pretty_span_add(pretty, off, len, XC_PRETTY_COMMENT);
+		break;
+	}
+	return rc;
+}
+
+/* Starts a new line with indentation. */
+static int pretty_indent(struct xc_pretty *pretty, unsigned depth)
+{
+	size_t len = (size_t)depth * PRETTY_INDENT;
+	int    rc;
+
+	rc = pretty_reserve(pretty, len + 1);
+	if (rc == 0) {
+		if (pretty->p_len > 0)
+			pretty->p_buf[pretty->p_len++] = '\n';
+		memset(pretty->p_buf + pretty->p_len, ' ', len);
+		pretty->p_len += len;
+		pretty->p_buf[pretty->p_len] = '\0';
+	}
+	return rc;
+}
+
+static bool pretty_has_prefix(const char *xml,
+			      size_t      len,
+			      size_t      pos,
+			      const char *prefix)
+{
+	size_t prefix_len = strlen(prefix);
+
+	return len - pos >= prefix_len &&
+	       memcmp(xml + pos, prefix, prefix_len) == 0;
+}
+
+/* Returns position just after 'seq' or 'len' if it isn't found. */
+static size_t pretty_skip_to(const char *xml,
+			     size_t      len,
+			     size_t      pos,
+			     const char *seq)
+{
+	size_t seq_len = strlen(seq);
+
+	for (; pos + seq_len <= len; ++pos) {
+		if (memcmp(xml + pos, seq, seq_len) == 0)
+			return pos + seq_len;
+	}
+	return len;
+}
+
+static void pretty_token_next(const char          *xml,
+			      size_t               len,
+			      size_t               pos,
+			      struct pretty_token *tok)
+{
+	const char *lt;
+	char        quote = '\0';
+	size_t      i;
+
+	tok->t_pos = pos;
+	if (pos >= len || xml[pos] != '<') {
+		lt = pos < len ? memchr(xml + pos, '<', len - pos) : NULL;
+		tok->t_type = PRETTY_TEXT;
+		tok->t_end = lt == NULL ? MAX(pos, len) : (size_t)(lt - xml);
+		return;
+	}
+	if (pretty_has_prefix(xml, len, pos, "<!--")) {
+		tok->t_type = PRETTY_OTHER;
+		tok->t_end = pretty_skip_to(xml, len, pos + 4, "-->");
+		return;
+	}
+	if (pretty_has_prefix(xml, len, pos, "<![CDATA[")) {
+		tok->t_type = PRETTY_OTHER;
+		tok->t_end = pretty_skip_to(xml, len, pos + 9, "]]>");
+		return;
+	}
+
+	if (pos + 1 < len && xml[pos + 1] == '/')
+		tok->t_type = PRETTY_END;
+	else if (pos + 1 < len && (xml[pos + 1] == '?' || xml[pos + 1] == '!'))
+		tok->t_type = PRETTY_OTHER;
+	else
+		tok->t_type = PRETTY_START;
+
+	for (i = pos + 1; i < len; ++i) {
+		if (quote != '\0') {
+			if (xml[i] == quote)
+				quote = '\0';
+		} else if (xml[i] == '"' || xml[i] == '\'') {
+			quote = xml[i];
+		} else if (xml[i] == '>') {
+			if (tok->t_type == PRETTY_START && xml[i - 1] == '/')
+				tok->t_type = PRETTY_EMPTY;
+			tok->t_end = i + 1;
+			return;
+		}
+	}
+	tok->t_end = len;
+}
+
+/* Strips whitespace around text. Returns false if nothing is left. */
+static bool pretty_text_trim(const char *xml, size_t *pos, size_t *end)
+{
+	while (*pos < *end && pretty_is_space(xml[*pos]))
+		++*pos;
+	while (*end > *pos && pretty_is_space(xml[*end - 1]))
+		--*end;
+
+	return *pos < *end;
+}
+
+/* Long text which consists only of base64 characters and whitespace. */
+static bool pretty_is_base64(const char *xml, const struct pretty_token *tok)
+{
+	size_t i;
+	char   c;
+
+	if (tok->t_type != PRETTY_TEXT ||
+	    tok->t_end - tok->t_pos <= XC_PRETTY_FOLD_WIDTH)
+		return false;
+
+	for (i = tok->t_pos; i < tok->t_end; ++i) {
+		c = xml[i];
+		if (!isalnum((unsigned char)c) && c != '+' && c != '/' &&
+		    c != '=' && !pretty_is_space(c))
+			return false;
+	}
+	return true;
+}
+
+/* Appends base64 text split into indented lines of the same width. */
+static int pretty_fold(struct xc_pretty          *pretty,
+		       const char                *xml,
+		       const struct pretty_token *tok,
+		       unsigned                   depth)
+{
+	size_t i = tok->t_pos;
+	size_t line = XC_PRETTY_FOLD_WIDTH;
+	size_t n;
+	int    rc = 0;
+
+	while (rc == 0 && i < tok->t_end) {
+		if (pretty_is_space(xml[i])) {
+			++i;
+			continue;
+		}
+		if (line == XC_PRETTY_FOLD_WIDTH) {
+			rc = pretty_indent(pretty, depth);
+			line = 0;
+		}
+		for (n = 0; i + n < tok->t_end &&
+			    line + n < XC_PRETTY_FOLD_WIDTH &&
+			    !pretty_is_space(xml[i + n]); ++n)
+			;
+		rc = rc ?: pretty_append(pretty, xml + i, n);
+		line += n;
+		i += n;
+	}
+	return rc;
+}
+
+int xc_pretty_format(struct xc_pretty *pretty,
+		     const char       *xml,
+		     size_t            len,
+		     unsigned          flags)
+{
+	struct pretty_token tok;
+	struct pretty_token next;
+	struct pretty_token close;
+	unsigned            depth = 0;
+	size_t              pos = 0;
+	bool                is_fold = (flags & XC_PRETTY_FOLD) != 0;
+	int                 rc;
+
+	pretty->p_len = 0;
+	pretty->p_spans_nr = 0;
+	rc = pretty_reserve(pretty, len);
+	if (rc == 0)
+		pretty->p_buf[0] = '\0';
+
+	while (rc == 0 && pos < len) {
+		pretty_token_next(xml, len, pos, &tok);
+		pos = tok.t_end;
+
+		if (!(flags & XC_PRETTY_INDENT)) {
+			rc = is_fold && pretty_is_base64(xml, &tok) ?
+			     pretty_fold(pretty, xml, &tok, 0) :
+			     pretty_append_token(pretty, xml, &tok, flags);
+			continue;
+		}
+
+		switch (tok.t_type) {
+		case PRETTY_TEXT:
+			if (is_fold && pretty_is_base64(xml, &tok)) {
+				rc = pretty_fold(pretty, xml, &tok, depth);
+			} else if (pretty_text_trim(xml, &tok.t_pos,
+						    &tok.t_end)) {
+				rc = pretty_indent(pretty, depth) ?:
+				     pretty_append_token(pretty, xml, &tok,
+							 flags);
+			}
+			break;
+		case PRETTY_START:
+			rc = pretty_indent(pretty, depth) ?:
+			     pretty_append_token(pretty, xml, &tok, flags);
+			if (rc != 0)
+				break;
+			/*
+			 * Keep elements like <body>text</body> on one line
+			 * unless the text is going to be folded.
+			 */
+			pretty_token_next(xml, len, pos, &next);
+			close = next;
+			if (next.t_type == PRETTY_TEXT && next.t_end < len)
+				pretty_token_next(xml, len, next.t_end, &close);
+			if (close.t_type == PRETTY_END &&
+			    !(is_fold && pretty_is_base64(xml, &next))) {
+				if (next.t_type == PRETTY_TEXT) {
+					rc = pretty_append_token(pretty, xml,
+								 &next, flags);
+				}
+				rc = rc ?: pretty_append_token(pretty, xml,
+							       &close, flags);
+				pos = close.t_end;
+			} else {
+				++depth;
+			}
+			break;
+		case PRETTY_END:
+			depth = depth > 0 ? depth - 1 : 0;
+			/* Fall through. */
+		case PRETTY_EMPTY:
+		case PRETTY_OTHER:
+			rc = pretty_indent(pretty, depth) ?:
+			     pretty_append_token(pretty, xml, &tok, flags);
+			break;
+		}
+	}
+	return rc;
+}
+
+int xc_pretty_print(struct xc_pretty *pretty, const char *xml, size_t len)
+{
+	return xc_pretty_format(pretty, xml, len, XC_PRETTY_INDENT);
+}
@@ -0,0 +1,81 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XC_PRETTY_H__
+#define __XC_PRETTY_H__
+
+#include <stddef.h>	/* size_t */
+
+/*
+ * Pretty-printer for XML stanzas. Every element starts on a new line and is
+ * indented by its depth. Elements which contain only text are kept on
+ * a single line. Input doesn't have to be well-formed, for example an
+ * opening <stream:stream> tag without the closing one is fine.
+ *
+ * The formatter can also split markup into spans for highlighting. It
+ * doesn't depend on any UI, so it can run in a worker thread.
+ */
+
+typedef enum {
+	/* Tag names with angle brackets. */
+	XC_PRETTY_TAG,
+	XC_PRETTY_ATTR,
+	/* Attribute values with quotes. */
+	XC_PRETTY_VALUE,
+	/* Comments, CDATA sections, PIs and DOCTYPE. */
+	XC_PRETTY_COMMENT,
+	XC_PRETTY_KINDS_NR,
+} xc_pretty_kind_t;
+
+struct xc_pretty_span {
+	size_t           ps_off;
+	size_t           ps_len;
+	xc_pretty_kind_t ps_kind;
+};
+
+/* Flags of xc_pretty_format(). Without XC_PRETTY_INDENT text is kept. */
+#define XC_PRETTY_INDENT 0x1
+/* Long base64 text is split into lines of XC_PRETTY_FOLD_WIDTH. */
+#define XC_PRETTY_FOLD   0x2
+#define XC_PRETTY_SPANS  0x4
+
+#define XC_PRETTY_FOLD_WIDTH 76
+
+struct xc_pretty {
+	char                  *p_buf;
+	size_t                 p_len;
+	size_t                 p_size;
+	/* Spans are sorted by offset and don't overlap. */
+	struct xc_pretty_span *p_spans;
+	size_t                 p_spans_nr;
+	size_t                 p_spans_size;
+};
+
+void xc_pretty_init(struct xc_pretty *pretty);
+void xc_pretty_fini(struct xc_pretty *pretty);
+
+/* Replaces content of the buffer with formatted 'xml'. */
+int xc_pretty_format(struct xc_pretty *pretty,
+		     const char       *xml,
+		     size_t            len,
+		     unsigned          flags);
+/* Same as xc_pretty_format() with XC_PRETTY_INDENT. */
+int xc_pretty_print(struct xc_pretty *pretty, const char *xml, size_t len);
+
+#endif /* __XC_PRETTY_H__ */
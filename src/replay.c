@@ -0,0 +1,157 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "misc.h"
+#include "replay.h"
+#include "xmpp.h"
+
+#include <string.h>
+#include <strophe.h>
+
+/* Stanzas sent per timer callback, so the event loop isn't starved. */
+#define REPLAY_BATCH 256
+/* Send queue length which pauses the replay for a tick. */
+#define REPLAY_QUEUE_MAX 1024
+
+static bool replay_is_name(const char *p, const char *end, const char *name)
+{
+	size_t len = strlen(name);
+
+	return (size_t)(end - p) > len && memcmp(p, name, len) == 0 &&
+	       (p[len] == ' ' || p[len] == '/' || p[len] == '>' ||
+		p[len] == '\t' || p[len] == '\r' || p[len] == '\n');
+}
+
+/*
+ * Only stanzas are replayed. Stream headers, TLS and SASL negotiation
+ * belong to the original connection.
+ */
+static bool replay_is_stanza(const struct xc_cap_block *blk)
+{
+	const char *p = (const char *)(blk + 1);
+	const char *end = p + blk->cb_len;
+
+	if (blk->cb_dir != XC_DIR_SENT)
+		return false;
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+		++p;
+	if (p == end || *p++ != '<')
+		return false;
+
+	return replay_is_name(p, end, "message") ||
+	       replay_is_name(p, end, "presence") ||
+	       replay_is_name(p, end, "iq");
+}
+
+static const struct xc_cap_block *replay_next(struct xc_replay *rp)
+{
+	const struct xc_cap_block *blk;
+
+	do {
+		blk = xc_capture_file_next(&rp->rp_file);
+	} while (blk != NULL && !replay_is_stanza(blk));
+
+	return blk;
+}
+
+static uint64_t replay_due(struct xc_replay *rp, const struct xc_cap_block *blk)
+{
+	uint64_t elapsed = blk->cb_time / 1000000 - rp->rp_file_base;
+
+	if (rp->rp_speed == 0)
+		return 0;
+	return rp->rp_base + (uint64_t)((double)elapsed / rp->rp_speed);
+}
+
+static void replay_timer_cb(struct xc_timer *timer, void *userdata)
+{
+	struct xc_replay *rp = userdata;
+	struct xc_ctx    *ctx = rp->rp_ctx;
+	uint64_t          now = xc_time_ms();
+	uint64_t          due;
+	int               i;
+
+#ifdef HAVE_XMPP_CONN_SEND_QUEUE_LEN
+	/* Don't queue the whole file when the server is slower. */
+	if (xmpp_conn_send_queue_len(ctx->c_conn) > REPLAY_QUEUE_MAX) {
+		xc_timer_arm(&ctx->c_wheel, timer, now + 1);
+		return;
+	}
+#endif
+	for (i = 0; i < REPLAY_BATCH && rp->rp_next != NULL; ++i) {
+		due = replay_due(rp, rp->rp_next);
+		if (due > now) {
+			xc_timer_arm(&ctx->c_wheel, timer, due);
+			return;
+		}
+		xc_send_buf(ctx, (const char *)(rp->rp_next + 1),
+			    rp->rp_next->cb_len);
+		++rp->rp_sent_nr;
+		rp->rp_next = replay_next(rp);
+	}
+	if (rp->rp_next != NULL)
+		xc_timer_arm(&ctx->c_wheel, timer, now);
+}
+
+int xc_replay_init(struct xc_replay *rp,
+		   struct xc_ctx    *ctx,
+		   const char       *path,
+		   double            speed)
+{
+	int rc;
+
+	memset(rp, 0, sizeof(*rp));
+	rc = xc_capture_file_open(&rp->rp_file, path);
+	if (rc != 0)
+		return rc;
+
+	rp->rp_ctx = ctx;
+	rp->rp_speed = speed;
+	rp->rp_next = replay_next(rp);
+	xc_timer_init(&rp->rp_timer, replay_timer_cb, rp);
+
+	return 0;
+}
+
+void xc_replay_fini(struct xc_replay *rp)
+{
+	xc_timer_disarm(&rp->rp_ctx->c_wheel, &rp->rp_timer);
+	xc_capture_file_close(&rp->rp_file);
+}
+
+void xc_replay_start(struct xc_replay *rp)
+{
+	if (rp->rp_next == NULL)
+		return;
+
+	/* Intervals are kept from the first stanza after (re)connection. */
+	rp->rp_file_base = rp->rp_next->cb_time / 1000000;
+	rp->rp_base = xc_time_ms();
+	xc_timer_arm(&rp->rp_ctx->c_wheel, &rp->rp_timer, rp->rp_base);
+}
+
+void xc_replay_stop(struct xc_replay *rp)
+{
+	xc_timer_disarm(&rp->rp_ctx->c_wheel, &rp->rp_timer);
+}
+
+bool xc_replay_is_done(struct xc_replay *rp)
+{
+	return rp->rp_next == NULL;
+}
@@ -0,0 +1,61 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XC_REPLAY_H__
+#define __XC_REPLAY_H__
+
+#include "capture.h"
+#include "wheel.h"
+
+#include <stdbool.h>	/* bool */
+#include <stdint.h>	/* uint64_t */
+
+/* Forward declarations */
+struct xc_ctx;
+
+/*
+ * Replays stanzas sent in a capture file over the current connection. The
+ * file is read sequentially and a single timer is armed for the next
+ * stanza, so memory usage doesn't depend on the size of the file.
+ */
+struct xc_replay {
+	struct xc_capture_file     rp_file;
+	struct xc_timer            rp_timer;
+	struct xc_ctx             *rp_ctx;
+	/* The next stanza to send or NULL at the end of the file. */
+	const struct xc_cap_block *rp_next;
+	/* Speed multiplier, 0 sends stanzas as fast as possible. */
+	double                     rp_speed;
+	/* Time of rp_next in the file and when it is due, in ms. */
+	uint64_t                   rp_file_base;
+	uint64_t                   rp_base;
+	unsigned long              rp_sent_nr;
+};
+
+int  xc_replay_init(struct xc_replay *rp,
+		    struct xc_ctx    *ctx,
+		    const char       *path,
+		    double            speed);
+void xc_replay_fini(struct xc_replay *rp);
+/* Starts or resumes the replay when the connection is established. */
+void xc_replay_start(struct xc_replay *rp);
+void xc_replay_stop(struct xc_replay *rp);
+bool xc_replay_is_done(struct xc_replay *rp);
+
+#endif /* __XC_REPLAY_H__ */
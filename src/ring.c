@@ -0,0 +1,137 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Every record starts with its length aligned to the header size. */
+#define RING_HDR_SIZE sizeof(size_t)
+#define RING_WRAP SIZE_MAX
+#define RING_REC_SIZE(len) \
+	(RING_HDR_SIZE + (((len) + RING_HDR_SIZE - 1) & ~(RING_HDR_SIZE - 1)))
+
+static size_t *ring_hdr(struct xc_ring *ring, size_t pos)
+{
+	return (size_t *)(ring->r_buf + (pos & (ring->r_size - 1)));
+}
+
+int xc_ring_init(struct xc_ring *ring, size_t size)
+{
+	size_t rsize = RING_HDR_SIZE * 2;
+
+	while (rsize < size)
+		rsize <<= 1;
+
+	ring->r_buf = malloc(rsize);
+	if (ring->r_buf == NULL)
+		return -ENOMEM;
+
+	ring->r_size = rsize;
+	ring->r_skip = 0;
+	ring->r_read = 0;
+	atomic_init(&ring->r_head, 0);
+	atomic_init(&ring->r_tail, 0);
+
+	return 0;
+}
+
+void xc_ring_fini(struct xc_ring *ring)
+{
+	free(ring->r_buf);
+	ring->r_buf = NULL;
+}
+
+bool xc_ring_fits(struct xc_ring *ring, size_t len)
+{
+	/* In the worst case a record wraps and wastes the ring's tail. */
+	return RING_REC_SIZE(len) <= ring->r_size / 2;
+}
+
+void *xc_ring_reserve(struct xc_ring *ring, size_t len)
+{
+	size_t tail = atomic_load_explicit(&ring->r_tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring->r_head, memory_order_acquire);
+	size_t need = RING_REC_SIZE(len);
+	size_t contig = ring->r_size - (tail & (ring->r_size - 1));
+	size_t skip = need > contig ? contig : 0;
+
+	if (ring->r_size - (tail - head) < skip + need)
+		return NULL;
+
+	if (skip > 0) {
+		*ring_hdr(ring, tail) = RING_WRAP;
+		tail += skip;
+	}
+	ring->r_skip = skip;
+	*ring_hdr(ring, tail) = len;
+
+	return (char *)ring_hdr(ring, tail) + RING_HDR_SIZE;
+}
+
+void xc_ring_commit(struct xc_ring *ring, size_t len)
+{
+	size_t tail = atomic_load_explicit(&ring->r_tail, memory_order_relaxed);
+	size_t *hdr = ring_hdr(ring, tail + ring->r_skip);
+
+	/* Record may be shrunk, but not enlarged. */
+	assert(len <= *hdr);
+	*hdr = len;
+	tail += ring->r_skip + RING_REC_SIZE(len);
+	ring->r_skip = 0;
+	atomic_store_explicit(&ring->r_tail, tail, memory_order_release);
+}
+
+void *xc_ring_peek(struct xc_ring *ring, size_t *len)
+{
+	size_t  pos = ring->r_read;
+	size_t  tail = atomic_load_explicit(&ring->r_tail, memory_order_acquire);
+	size_t *hdr;
+
+	if (pos == tail)
+		return NULL;
+
+	hdr = ring_hdr(ring, pos);
+	if (*hdr == RING_WRAP) {
+		pos += ring->r_size - (pos & (ring->r_size - 1));
+		ring->r_read = pos;
+		if (pos == tail)
+			return NULL;
+		hdr = ring_hdr(ring, pos);
+	}
+	ring->r_read = pos + RING_REC_SIZE(*hdr);
+	*len = *hdr;
+
+	return (char *)hdr + RING_HDR_SIZE;
+}
+
+void xc_ring_release(struct xc_ring *ring)
+{
+	atomic_store_explicit(&ring->r_head, ring->r_read,
+			      memory_order_release);
+}
+
+bool xc_ring_is_empty(struct xc_ring *ring)
+{
+	return atomic_load_explicit(&ring->r_head, memory_order_acquire) ==
+	       atomic_load_explicit(&ring->r_tail, memory_order_acquire);
+}
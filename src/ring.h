@@ -0,0 +1,65 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XC_RING_H__
+#define __XC_RING_H__
+
+#include <stdatomic.h>	/* atomic_size_t */
+#include <stdbool.h>	/* bool */
+#include <stddef.h>	/* size_t */
+
+/*
+ * Lock-free single-producer/single-consumer ring of variable-length
+ * records. Every record is stored contiguously, so the producer can build
+ * a record in place and the consumer can use it without copying.
+ *
+ * The producer calls xc_ring_reserve() and publishes the record with
+ * xc_ring_commit(). The consumer gets the oldest record with xc_ring_peek()
+ * and frees its space with xc_ring_release(). The consumer may peek several
+ * records in a row to process them as a batch, xc_ring_release() frees all
+ * the peeked records then.
+ */
+
+struct xc_ring {
+	char          *r_buf;
+	size_t         r_size;
+	/* Consumer position. */
+	atomic_size_t  r_head;
+	/* Producer position. */
+	atomic_size_t  r_tail;
+	/* Producer private: bytes skipped at the end of the buffer. */
+	size_t         r_skip;
+	/* Consumer private: position after the peeked records. */
+	size_t         r_read;
+};
+
+/* Size is rounded up to a power of 2. */
+int xc_ring_init(struct xc_ring *ring, size_t size);
+void xc_ring_fini(struct xc_ring *ring);
+
+bool xc_ring_fits(struct xc_ring *ring, size_t len);
+void *xc_ring_reserve(struct xc_ring *ring, size_t len);
+void xc_ring_commit(struct xc_ring *ring, size_t len);
+
+void *xc_ring_peek(struct xc_ring *ring, size_t *len);
+void xc_ring_release(struct xc_ring *ring);
+
+bool xc_ring_is_empty(struct xc_ring *ring);
+
+#endif /* __XC_RING_H__ */
@@ -0,0 +1,362 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "misc.h"
+#include "rtt.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t rtt_hash(const char *id, size_t len)
+{
+	/* FNV-1a */
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t   i;
+
+	for (i = 0; i < len; ++i) {
+		hash ^= (unsigned char)id[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash != 0 ? hash : 1;
+}
+
+static size_t rtt_bucket(uint64_t us)
+{
+	unsigned shift;
+	size_t   idx;
+
+	if (us < XC_RTT_SUB_BUCKETS)
+		return (size_t)us;
+
+	shift = 63 - (unsigned)__builtin_clzll(us) - XC_RTT_SUB_BITS;
+	idx = (shift + 1) * XC_RTT_SUB_BUCKETS +
+	      (size_t)(us >> shift) - XC_RTT_SUB_BUCKETS;
+
+	return idx < XC_RTT_BUCKETS ? idx : XC_RTT_BUCKETS - 1;
+}
+
+/* Returns the lowest value of the bucket. */
+static uint64_t rtt_bucket_value(size_t idx)
+{
+	unsigned shift;
+
+	if (idx < XC_RTT_SUB_BUCKETS)
+		return idx;
+
+	shift = (unsigned)(idx / XC_RTT_SUB_BUCKETS) - 1;
+	return (uint64_t)(idx % XC_RTT_SUB_BUCKETS + XC_RTT_SUB_BUCKETS) <<
+	       shift;
+}
+
+int xc_rtt_init(struct xc_rtt *rtt, size_t size)
+{
+	memset(rtt, 0, sizeof(*rtt));
+	for (rtt->rt_size = 16; rtt->rt_size < size; rtt->rt_size <<= 1)
+		;
+	rtt->rt_table = calloc(rtt->rt_size, sizeof(*rtt->rt_table));
+
+	return rtt->rt_table == NULL ? -ENOMEM : 0;
+}
+
+void xc_rtt_fini(struct xc_rtt *rtt)
+{
+	free(rtt->rt_table);
+	rtt->rt_table = NULL;
+}
+
+static size_t rtt_slot(struct xc_rtt *rtt, uint64_t key)
+{
+	return (size_t)key & (rtt->rt_size - 1);
+}
+
+/* Backward shift deletion keeps probe sequences without tombstones. */
+static void rtt_del(struct xc_rtt *rtt, size_t i)
+{
+	size_t mask = rtt->rt_size - 1;
+	size_t j = i;
+	size_t k;
+
+	while (1) {
+		j = (j + 1) & mask;
+		if (rtt->rt_table[j].re_key == 0)
+			break;
+		k = rtt_slot(rtt, rtt->rt_table[j].re_key);
+		/* Move the entry if its home slot isn't in (i, j]. */
+		if ((i < j && (k <= i || k > j)) ||
+		    (i > j && k <= i && k > j)) {
+			rtt->rt_table[i] = rtt->rt_table[j];
+			i = j;
+		}
+	}
+	rtt->rt_table[i].re_key = 0;
+	--rtt->rt_nr;
+}
+
+static void rtt_expire(struct xc_rtt *rtt, uint64_t now)
+{
+	size_t i = 0;
+
+	while (i < rtt->rt_size) {
+		if (rtt->rt_table[i].re_key != 0 &&
+		    now - rtt->rt_table[i].re_time > XC_RTT_TIMEOUT_NS) {
+			/* An entry is shifted to slot i, check it again. */
+			rtt_del(rtt, i);
+			++rtt->rt_expired;
+		} else {
+			++i;
+		}
+	}
+}
+
+void xc_rtt_sent(struct xc_rtt *rtt, const char *id, size_t len,
+		 uint64_t time)
+{
+	uint64_t key = rtt_hash(id, len);
+	size_t   mask = rtt->rt_size - 1;
+	size_t   i;
+
+	/* Keep the load factor low, so probe sequences are short. */
+	if (rtt->rt_nr >= rtt->rt_size / 4 * 3)
+		rtt_expire(rtt, time);
+	if (rtt->rt_nr >= rtt->rt_size / 4 * 3) {
+		++rtt->rt_untracked;
+		return;
+	}
+
+	for (i = rtt_slot(rtt, key); rtt->rt_table[i].re_key != 0;
+	     i = (i + 1) & mask) {
+		/* A reused id, the latest request wins. */
+		if (rtt->rt_table[i].re_key == key)
+			break;
+	}
+	if (rtt->rt_table[i].re_key == 0)
+		++rtt->rt_nr;
+	rtt->rt_table[i].re_key = key;
+	rtt->rt_table[i].re_time = time;
+}
+
+bool xc_rtt_received(struct xc_rtt *rtt, const char *id, size_t len,
+		     uint64_t time)
+{
+	uint64_t key = rtt_hash(id, len);
+	uint64_t us;
+	size_t   mask = rtt->rt_size - 1;
+	size_t   i;
+
+	for (i = rtt_slot(rtt, key); rtt->rt_table[i].re_key != key;
+	     i = (i + 1) & mask) {
+		if (rtt->rt_table[i].re_key == 0)
+			return false;
+	}
+
+	us = (time - rtt->rt_table[i].re_time) / 1000;
+	rtt_del(rtt, i);
+	++rtt->rt_counts[rtt_bucket(us)];
+	++rtt->rt_total;
+	if (us > rtt->rt_max)
+		rtt->rt_max = us;
+
+	return true;
+}
+
+/* Returns pointer after 'term' or 'end'. */
+static const char *rtt_skip(const char *p, const char *end, const char *term)
+{
+	size_t len = strlen(term);
+
+	for (; (size_t)(end - p) >= len; ++p) {
+		if (memcmp(p, term, len) == 0)
+			return p + len;
+	}
+	return end;
+}
+
+static bool rtt_is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* Cheap check which lets most messages skip the parser. */
+static bool rtt_has_iq(const char *xml, const char *end)
+{
+	const char *p = xml;
+
+	while ((p = memchr(p, '<', end - p)) != NULL) {
+		if (end - p > 2 && p[1] == 'i' && p[2] == 'q')
+			return true;
+		++p;
+	}
+	return false;
+}
+
+/* Returns true if the character can be a part of an attribute name. */
+static bool rtt_is_attr_char(char c)
+{
+	return !rtt_is_space(c) && c != '=' && c != '/' && c != '>' &&
+	       c != '"' && c != '\'';
+}
+
+size_t xc_rtt_iq_without_id(const char *xml, size_t len, size_t *offs,
+			    size_t max)
+{
+	static const char  stream[] = "stream:stream";
+	const char        *end = xml + len;
+	const char        *p = xml;
+	const char        *name;
+	const char        *tag_end;
+	const char        *term;
+	const char        *attr;
+	const char        *eq;
+	unsigned           depth = 0;
+	bool               has_id;
+	char               quote;
+	size_t             nr = 0;
+
+	if (!rtt_has_iq(xml, end))
+		return 0;
+
+	while ((p = memchr(p, '<', end - p)) != NULL) {
+		if (++p == end)
+			break;
+		/* Skip CDATA, comments, DOCTYPE and processing instructions. */
+		term = NULL;
+		if (*p == '!' && p + 1 < end && p[1] == '[')
+			term = "]]>";
+		else if (*p == '!' && p + 1 < end && p[1] == '-')
+			term = "-->";
+		else if (*p == '!')
+			term = ">";
+		else if (*p == '?')
+			term = "?>";
+		if (term != NULL) {
+			p = rtt_skip(p, end, term);
+			continue;
+		}
+		if (*p == '/') {
+			depth -= depth > 0;
+			continue;
+		}
+
+		name = p;
+		has_id = false;
+		for (tag_end = p; tag_end < end && *tag_end != '>'; ++tag_end) {
+			if (*tag_end == '"' || *tag_end == '\'') {
+				quote = *tag_end++;
+				while (tag_end < end && *tag_end != quote)
+					++tag_end;
+				if (tag_end == end)
+					break;
+			} else if (rtt_is_space(tag_end[-1]) &&
+				   rtt_is_attr_char(*tag_end)) {
+				/* Whitespace is allowed around '='. */
+				attr = tag_end;
+				while (tag_end < end &&
+				       rtt_is_attr_char(*tag_end))
+					++tag_end;
+				for (eq = tag_end; eq < end && rtt_is_space(*eq);
+				     ++eq)
+					;
+				if (tag_end - attr == 2 &&
+				    memcmp(attr, "id", 2) == 0 &&
+				    eq < end && *eq == '=')
+					has_id = true;
+				/* The loop checks the character after it. */
+				--tag_end;
+			}
+		}
+		if (depth == 0 && !has_id && end - name > 2 &&
+		    memcmp(name, "iq", 2) == 0 &&
+		    (rtt_is_space(name[2]) || name[2] == '/' ||
+		     name[2] == '>')) {
+			if (nr < max)
+				offs[nr] = (size_t)(name + 2 - xml);
+			++nr;
+		}
+		/* Stream header doesn't wrap stanzas as an element here. */
+		if (tag_end < end && tag_end[-1] != '/' &&
+		    !((size_t)(end - name) >= sizeof(stream) - 1 &&
+		      memcmp(name, stream, sizeof(stream) - 1) == 0))
+			++depth;
+		p = tag_end;
+	}
+	return nr;
+}
+
+uint64_t xc_rtt_percentile(struct xc_rtt *rtt, double p)
+{
+	uint64_t need = (uint64_t)((double)rtt->rt_total * p / 100 + 0.5);
+	uint64_t sum = 0;
+	uint64_t mid;
+	size_t   i;
+
+	if (rtt->rt_total == 0)
+		return 0;
+	if (need == 0)
+		need = 1;
+
+	for (i = 0; i < XC_RTT_BUCKETS; ++i) {
+		sum += rtt->rt_counts[i];
+		if (sum >= need)
+			break;
+	}
+	/* The middle of the bucket, but not above the maximum. */
+	if (i + 1 >= XC_RTT_BUCKETS)
+		return rtt->rt_max;
+	mid = (rtt_bucket_value(i) + rtt_bucket_value(i + 1)) / 2;
+	return MIN(mid, rtt->rt_max);
+}
+
+void xc_rtt_format(char *buf, size_t size, uint64_t us)
+{
+	if (us < 1000)
+		snprintf(buf, size, "%uus", (unsigned)us);
+	else if (us < 1000000)
+		snprintf(buf, size, "%.1fms", (double)us / 1000);
+	else
+		snprintf(buf, size, "%.2fs", (double)us / 1000000);
+}
+
+void xc_rtt_print(struct xc_rtt *rtt, FILE *stream)
+{
+	static const double percentiles[] = { 50, 90, 99, 99.9 };
+	size_t              i;
+
+	fprintf(stream, "rtt_replies %llu\n",
+		(unsigned long long)rtt->rt_total);
+	fprintf(stream, "rtt_pending %zu\n", rtt->rt_nr);
+	fprintf(stream, "rtt_expired %llu\n",
+		(unsigned long long)rtt->rt_expired);
+	fprintf(stream, "rtt_untracked %llu\n",
+		(unsigned long long)rtt->rt_untracked);
+	for (i = 0; i < ARRAY_SIZE(percentiles); ++i) {
+		fprintf(stream, "rtt_p%g_us %llu\n", percentiles[i],
+			(unsigned long long)xc_rtt_percentile(rtt,
+							      percentiles[i]));
+	}
+	fprintf(stream, "rtt_max_us %llu\n", (unsigned long long)rtt->rt_max);
+	/* Buckets are "lowest value in us" and count. */
+	for (i = 0; i < XC_RTT_BUCKETS; ++i) {
+		if (rtt->rt_counts[i] != 0) {
+			fprintf(stream, "rtt_bucket %llu %llu\n",
+				(unsigned long long)rtt_bucket_value(i),
+				(unsigned long long)rtt->rt_counts[i]);
+		}
+	}
+}
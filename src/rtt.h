@@ -0,0 +1,89 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XC_RTT_H__
+#define __XC_RTT_H__
+
+#include <stdbool.h>	/* bool */
+#include <stddef.h>	/* size_t */
+#include <stdint.h>	/* uint64_t */
+#include <stdio.h>	/* FILE */
+
+/*
+ * Round-trip times of IQ requests. Ids of pending requests are kept in an
+ * open-addressing hash table with linear probing, replies are matched by
+ * the id and their RTTs are counted in a log-linear histogram.
+ *
+ * The histogram has XC_RTT_SUB_BUCKETS linear buckets per power of 2, so
+ * relative error of a reported value is below 1 / XC_RTT_SUB_BUCKETS.
+ * Values are in microseconds.
+ */
+
+#define XC_RTT_SUB_BITS 5
+#define XC_RTT_SUB_BUCKETS (1U << XC_RTT_SUB_BITS)
+/* Up to 2^40 us, longer RTTs are counted in the last bucket. */
+#define XC_RTT_BUCKETS ((40 - XC_RTT_SUB_BITS + 1) * XC_RTT_SUB_BUCKETS)
+/* Requests without replies are forgotten after the timeout. */
+#define XC_RTT_TIMEOUT_NS (60ULL * 1000000000)
+
+struct xc_rtt_entry {
+	/* Hash of the id, 0 marks an empty slot. */
+	uint64_t re_key;
+	uint64_t re_time;
+};
+
+struct xc_rtt {
+	struct xc_rtt_entry *rt_table;
+	size_t               rt_size;
+	size_t               rt_nr;
+	uint64_t             rt_counts[XC_RTT_BUCKETS];
+	uint64_t             rt_total;
+	uint64_t             rt_max;
+	/* Requests which weren't tracked because the table was full. */
+	uint64_t             rt_untracked;
+	uint64_t             rt_expired;
+};
+
+/* Size is the maximum number of pending requests, rounded up to 2^N. */
+int  xc_rtt_init(struct xc_rtt *rtt, size_t size);
+void xc_rtt_fini(struct xc_rtt *rtt);
+
+void xc_rtt_sent(struct xc_rtt *rtt, const char *id, size_t len,
+		 uint64_t time);
+/* Returns true if the reply matches a pending request. */
+bool xc_rtt_received(struct xc_rtt *rtt, const char *id, size_t len,
+		     uint64_t time);
+
+/*
+ * Finds top-level <iq/> elements without id in the XML. Returns number of
+ * them and stores up to 'max' offsets just after "<iq", where an id can be
+ * inserted. If the result is larger than 'max', the call can be repeated
+ * with a larger array.
+ */
+size_t xc_rtt_iq_without_id(const char *xml, size_t len, size_t *offs,
+			    size_t max);
+
+/* Returns the value at percentile 'p' (0..100) in microseconds. */
+uint64_t xc_rtt_percentile(struct xc_rtt *rtt, double p);
+/* Formats a duration with a suitable unit. */
+void xc_rtt_format(char *buf, size_t size, uint64_t us);
+/* Prints summary and non-empty buckets of the histogram. */
+void xc_rtt_print(struct xc_rtt *rtt, FILE *stream);
+
+#endif /* __XC_RTT_H__ */
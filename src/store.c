@@ -0,0 +1,382 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "misc.h"
+#include "store.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Initial sizes, most sessions never reach the limits. */
+#define STORE_ARENA_INIT (256 * 1024)
+#define STORE_RECORDS_INIT 1024
+
+/* Largest 'max >> k' which doesn't exceed 'init'. */
+static size_t store_size_init(size_t max, size_t init)
+{
+	while (max > init)
+		max >>= 1;
+	return max;
+}
+
+/* Rounds 'max' down to 'size << k', so doubling reaches it exactly. */
+static size_t store_size_max(size_t size, size_t max)
+{
+	while (size <= max >> 1)
+		size <<= 1;
+	return size;
+}
+
+int xc_store_init(struct xc_store *store, size_t arena_max, size_t recs_max)
+{
+	assert(arena_max > 1 && recs_max > 0);
+
+	memset(store, 0, sizeof(*store));
+	store->s_arena_size = store_size_init(arena_max, STORE_ARENA_INIT);
+	store->s_arena_max = store_size_max(store->s_arena_size, arena_max);
+	store->s_recs_nr = store_size_init(recs_max, STORE_RECORDS_INIT);
+	store->s_recs_max = store_size_max(store->s_recs_nr, recs_max);
+
+	store->s_arena = malloc(store->s_arena_size);
+	store->s_recs = malloc(store->s_recs_nr * sizeof(*store->s_recs));
+	if (store->s_arena == NULL || store->s_recs == NULL) {
+		free(store->s_arena);
+		free(store->s_recs);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+void xc_store_fini(struct xc_store *store)
+{
+	free(store->s_arena);
+	free(store->s_recs);
+	store->s_arena = NULL;
+	store->s_recs = NULL;
+}
+
+static struct xc_record *store_rec(struct xc_store *store, uint64_t seq)
+{
+	return &store->s_recs[seq % store->s_recs_nr];
+}
+
+/*
+ * Doubles the arena. Positions are monotonic and a payload doesn't cross
+ * the end of the old arena, so it stays contiguous at the same position
+ * modulo the new size.
+ */
+static int store_arena_grow(struct xc_store *store)
+{
+	size_t    old = store->s_arena_size;
+	size_t    size = old * 2;
+	uint64_t  pos = store->s_arena_head;
+	size_t    chunk;
+	char     *arena;
+
+	if (old == store->s_arena_max)
+		return -ENOSPC;
+	arena = malloc(size);
+	if (arena == NULL)
+		return -ENOMEM;
+	while (pos < store->s_arena_tail) {
+		chunk = MIN(store->s_arena_tail - pos, old - pos % old);
+		memcpy(arena + pos % size, store->s_arena + pos % old, chunk);
+		pos += chunk;
+	}
+	free(store->s_arena);
+	store->s_arena = arena;
+	store->s_arena_size = size;
+
+	return 0;
+}
+
+static int store_recs_grow(struct xc_store *store)
+{
+	size_t            nr = store->s_recs_nr * 2;
+	struct xc_record *recs;
+	uint64_t          seq;
+
+	if (store->s_recs_nr == store->s_recs_max)
+		return -ENOSPC;
+	recs = malloc(nr * sizeof(*recs));
+	if (recs == NULL)
+		return -ENOMEM;
+	for (seq = store->s_first; seq < store->s_next; ++seq)
+		recs[seq % nr] = *store_rec(store, seq);
+	free(store->s_recs);
+	store->s_recs = recs;
+	store->s_recs_nr = nr;
+
+	return 0;
+}
+
+/* Position of a payload of size 'need', it must be contiguous. */
+static uint64_t store_arena_pos(struct xc_store *store, size_t need)
+{
+	uint64_t pos = store->s_arena_tail;
+	size_t   size = store->s_arena_size;
+
+	if (pos % size + need > size)
+		pos += size - pos % size;
+	return pos;
+}
+
+static bool store_arena_is_full(struct xc_store *store, size_t need)
+{
+	if (store->s_first == store->s_next)
+		return need > store->s_arena_size;
+	return store_arena_pos(store, need) + need - store->s_arena_head >
+	       store->s_arena_size;
+}
+
+static void store_evict(struct xc_store *store)
+{
+	assert(store->s_first < store->s_next);
+
+	++store->s_first;
+	store->s_arena_head = store->s_first < store->s_next ?
+			      store_rec(store, store->s_first)->rec_pos :
+			      store->s_arena_tail;
+}
+
+static bool store_is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* Finds value of attribute 'name' within the start tag [p, end). */
+static void store_attr(const char  *p,
+		       const char  *end,
+		       const char  *name,
+		       const char  *base,
+		       uint32_t    *off,
+		       uint32_t    *len)
+{
+	size_t      name_len = strlen(name);
+	const char *value;
+	char        quote;
+
+	while (p < end) {
+		if (*p == '"' || *p == '\'') {
+			/* Skip a value of another attribute. */
+			quote = *p++;
+			while (p < end && *p != quote)
+				++p;
+			++p;
+			continue;
+		}
+		if (store_is_space(p[-1]) && (size_t)(end - p) > name_len &&
+		    memcmp(p, name, name_len) == 0 &&
+		    (store_is_space(p[name_len]) || p[name_len] == '=')) {
+			/* Whitespace is allowed around '='. */
+			for (p += name_len; p < end && store_is_space(*p); ++p)
+				;
+			if (p == end || *p != '=')
+				continue;
+			for (++p; p < end && store_is_space(*p); ++p)
+				;
+			if (p == end)
+				return;
+			quote = *p;
+			if (quote != '"' && quote != '\'')
+				return;
+			value = ++p;
+			while (p < end && *p != quote)
+				++p;
+			*off = (uint32_t)(value - base);
+			*len = (uint32_t)(p - value);
+			return;
+		}
+		++p;
+	}
+}
+
+/* Extracts name, namespace, id and type of the top-level element. */
+static void store_parse(struct xc_record *rec, const char *data, size_t len)
+{
+	const char *end = data + len;
+	const char *p = data;
+	const char *name;
+
+	while (p < end) {
+		while (p < end && store_is_space(*p))
+			++p;
+		if (p + 1 >= end || *p != '<')
+			return;
+		if (p[1] != '?' && p[1] != '!')
+			break;
+		/* Skip XML declaration and comments. */
+		p = memchr(p, '>', end - p);
+		if (p == NULL)
+			return;
+		++p;
+	}
+	if (p >= end)
+		return;
+
+	name = ++p;
+	while (p < end && !store_is_space(*p) && *p != '/' && *p != '>')
+		++p;
+	rec->rec_name_off = (uint32_t)(name - data);
+	rec->rec_name_len = (uint32_t)(p - name);
+
+	/* End of the start tag, attribute values must not contain '>'. */
+	end = memchr(p, '>', end - p) ?: end;
+	store_attr(p, end, "xmlns", data, &rec->rec_ns_off, &rec->rec_ns_len);
+	store_attr(p, end, "id", data, &rec->rec_id_off, &rec->rec_id_len);
+	store_attr(p, end, "type", data, &rec->rec_type_off,
+		   &rec->rec_type_len);
+}
+
+const struct xc_record *xc_store_append(struct xc_store *store,
+					uint64_t         time,
+					xc_dir_t         dir,
+					uint32_t         conn,
+					const char      *data,
+					size_t           len)
+{
+	struct iovec iov = {
+		.iov_base = (void *)data,
+		.iov_len  = len,
+	};
+
+	return xc_store_appendv(store, time, dir, conn, &iov, 1);
+}
+
+const struct xc_record *xc_store_appendv(struct xc_store    *store,
+					 uint64_t            time,
+					 xc_dir_t            dir,
+					 uint32_t            conn,
+					 const struct iovec *iov,
+					 int                 iovcnt)
+{
+	struct xc_record *rec;
+	uint64_t          pos;
+	size_t            size;
+	size_t            need;
+	size_t            len = 0;
+	size_t            part;
+	char             *payload;
+	int               i;
+
+	for (i = 0; i < iovcnt; ++i)
+		len += iov[i].iov_len;
+	if (len > store->s_arena_max - 1)
+		len = store->s_arena_max - 1;
+	need = len + 1;
+
+	/* Grow until the limits, the oldest records are evicted then. */
+	while (store_arena_is_full(store, need) &&
+	       store_arena_grow(store) == 0)
+		;
+	while (store->s_next - store->s_first >= store->s_recs_nr &&
+	       store_recs_grow(store) == 0)
+		;
+
+	/* Payload must be contiguous, skip the arena's tail. */
+	size = store->s_arena_size;
+	if (len > size - 1) {
+		/* The arena can't grow to the limit without memory. */
+		len = size - 1;
+		need = len + 1;
+	}
+	pos = store_arena_pos(store, need);
+	while (store->s_first < store->s_next &&
+	       (pos + need - store->s_arena_head > size ||
+		store->s_next - store->s_first >= store->s_recs_nr)) {
+		store_evict(store);
+	}
+	if (store->s_first == store->s_next)
+		store->s_arena_head = pos;
+
+	rec = store_rec(store, store->s_next);
+	memset(rec, 0, sizeof(*rec));
+	rec->rec_seq = store->s_next;
+	rec->rec_time = time;
+	rec->rec_pos = pos;
+	rec->rec_len = (uint32_t)len;
+	rec->rec_dir = dir;
+	rec->rec_conn = conn;
+	payload = store->s_arena + pos % size;
+	for (i = 0, part = 0; i < iovcnt && part < len; ++i) {
+		memcpy(payload + part, iov[i].iov_base,
+		       MIN(iov[i].iov_len, len - part));
+		part += MIN(iov[i].iov_len, len - part);
+	}
+	payload[len] = '\0';
+	store_parse(rec, payload, len);
+
+	store->s_arena_tail = pos + need;
+	++store->s_next;
+
+	return rec;
+}
+
+void xc_store_clear(struct xc_store *store)
+{
+	store->s_first = store->s_next;
+	store->s_arena_head = store->s_arena_tail;
+}
+
+uint64_t xc_store_first(struct xc_store *store)
+{
+	return store->s_first;
+}
+
+uint64_t xc_store_next(struct xc_store *store)
+{
+	return store->s_next;
+}
+
+const struct xc_record *xc_store_get(struct xc_store *store, uint64_t seq)
+{
+	if (seq < store->s_first || seq >= store->s_next)
+		return NULL;
+	return store_rec(store, seq);
+}
+
+const char *xc_store_payload(struct xc_store *store,
+			     const struct xc_record *rec)
+{
+	return store->s_arena + rec->rec_pos % store->s_arena_size;
+}
+
+uint64_t xc_store_seek_time(struct xc_store *store, uint64_t time)
+{
+	uint64_t lo = store->s_first;
+	uint64_t hi = store->s_next;
+	uint64_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (store_rec(store, mid)->rec_time < time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+const char *xc_dir_name(xc_dir_t dir)
+{
+	return dir == XC_DIR_SENT ? "SENT" : "RECV";
+}
@@ -0,0 +1,121 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XC_STORE_H__
+#define __XC_STORE_H__
+
+#include <stdbool.h>	/* bool */
+#include <stddef.h>	/* size_t */
+#include <stdint.h>	/* uint64_t */
+#include <sys/uio.h>	/* struct iovec */
+
+/*
+ * Store of the XMPP traffic shared by all UIs. Every sent or received piece
+ * of the stream is a record with metadata. Payloads are kept in a single
+ * contiguous arena. Both arena and records table are rings which start
+ * small and double until they reach their limits. Then the oldest records
+ * are evicted. Growth moves payloads and records, so pointers returned by
+ * the store are valid only until the next append.
+ *
+ * Records are identified by sequence numbers which grow monotonically.
+ * A record is valid while its sequence number is within
+ * [xc_store_first(), xc_store_next()).
+ */
+
+typedef enum {
+	XC_DIR_SENT,
+	XC_DIR_RECV,
+} xc_dir_t;
+
+struct xc_record {
+	uint64_t rec_seq;
+	/*
+	 * Monotonic time in nanoseconds. Records of a capture file keep
+	 * intervals of the original session.
+	 */
+	uint64_t rec_time;
+	/* Position of the payload in the arena. */
+	uint64_t rec_pos;
+	uint32_t rec_len;
+	xc_dir_t rec_dir;
+	/* Connection attempt which the record belongs to. */
+	uint32_t rec_conn;
+	/* Top-level element. Offsets are relative to the payload. */
+	uint32_t rec_name_off;
+	uint32_t rec_name_len;
+	uint32_t rec_ns_off;
+	uint32_t rec_ns_len;
+	uint32_t rec_id_off;
+	uint32_t rec_id_len;
+	uint32_t rec_type_off;
+	uint32_t rec_type_len;
+};
+
+struct xc_store {
+	char             *s_arena;
+	size_t            s_arena_size;
+	size_t            s_arena_max;
+	/* Monotonic positions of the oldest payload and the next one. */
+	uint64_t          s_arena_head;
+	uint64_t          s_arena_tail;
+	struct xc_record *s_recs;
+	size_t            s_recs_nr;
+	size_t            s_recs_max;
+	uint64_t          s_first;
+	uint64_t          s_next;
+};
+
+/* Limits which are reached only if the traffic needs them. */
+#define XC_STORE_ARENA_SIZE (64 * 1024 * 1024)
+#define XC_STORE_RECORDS_MAX (256 * 1024)
+
+/* Limits are rounded down, so the initial sizes double up to them. */
+int xc_store_init(struct xc_store *store, size_t arena_max, size_t recs_max);
+void xc_store_fini(struct xc_store *store);
+
+/* Payload longer than the arena limit is truncated. */
+const struct xc_record *xc_store_append(struct xc_store *store,
+					uint64_t         time,
+					xc_dir_t         dir,
+					uint32_t         conn,
+					const char      *data,
+					size_t           len);
+/* Gathers the payload from slices, so the caller doesn't copy them. */
+const struct xc_record *xc_store_appendv(struct xc_store    *store,
+					 uint64_t            time,
+					 xc_dir_t            dir,
+					 uint32_t            conn,
+					 const struct iovec *iov,
+					 int                 iovcnt);
+
+/* Evicts all records, sequence numbers keep growing. */
+void xc_store_clear(struct xc_store *store);
+
+uint64_t xc_store_first(struct xc_store *store);
+uint64_t xc_store_next(struct xc_store *store);
+const struct xc_record *xc_store_get(struct xc_store *store, uint64_t seq);
+/* Payload is null-terminated. */
+const char *xc_store_payload(struct xc_store *store,
+			     const struct xc_record *rec);
+/* Returns the first record with time not less than 'time'. */
+uint64_t xc_store_seek_time(struct xc_store *store, uint64_t time);
+
+const char *xc_dir_name(xc_dir_t dir);
+
+#endif /* __XC_STORE_H__ */
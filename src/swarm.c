@@ -0,0 +1,455 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "misc.h"
+#include "swarm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+
+/* Connections started per timer callback, so the event loop isn't starved. */
+#define SWARM_BATCH 64
+/* Enough for the JID template and the index. */
+#define SWARM_JID_SIZE 1024
+/* Max time a worker thread sleeps, it checks the stop flag after it. */
+#define SWARM_LOOP_TIMEOUT 100
+/*
+ * Descriptors which may be opened after the swarm is started, for example,
+ * flight recorder dumps. Every shard also needs one for name resolution.
+ */
+#define SWARM_FDS_RESERVED 16
+
+/*
+ * Swarm which runs on the caller's event loop. The sockopt callback doesn't
+ * have userdata, so connections are looked up in it.
+ */
+static struct xc_swarm *g_swarm;
+
+unsigned xc_swarm_nr_max(const struct xc_swarm_conf *conf)
+{
+	unsigned used = SWARM_FDS_RESERVED + MAX(conf->swc_threads, 1);
+	int      fd;
+
+	for (fd = 0; fd < FD_SETSIZE; ++fd) {
+		if (fcntl(fd, F_GETFD) != -1)
+			++used;
+	}
+	return used < FD_SETSIZE ? FD_SETSIZE - used : 0;
+}
+
+bool xc_swarm_jid_is_valid(const char *jid)
+{
+	const char *p = strchr(jid, '%');
+
+	return p != NULL && p[1] == 'd' && strchr(p + 2, '%') == NULL &&
+	       strlen(jid) < SWARM_JID_SIZE - 16;
+}
+
+/* Spreads consecutive indexes evenly across shards. */
+static unsigned swarm_shard_of(struct xc_swarm *sw, unsigned index)
+{
+	uint32_t hash = (uint32_t)index * 2654435761u;
+
+	return (unsigned)(((uint64_t)hash * sw->sw_shards_nr) >> 32);
+}
+
+static void swarm_counter_inc(atomic_ulong *counter)
+{
+	atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static void swarm_conn_retry(struct xc_swarm_conn *sc)
+{
+	struct xc_swarm_shard *sh = sc->sc_shard;
+	uint64_t               delay;
+
+	if (!sh->sh_is_stopping && xc_backoff_next(&sc->sc_backoff, &delay))
+		xc_timer_arm(sh->sh_wheel, &sc->sc_timer, xc_time_ms() + delay);
+}
+
+static void swarm_conn_handler(xmpp_conn_t         *conn,
+			       xmpp_conn_event_t    status,
+			       int                  error,
+			       xmpp_stream_error_t *stream_error,
+			       void                *userdata)
+{
+	struct xc_swarm_conn  *sc = userdata;
+	struct xc_swarm_shard *sh = sc->sc_shard;
+
+	if (status == XMPP_CONN_CONNECT) {
+		sc->sc_is_connected = true;
+		xc_backoff_reset(&sc->sc_backoff);
+		atomic_fetch_add_explicit(&sh->sh_established, 1,
+					  memory_order_relaxed);
+		swarm_counter_inc(&sh->sh_logins);
+		return;
+	}
+
+	/* libstrophe has closed the socket. */
+	sc->sc_fd = -1;
+	if (sc->sc_is_connected) {
+		sc->sc_is_connected = false;
+		atomic_fetch_sub_explicit(&sh->sh_established, 1,
+					  memory_order_relaxed);
+	} else {
+		swarm_counter_inc(&sh->sh_failures);
+	}
+	swarm_conn_retry(sc);
+}
+
+static int swarm_sockopt_cb(xmpp_conn_t *conn, void *sock)
+{
+	struct xc_swarm_shard *sh;
+	unsigned               i;
+
+	if (g_swarm == NULL)
+		return 0;
+	sh = &g_swarm->sw_shards[0];
+	for (i = 0; i < sh->sh_nr; ++i) {
+		if (sh->sh_conns[i].sc_conn == conn) {
+			sh->sh_conns[i].sc_fd = *(int *)sock;
+			break;
+		}
+	}
+	return 0;
+}
+
+static void swarm_conn_connect(struct xc_swarm_conn *sc)
+{
+	struct xc_swarm_conf *conf = &sc->sc_shard->sh_swarm->sw_conf;
+	int                   rc;
+
+	rc = xmpp_connect_client(sc->sc_conn, conf->swc_host, conf->swc_port,
+				 swarm_conn_handler, sc);
+	if (rc != XMPP_EOK) {
+		swarm_counter_inc(&sc->sc_shard->sh_failures);
+		swarm_conn_retry(sc);
+	}
+}
+
+static void swarm_conn_timer_cb(struct xc_timer *timer, void *userdata)
+{
+	swarm_conn_connect(userdata);
+}
+
+static void swarm_ramp_cb(struct xc_timer *timer, void *userdata)
+{
+	struct xc_swarm_shard *sh = userdata;
+	uint64_t               now = xc_time_ms();
+	uint64_t               target;
+	double                 rate = sh->sh_rate;
+
+	/* Connections which are due since the start. */
+	target = sh->sh_nr;
+	if (rate > 0)
+		target = (uint64_t)((double)(now - sh->sh_ramp_base) * rate /
+				    1000) + 1;
+	target = MIN(target, (uint64_t)sh->sh_started + SWARM_BATCH);
+	target = MIN(target, (uint64_t)sh->sh_nr);
+
+	while (sh->sh_started < target)
+		swarm_conn_connect(&sh->sh_conns[sh->sh_started++]);
+
+	if (sh->sh_started == sh->sh_nr)
+		return;
+	target = rate > 0 ?
+		 sh->sh_ramp_base +
+		 (uint64_t)((double)sh->sh_started * 1000 / rate) : now;
+	xc_timer_arm(sh->sh_wheel, timer, MAX(target, now + 1));
+}
+
+static void swarm_ramp_start(struct xc_swarm_shard *sh)
+{
+	sh->sh_ramp_base = xc_time_ms();
+	xc_timer_arm(sh->sh_wheel, &sh->sh_ramp, sh->sh_ramp_base);
+}
+
+static void *swarm_thread(void *arg)
+{
+	struct xc_swarm_shard *sh = arg;
+	struct xc_swarm       *sw = sh->sh_swarm;
+	uint64_t               now;
+	int                    timeout;
+
+	swarm_ramp_start(sh);
+	while (!atomic_load_explicit(&sw->sw_stop, memory_order_relaxed)) {
+		now = xc_time_ms();
+		xc_wheel_advance(sh->sh_wheel, now);
+		timeout = xc_wheel_timeout(sh->sh_wheel, now);
+		if (timeout < 0 || timeout > SWARM_LOOP_TIMEOUT)
+			timeout = SWARM_LOOP_TIMEOUT;
+		xmpp_run_once(sh->sh_ctx, (unsigned long)timeout);
+	}
+	return NULL;
+}
+
+static int swarm_shard_init(struct xc_swarm_shard *sh,
+			    struct xc_swarm       *sw,
+			    xmpp_ctx_t            *ctx,
+			    struct xc_wheel       *wheel,
+			    unsigned               nr)
+{
+	sh->sh_is_owner = ctx == NULL;
+	if (sh->sh_is_owner) {
+		/* Logger isn't set, traffic of the swarm isn't captured. */
+		ctx = xmpp_ctx_new(NULL, NULL);
+		if (ctx == NULL)
+			return -ENOMEM;
+		wheel = &sh->sh_own_wheel;
+		xc_wheel_init(wheel, xc_time_ms());
+	}
+	/* Marks the shard as initialised for swarm_shard_fini(). */
+	sh->sh_swarm = sw;
+	sh->sh_ctx = ctx;
+	sh->sh_wheel = wheel;
+	sh->sh_rate = sw->sw_conf.swc_rate / sw->sw_shards_nr;
+	xc_timer_init(&sh->sh_ramp, swarm_ramp_cb, sh);
+	atomic_init(&sh->sh_established, 0);
+	atomic_init(&sh->sh_logins, 0);
+	atomic_init(&sh->sh_failures, 0);
+
+	sh->sh_conns = calloc(nr, sizeof(*sh->sh_conns));
+	return sh->sh_conns == NULL && nr > 0 ? -ENOMEM : 0;
+}
+
+static void swarm_shard_fini(struct xc_swarm_shard *sh)
+{
+	struct xc_swarm_conn *sc;
+	unsigned              i;
+
+	if (sh->sh_swarm == NULL)
+		return;
+
+	/* Disconnect events must not schedule reconnects. */
+	sh->sh_is_stopping = true;
+	xc_timer_disarm(sh->sh_wheel, &sh->sh_ramp);
+	for (i = 0; i < sh->sh_nr; ++i) {
+		sc = &sh->sh_conns[i];
+		xc_timer_disarm(sh->sh_wheel, &sc->sc_timer);
+		xmpp_conn_release(sc->sc_conn);
+	}
+	free(sh->sh_conns);
+	if (sh->sh_is_owner) {
+		xc_wheel_fini(sh->sh_wheel);
+		xmpp_ctx_free(sh->sh_ctx);
+	}
+}
+
+static int swarm_conn_init(struct xc_swarm_shard *sh, unsigned index)
+{
+	struct xc_swarm_conf *conf = &sh->sh_swarm->sw_conf;
+	struct xc_swarm_conn *sc = &sh->sh_conns[sh->sh_nr];
+	char                  jid[SWARM_JID_SIZE];
+
+	sc->sc_shard = sh;
+	sc->sc_fd = -1;
+	sc->sc_conn = xmpp_conn_new(sh->sh_ctx);
+	if (sc->sc_conn == NULL)
+		return -ENOMEM;
+	++sh->sh_nr;
+	if (!sh->sh_is_owner)
+		xmpp_conn_set_sockopt_callback(sc->sc_conn, swarm_sockopt_cb);
+	xc_timer_init(&sc->sc_timer, swarm_conn_timer_cb, sc);
+	/* Connections must not retry in lockstep after a server restart. */
+	xc_backoff_init(&sc->sc_backoff, conf->swc_reconnect_min,
+			conf->swc_reconnect_max, conf->swc_reconnect_tries,
+			xc_time_ns() ^ ((uint64_t)index << 32 | index));
+	snprintf(jid, sizeof(jid), conf->swc_jid, (int)index);
+	xmpp_conn_set_flags(sc->sc_conn, conf->swc_flags);
+	xmpp_conn_set_jid(sc->sc_conn, jid);
+	if (conf->swc_passwd != NULL)
+		xmpp_conn_set_pass(sc->sc_conn, conf->swc_passwd);
+
+	return 0;
+}
+
+int xc_swarm_init(struct xc_swarm            *sw,
+		  xmpp_ctx_t                 *ctx,
+		  struct xc_wheel            *wheel,
+		  const struct xc_swarm_conf *conf)
+{
+	unsigned *counts;
+	unsigned  i;
+	int       rc = 0;
+
+	memset(sw, 0, sizeof(*sw));
+	sw->sw_conf = *conf;
+	sw->sw_shards_nr = MAX(conf->swc_threads, 1);
+	atomic_init(&sw->sw_stop, false);
+	sw->sw_shards = calloc(sw->sw_shards_nr, sizeof(*sw->sw_shards));
+	counts = calloc(sw->sw_shards_nr, sizeof(*counts));
+	if (sw->sw_shards == NULL || counts == NULL) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < conf->swc_nr; ++i)
+		++counts[swarm_shard_of(sw, i)];
+	for (i = 0; rc == 0 && i < sw->sw_shards_nr; ++i) {
+		rc = conf->swc_threads > 0 ?
+		     swarm_shard_init(&sw->sw_shards[i], sw, NULL, NULL,
+				      counts[i]) :
+		     swarm_shard_init(&sw->sw_shards[i], sw, ctx, wheel,
+				      counts[i]);
+	}
+	for (i = 0; rc == 0 && i < conf->swc_nr; ++i)
+		rc = swarm_conn_init(&sw->sw_shards[swarm_shard_of(sw, i)], i);
+
+out:
+	free(counts);
+	if (rc != 0)
+		xc_swarm_fini(sw);
+	return rc;
+}
+
+void xc_swarm_fini(struct xc_swarm *sw)
+{
+	unsigned i;
+
+	atomic_store(&sw->sw_stop, true);
+	if (g_swarm == sw)
+		g_swarm = NULL;
+	for (i = 0; i < sw->sw_threads_nr; ++i)
+		pthread_join(sw->sw_shards[i].sh_thread, NULL);
+	for (i = 0; sw->sw_shards != NULL && i < sw->sw_shards_nr; ++i)
+		swarm_shard_fini(&sw->sw_shards[i]);
+	free(sw->sw_shards);
+}
+
+int xc_swarm_start(struct xc_swarm *sw)
+{
+	struct xc_swarm_shard *sh;
+	sigset_t               set;
+	sigset_t               oldset;
+	int                    rc = 0;
+
+	sw->sw_stats_time = xc_time_ms();
+	if (sw->sw_conf.swc_threads == 0) {
+		g_swarm = sw;
+		swarm_ramp_start(&sw->sw_shards[0]);
+		return 0;
+	}
+
+	/* Signals must be delivered to the event loop thread. */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &oldset);
+	while (sw->sw_threads_nr < sw->sw_shards_nr) {
+		sh = &sw->sw_shards[sw->sw_threads_nr];
+		rc = -pthread_create(&sh->sh_thread, NULL, swarm_thread, sh);
+		if (rc != 0)
+			break;
+		++sw->sw_threads_nr;
+	}
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	return rc;
+}
+
+unsigned xc_swarm_pollfds(struct xc_swarm *sw, struct pollfd *fds)
+{
+	struct xc_swarm_shard *sh = &sw->sw_shards[0];
+	xmpp_conn_t           *conn;
+	unsigned               i;
+
+	if (sw->sw_conf.swc_threads > 0)
+		return 0;
+	for (i = 0; i < sh->sh_nr; ++i) {
+		conn = sh->sh_conns[i].sc_conn;
+		fds[i].fd = sh->sh_conns[i].sc_fd;
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+		/* Wait for the non-blocking connect(2) to complete. */
+		if (xmpp_conn_is_connecting(conn))
+			fds[i].events |= POLLOUT;
+#ifdef HAVE_XMPP_CONN_SEND_QUEUE_LEN
+		if (xmpp_conn_send_queue_len(conn) > 0)
+			fds[i].events |= POLLOUT;
+#endif
+	}
+	return sh->sh_nr;
+}
+
+bool xc_swarm_is_negotiating(struct xc_swarm *sw)
+{
+	struct xc_swarm_shard *sh = &sw->sw_shards[0];
+	unsigned               i;
+
+	if (sw->sw_conf.swc_threads > 0)
+		return false;
+	for (i = 0; i < sh->sh_nr; ++i) {
+		if (sh->sh_conns[i].sc_fd >= 0 &&
+		    !sh->sh_conns[i].sc_is_connected)
+			return true;
+	}
+	return false;
+}
+
+unsigned long xc_swarm_logins(struct xc_swarm *sw)
+{
+	unsigned long nr = 0;
+	unsigned      i;
+
+	for (i = 0; i < sw->sw_shards_nr; ++i) {
+		nr += atomic_load_explicit(&sw->sw_shards[i].sh_logins,
+					   memory_order_relaxed);
+	}
+	return nr;
+}
+
+unsigned long xc_swarm_failures(struct xc_swarm *sw)
+{
+	unsigned long nr = 0;
+	unsigned      i;
+
+	for (i = 0; i < sw->sw_shards_nr; ++i) {
+		nr += atomic_load_explicit(&sw->sw_shards[i].sh_failures,
+					   memory_order_relaxed);
+	}
+	return nr;
+}
+
+void xc_swarm_stats(struct xc_swarm *sw, uint64_t now, char *buf,
+		    size_t size)
+{
+	uint64_t      elapsed = now - sw->sw_stats_time;
+	unsigned long logins = xc_swarm_logins(sw);
+	unsigned      established = 0;
+	double        rate = 0;
+	unsigned      i;
+
+	for (i = 0; i < sw->sw_shards_nr; ++i) {
+		established +=
+			atomic_load_explicit(&sw->sw_shards[i].sh_established,
+					     memory_order_relaxed);
+	}
+	if (elapsed > 0) {
+		rate = (double)(logins - sw->sw_stats_logins) * 1000 /
+		       (double)elapsed;
+	}
+	sw->sw_stats_logins = logins;
+	sw->sw_stats_time = now;
+
+	snprintf(buf, size, "swarm %u/%u up %.0f logins/s %lu failed",
+		 established, sw->sw_conf.swc_nr, rate, xc_swarm_failures(sw));
+}
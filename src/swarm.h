@@ -0,0 +1,156 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XC_SWARM_H__
+#define __XC_SWARM_H__
+
+#include "backoff.h"
+#include "wheel.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>	/* bool */
+#include <stddef.h>	/* size_t */
+#include <stdint.h>	/* uint64_t */
+#include <strophe.h>
+
+/*
+ * Swarm of connections for load testing. Connections are assigned to shards
+ * by hash of their index. A shard owns a libstrophe context and a timer
+ * wheel and runs its own event loop in a worker thread. Without worker
+ * threads there is a single shard which is driven by the caller's event
+ * loop. Connections are started at a limited rate and reconnect
+ * independently. Their traffic isn't captured, only counters are kept.
+ */
+
+struct xc_swarm_conf {
+	/* JID template with a single %d which is replaced by the index. */
+	const char     *swc_jid;
+	const char     *swc_passwd;
+	const char     *swc_host;
+	unsigned short  swc_port;
+	long            swc_flags;
+	unsigned        swc_nr;
+	/* Connections started per second, 0 without limit. */
+	double          swc_rate;
+	/* Number of worker threads, 0 runs on the caller's event loop. */
+	unsigned        swc_threads;
+	/* Parameters of struct xc_backoff. */
+	uint64_t        swc_reconnect_min;
+	uint64_t        swc_reconnect_max;
+	unsigned        swc_reconnect_tries;
+};
+
+struct xc_swarm;
+struct xc_swarm_shard;
+
+struct xc_swarm_conn {
+	/* Reconnect timer. */
+	struct xc_timer        sc_timer;
+	struct xc_swarm_shard *sc_shard;
+	xmpp_conn_t           *sc_conn;
+	struct xc_backoff      sc_backoff;
+	/* Socket of the attempt, tracked only without worker threads. */
+	int                    sc_fd;
+	bool                   sc_is_connected;
+};
+
+struct xc_swarm_shard {
+	struct xc_swarm      *sh_swarm;
+	xmpp_ctx_t           *sh_ctx;
+	struct xc_wheel      *sh_wheel;
+	/* Context and wheel of a worker thread. */
+	struct xc_wheel       sh_own_wheel;
+	bool                  sh_is_owner;
+	pthread_t             sh_thread;
+	struct xc_swarm_conn *sh_conns;
+	unsigned              sh_nr;
+	/* Starts connections according to the rate. */
+	struct xc_timer       sh_ramp;
+	uint64_t              sh_ramp_base;
+	double                sh_rate;
+	unsigned              sh_started;
+	/* Written by the shard only, read by xc_swarm_stats(). */
+	atomic_uint           sh_established;
+	atomic_ulong          sh_logins;
+	atomic_ulong          sh_failures;
+	bool                  sh_is_stopping;
+};
+
+struct xc_swarm {
+	struct xc_swarm_conf   sw_conf;
+	struct xc_swarm_shard *sw_shards;
+	unsigned               sw_shards_nr;
+	unsigned               sw_threads_nr;
+	atomic_bool            sw_stop;
+	/* The previous sample of xc_swarm_stats(). */
+	unsigned long          sw_stats_logins;
+	uint64_t               sw_stats_time;
+};
+
+/*
+ * libstrophe waits for sockets with select(2), which can't watch
+ * descriptors from FD_SETSIZE on. Worker threads share descriptors of the
+ * process, so they don't raise the limit. Returns how many connections fit
+ * along with the descriptors which are open already.
+ */
+unsigned xc_swarm_nr_max(const struct xc_swarm_conf *conf);
+
+/* Checks that the template has a single %d and no other conversions. */
+bool xc_swarm_jid_is_valid(const char *jid);
+
+/*
+ * Context and wheel are used without worker threads and may be NULL
+ * otherwise.
+ */
+int  xc_swarm_init(struct xc_swarm            *sw,
+		   xmpp_ctx_t                 *ctx,
+		   struct xc_wheel            *wheel,
+		   const struct xc_swarm_conf *conf);
+/*
+ * Stops worker threads and releases all connections, the caller's event
+ * loop must not run afterwards.
+ */
+void xc_swarm_fini(struct xc_swarm *sw);
+int  xc_swarm_start(struct xc_swarm *sw);
+
+/*
+ * Without worker threads the caller's event loop polls sockets of the
+ * swarm. Fills one descriptor per connection, negative for connections
+ * without a socket, and returns their number. Returns 0 with worker
+ * threads.
+ */
+unsigned xc_swarm_pollfds(struct xc_swarm *sw, struct pollfd *fds);
+/*
+ * Some connection on the caller's event loop is being established, its
+ * timeouts are libstrophe timed handlers.
+ */
+bool xc_swarm_is_negotiating(struct xc_swarm *sw);
+
+unsigned long xc_swarm_logins(struct xc_swarm *sw);
+unsigned long xc_swarm_failures(struct xc_swarm *sw);
+/*
+ * Formats established connections, failures and the login rate since the
+ * previous call. Counters of worker threads are read without locking.
+ */
+void xc_swarm_stats(struct xc_swarm *sw, uint64_t now, char *buf,
+		    size_t size);
+
+#endif /* __XC_SWARM_H__ */
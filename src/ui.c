@@ -125,14 +125,19 @@ void xc_ui_disconnected(struct xc_ui *ui)
 	ui->ui_ops->uio_state_set(ui, XC_UI_DISCONNECTED);
 }
 
+void xc_ui_offline(struct xc_ui *ui)
+{
+	ui->ui_ops->uio_state_set(ui, XC_UI_OFFLINE);
+}
+
 void xc_ui_run(struct xc_ui *ui)
 {
 	ui->ui_ops->uio_run(ui);
 }
 
-void xc_ui_print(struct xc_ui *ui, const char *msg)
+void xc_ui_print(struct xc_ui *ui, const struct xc_record *rec)
 {
-	ui->ui_ops->uio_print(ui, msg);
+	ui->ui_ops->uio_print(ui, rec);
 }
 
 bool xc_ui_is_done(struct xc_ui *ui)
@@ -144,3 +149,9 @@ void xc_ui_quit(struct xc_ui *ui)
 {
 	ui->ui_ops->uio_quit(ui);
 }
+
+void xc_ui_stats_set(struct xc_ui *ui, const char *stats)
+{
+	if (ui->ui_ops->uio_stats_set != NULL)
+		ui->ui_ops->uio_stats_set(ui, stats);
+}
@@ -24,6 +24,7 @@
 
 /* Forward declarations */
 struct xc_ctx;
+struct xc_record;
 struct xc_ui_ops;
 
 typedef enum {
@@ -33,6 +34,8 @@ typedef enum {
 	XC_UI_CONNECTED,
 	XC_UI_DISCONNECTING,
 	XC_UI_DISCONNECTED,
+	/* Read-only view of a capture file, there is no connection. */
+	XC_UI_OFFLINE,
 } xc_ui_state_t;
 
 typedef enum {
@@ -57,9 +60,11 @@ struct xc_ui_ops {
 	int  (*uio_get_passwd)(struct xc_ui *ui, char **out);
 	void (*uio_state_set)(struct xc_ui *ui, xc_ui_state_t state);
 	void (*uio_run)(struct xc_ui *ui);
-	void (*uio_print)(struct xc_ui *ui, const char *msg);
+	void (*uio_print)(struct xc_ui *ui, const struct xc_record *rec);
 	bool (*uio_is_done)(struct xc_ui *ui);
 	void (*uio_quit)(struct xc_ui *ui);
+	/* Optional. Shows a line of statistics in the status bar. */
+	void (*uio_stats_set)(struct xc_ui *ui, const char *stats);
 };
 
 xc_ui_type_t xc_ui_name_to_type(const char *name);
@@ -73,9 +78,11 @@ void xc_ui_connecting(struct xc_ui *ui);
 void xc_ui_connected(struct xc_ui *ui);
 void xc_ui_disconnecting(struct xc_ui *ui);
 void xc_ui_disconnected(struct xc_ui *ui);
+void xc_ui_offline(struct xc_ui *ui);
 void xc_ui_run(struct xc_ui *ui);
-void xc_ui_print(struct xc_ui *ui, const char *msg);
+void xc_ui_print(struct xc_ui *ui, const struct xc_record *rec);
 bool xc_ui_is_done(struct xc_ui *ui);
 void xc_ui_quit(struct xc_ui *ui);
+void xc_ui_stats_set(struct xc_ui *ui, const char *stats);
 
 #endif /* __XMPPCONSOLE_UI_H__ */
@@ -21,50 +21,184 @@
  * This is the most simple UI module that reads user's stanzas from STDIN and
  * prints logs to STDOUT. Work with multi-line input may be inconvenient.
  *
- * We use select(2) in order not to block the event loop. Also we rely on
- * terminal's buffering ability, so STDIN receives data when user presses
- * ENTER or terminal receives "\n" in other way.
+ * STDIN is read by a dedicated thread which blocks in poll(2) and frames
+ * complete lines. Lines are passed to the event loop via a lock-free ring,
+ * the loop drains all pending lines per wakeup. Lines are kept in the ring
+ * until the session is established, so input which is piped before login
+ * isn't mixed with the negotiation. EOF quits after the last line is sent.
+ * We rely on terminal's
+ * buffering ability, so STDIN receives data when user presses ENTER or
+ * terminal receives "\n" in other way.
+ *
+ * When STDIN is not a terminal, input is framed by XML elements instead of
+ * lines. So stanzas may span multiple lines. All stanzas framed from a
+ * single read(2) are passed as a single batch.
  */
 
+#include "framer.h"
+#include "misc.h"
+#include "ring.h"
 #include "ui.h"
 #include "xmpp.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strophe.h>
-#include <sys/select.h>
+#include <unistd.h>
+
+struct xc_ui_console {
+	struct xc_ring  uic_ring;
+	struct xc_ctx  *uic_ctx;
+	pthread_t       uic_thread;
+	bool            uic_thread_started;
+	/* Stops the input thread, the pipe interrupts its poll(2). */
+	atomic_bool     uic_stop;
+	int             uic_stop_pipe[2];
+	/* The input thread waits for space while the ring is full. */
+	pthread_mutex_t uic_lock;
+	pthread_cond_t  uic_space;
+	bool            uic_is_waiting;
+	atomic_bool     uic_eof;
+	/* Bytes of input which didn't fit, reported by the event loop. */
+	atomic_size_t   uic_dropped;
+	bool            uic_quit;
+	/* Input can be consumed: the session is established or offline. */
+	bool            uic_is_online;
+	/* XML framer for non-terminal input. */
+	struct xc_framer uic_framer;
+	bool            uic_is_stream;
+	/* Line which is being framed by the input thread. */
+	char           *uic_line;
+	size_t          uic_line_len;
+	size_t          uic_line_size;
+	/* Ends of units completed by a read, at most one per byte read. */
+	size_t         *uic_ends;
+};
 
-#define UI_CONSOLE_INPUT_PERIOD 10
+/* A batch must fit a half of the ring, large stanzas are usual for files. */
+#define UI_CONSOLE_RING_SIZE (8 * 1024 * 1024)
+#define UI_CONSOLE_LINE_SIZE 4096
+#define UI_CONSOLE_READ_SIZE 16384
 
 static bool is_done = false;
+static bool is_stop = false;
 
 static int ui_console_init(struct xc_ui *ui)
 {
+	struct xc_ui_console *uic;
+	int                   rc;
+
+	uic = malloc(sizeof(*uic));
+	if (uic == NULL)
+		return -ENOMEM;
+
+	rc = xc_ring_init(&uic->uic_ring, UI_CONSOLE_RING_SIZE);
+	if (rc != 0)
+		goto free_uic;
+	uic->uic_line = malloc(UI_CONSOLE_LINE_SIZE);
+	if (uic->uic_line == NULL) {
+		rc = -ENOMEM;
+		goto ring_fini;
+	}
+	uic->uic_ends = malloc(UI_CONSOLE_READ_SIZE * sizeof(*uic->uic_ends));
+	if (uic->uic_ends == NULL) {
+		rc = -ENOMEM;
+		goto line_free;
+	}
+	if (pipe(uic->uic_stop_pipe) != 0) {
+		rc = -errno;
+		goto ends_free;
+	}
+	(void)fcntl(uic->uic_stop_pipe[0], F_SETFD, FD_CLOEXEC);
+	(void)fcntl(uic->uic_stop_pipe[1], F_SETFD, FD_CLOEXEC);
+	pthread_mutex_init(&uic->uic_lock, NULL);
+	pthread_cond_init(&uic->uic_space, NULL);
+	uic->uic_is_waiting = false;
+	atomic_init(&uic->uic_stop, false);
+	uic->uic_line_len = 0;
+	uic->uic_line_size = UI_CONSOLE_LINE_SIZE;
+	uic->uic_ctx = NULL;
+	uic->uic_thread_started = false;
+	uic->uic_quit = false;
+	uic->uic_is_online = false;
+	uic->uic_is_stream = !isatty(STDIN_FILENO);
+	xc_framer_init(&uic->uic_framer);
+	atomic_init(&uic->uic_eof, false);
+	atomic_init(&uic->uic_dropped, 0);
+	ui->ui_priv = uic;
+
 	return 0;
+
+ends_free:
+	free(uic->uic_ends);
+line_free:
+	free(uic->uic_line);
+ring_fini:
+	xc_ring_fini(&uic->uic_ring);
+free_uic:
+	free(uic);
+	return rc;
 }
 
 static void ui_console_fini(struct xc_ui *ui)
 {
+	struct xc_ui_console *uic = ui->ui_priv;
+
+	if (uic->uic_thread_started) {
+		/* The thread is blocked either in poll(2) or on the ring. */
+		pthread_mutex_lock(&uic->uic_lock);
+		atomic_store(&uic->uic_stop, true);
+		pthread_cond_signal(&uic->uic_space);
+		pthread_mutex_unlock(&uic->uic_lock);
+		(void)write(uic->uic_stop_pipe[1], "", 1);
+		pthread_join(uic->uic_thread, NULL);
+	}
+	pthread_cond_destroy(&uic->uic_space);
+	pthread_mutex_destroy(&uic->uic_lock);
+	close(uic->uic_stop_pipe[0]);
+	close(uic->uic_stop_pipe[1]);
+	xc_ring_fini(&uic->uic_ring);
+	free(uic->uic_ends);
+	free(uic->uic_line);
+	free(uic);
+	ui->ui_priv = NULL;
 }
 
 static int ui_console_get_passwd(struct xc_ui *ui, char **out)
 {
 	char    *line = NULL;
 	size_t   len = 0;
+	size_t   size = 0;
 	ssize_t  rlen;
+	char     c;
 
 	printf("Enter password: ");
+	fflush(stdout);
 
-	rlen = getline(&line, &len, stdin);
-	if (rlen == -1 && errno == 0) {
-		/* Consider this scenario as Ctrl+D. */
-		free(line);
-		line = NULL;
+	/*
+	 * Read STDIN byte by byte bypassing stdio, otherwise, stdio may buffer
+	 * data which belongs to the input thread.
+	 */
+	while ((rlen = read(STDIN_FILENO, &c, 1)) != 0) {
+		if (rlen < 0 && errno == EINTR)
+			continue;
+		if (rlen < 0 || c == '\n')
+			break;
+		if (len + 1 >= size) {
+			size = size == 0 ? 64 : size * 2;
+			line = realloc(line, size);
+			if (line == NULL)
+				break;
+		}
+		line[len++] = c;
 	}
-	if (rlen > 0) {
-		if (line[rlen - 1] == '\n')
-			line[rlen - 1] = '\0';
+	if (line != NULL) {
+		line[len] = '\0';
 		if (*line == '\0') {
 			free(line);
 			line = NULL;
@@ -74,9 +208,12 @@ static int ui_console_get_passwd(struct xc_ui *ui, char **out)
 	*out = line;
 	return 0;
 }
-
 static void ui_console_state_set(struct xc_ui *ui, xc_ui_state_t state)
 {
+	struct xc_ui_console *uic = ui->ui_priv;
+
+	uic->uic_is_online = state == XC_UI_CONNECTED ||
+			     state == XC_UI_OFFLINE;
 	switch (state) {
 	case XC_UI_UNKNOWN:
 		/* Must not happen. */
@@ -94,61 +231,280 @@ static void ui_console_state_set(struct xc_ui *ui, xc_ui_state_t state)
 		printf("*** Disconnected ***\n");
 		is_done = true;
 		break;
+	case XC_UI_OFFLINE:
+		break;
 	}
 }
 
-static int ui_console_timed_cb(xmpp_conn_t *conn, void *userdata)
+/* Called by the input thread, the UI isn't touched from here. */
+static void ui_console_drop(struct xc_ui_console *uic, size_t len)
+{
+	atomic_fetch_add(&uic->uic_dropped, len);
+	xc_wakeup(uic->uic_ctx);
+}
+
+/*
+ * Called by the input thread. Blocks while the ring is full until the event
+ * loop releases records, the loop is woken up once for them. The record is
+ * discarded if the thread is stopped meanwhile.
+ *
+ * A record starts with the number of units and their ends found by the
+ * framer, followed by the null-terminated data. Lines have no units.
+ */
+static void ui_console_push(struct xc_ui_console *uic,
+			    const char           *data,
+			    size_t                len,
+			    const size_t         *ends,
+			    size_t                ends_nr)
 {
-	struct xc_ui   *ui = userdata;
-	char           *line = NULL;
-	size_t          len = 0;
-	ssize_t         rlen;
-	struct timeval  tv;
-	fd_set          rfds;
-	int             rc;
+	size_t  size = (ends_nr + 1) * sizeof(*ends) + len + 1;
+	size_t *rec;
 
-	FD_ZERO(&rfds);
-	FD_SET(0, &rfds);
-	tv.tv_sec = 0;
-	tv.tv_usec = 1;
-	rc = select(1, &rfds, NULL, NULL, &tv);
-	if (rc <= 0) {
-		/* Nothing in STDIN right now. */
-		return 1;
+	if (!xc_ring_fits(&uic->uic_ring, size)) {
+		ui_console_drop(uic, len);
+		return;
+	}
+	rec = xc_ring_reserve(&uic->uic_ring, size);
+	if (rec == NULL) {
+		xc_wakeup(uic->uic_ctx);
+		pthread_mutex_lock(&uic->uic_lock);
+		uic->uic_is_waiting = true;
+		while (!atomic_load(&uic->uic_stop) &&
+		       (rec = xc_ring_reserve(&uic->uic_ring, size)) == NULL)
+			pthread_cond_wait(&uic->uic_space, &uic->uic_lock);
+		uic->uic_is_waiting = false;
+		pthread_mutex_unlock(&uic->uic_lock);
+		if (rec == NULL)
+			return;
 	}
+	rec[0] = ends_nr;
+	memcpy(rec + 1, ends, ends_nr * sizeof(*ends));
+	memcpy(rec + 1 + ends_nr, data, len);
+	((char *)(rec + 1 + ends_nr))[len] = '\0';
+	xc_ring_commit(&uic->uic_ring, size);
+}
+
+static int ui_console_line_append(struct xc_ui_console *uic,
+				  const char           *data,
+				  size_t                len)
+{
+	char   *line;
+	size_t  size = uic->uic_line_size;
 
-	rlen = getline(&line, &len, stdin);
-	if (rlen == -1 && errno == 0) {
-		/* Consider this scenario as Ctrl+D. */
-		xc_quit(ui->ui_ctx);
-		free(line);
-		return 0;
+	while (uic->uic_line_len + len > size)
+		size *= 2;
+	if (size != uic->uic_line_size) {
+		line = realloc(uic->uic_line, size);
+		if (line == NULL)
+			return -ENOMEM;
+		uic->uic_line = line;
+		uic->uic_line_size = size;
 	}
-	if (rlen > 0) {
-		if (line[rlen - 1] == '\n')
-			line[rlen - 1] = '\0';
-		if (*line != '\0')
-			xc_send(ui->ui_ctx, line);
+	memcpy(uic->uic_line + uic->uic_line_len, data, len);
+	uic->uic_line_len += len;
+
+	return 0;
+}
+
+static void ui_console_line_flush(struct xc_ui_console *uic)
+{
+	if (uic->uic_line_len > 0)
+		ui_console_push(uic, uic->uic_line, uic->uic_line_len,
+				NULL, 0);
+	uic->uic_line_len = 0;
+}
+
+/* Splits data to lines. The last incomplete line is kept for next read. */
+static void ui_console_frame(struct xc_ui_console *uic,
+			     const char           *data,
+			     size_t                len)
+{
+	const char *end = data + len;
+	const char *p;
+
+	while (data < end) {
+		p = memchr(data, '\n', end - data);
+		if (p == NULL) {
+			if (ui_console_line_append(uic, data, end - data) != 0)
+				ui_console_drop(uic, end - data);
+			break;
+		}
+		if (uic->uic_line_len == 0) {
+			/* Fast path: the line is complete in the buffer. */
+			if (p > data)
+				ui_console_push(uic, data, p - data, NULL, 0);
+		} else {
+			if (ui_console_line_append(uic, data, p - data) != 0)
+				ui_console_drop(uic, p - data);
+			ui_console_line_flush(uic);
+		}
+		data = p + 1;
+	}
+}
+
+/*
+ * Frames XML elements. Complete elements from the buffer are pushed as a
+ * single record together with their ends, so they aren't framed again when
+ * they are sent. The incomplete tail is kept for next read.
+ */
+static void ui_console_frame_stream(struct xc_ui_console *uic,
+				    const char           *data,
+				    size_t                len)
+{
+	size_t boundary = 0;
+	size_t off = uic->uic_line_len;
+	size_t nr = 0;
+	size_t n;
+	int    rc;
+
+	rc = ui_console_line_append(uic, data, len);
+	if (rc != 0) {
+		ui_console_drop(uic, len);
+		return;
+	}
+
+	while (off < uic->uic_line_len &&
+	       (n = xc_framer_next(&uic->uic_framer, uic->uic_line + off,
+				   uic->uic_line_len - off)) > 0) {
+		off += n;
+		uic->uic_ends[nr++] = off;
+		boundary = off;
+	}
+	if (boundary > 0) {
+		ui_console_push(uic, uic->uic_line, boundary, uic->uic_ends, nr);
+		uic->uic_line_len -= boundary;
+		memmove(uic->uic_line, uic->uic_line + boundary,
+			uic->uic_line_len);
 	}
-	/* line should be freed even if getline() fails. */
-	free(line);
+}
+
+static void *ui_console_input_thread(void *userdata)
+{
+	struct xc_ui_console *uic = userdata;
+	char                  buf[UI_CONSOLE_READ_SIZE];
+	struct pollfd         fds[2];
+	ssize_t               rlen;
 
-	return 1;
+	fds[0].fd = STDIN_FILENO;
+	fds[0].events = POLLIN;
+	fds[1].fd = uic->uic_stop_pipe[0];
+	fds[1].events = POLLIN;
+	while (1) {
+		if (poll(fds, ARRAY_SIZE(fds), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		/* Pending input is discarded on quit. */
+		if (atomic_load(&uic->uic_stop))
+			return NULL;
+		rlen = read(STDIN_FILENO, buf, sizeof(buf));
+		if (rlen < 0 && errno == EINTR)
+			continue;
+		if (rlen <= 0)
+			break;
+		if (uic->uic_is_stream)
+			ui_console_frame_stream(uic, buf, (size_t)rlen);
+		else
+			ui_console_frame(uic, buf, (size_t)rlen);
+		xc_wakeup(uic->uic_ctx);
+	}
+	/* Consider EOF as Ctrl+D, but send the last line before quit. */
+	ui_console_line_flush(uic);
+	atomic_store(&uic->uic_eof, true);
+	xc_wakeup(uic->uic_ctx);
+
+	return NULL;
+}
+
+/*
+ * Sends all pending lines. Returns true if anything was sent. Nothing is
+ * consumed until the session is established.
+ */
+static bool ui_console_drain(struct xc_ui_console *uic)
+{
+	struct xc_ctx *ctx = uic->uic_ctx;
+	bool           eof = atomic_load(&uic->uic_eof);
+	bool           sent = false;
+	size_t         dropped;
+	size_t         len;
+	size_t        *rec;
+	size_t         nr;
+	char          *line;
+
+	dropped = atomic_exchange(&uic->uic_dropped, 0);
+	if (dropped > 0) {
+		printf("*** Error: input is too long, dropped %zu bytes ***\n",
+		       dropped);
+	}
+	if (!uic->uic_is_online)
+		return false;
+	while ((rec = xc_ring_peek(&uic->uic_ring, &len)) != NULL) {
+		/* Data is null-terminated and follows the ends of units. */
+		nr = rec[0];
+		line = (char *)(rec + 1 + nr);
+		len -= (nr + 1) * sizeof(*rec) + 1;
+		xc_send_units(ctx, line, len, nr > 0 ? rec + 1 : NULL, nr);
+		xc_ring_release(&uic->uic_ring);
+		sent = true;
+	}
+	if (sent) {
+		pthread_mutex_lock(&uic->uic_lock);
+		if (uic->uic_is_waiting)
+			pthread_cond_signal(&uic->uic_space);
+		pthread_mutex_unlock(&uic->uic_lock);
+	}
+	/* EOF is set after the last line is pushed. */
+	if (eof && !uic->uic_quit) {
+		uic->uic_quit = true;
+		xc_quit(ctx);
+	}
+
+	return sent;
 }
 
 static void ui_console_run(struct xc_ui *ui)
 {
-	xmpp_ctx_t  *ctx = ui->ui_ctx->c_ctx;
-	xmpp_conn_t *conn = ui->ui_ctx->c_conn;
+	struct xc_ui_console *uic = ui->ui_priv;
+	struct xc_ctx        *ctx = ui->ui_ctx;
+	struct pollfd         fds[2 + XC_SWARM_FDS_MAX];
+	unsigned              nr;
+	int                   rc;
+
+	uic->uic_ctx = ctx;
+	rc = pthread_create(&uic->uic_thread, NULL, ui_console_input_thread,
+			    uic);
+	if (rc != 0) {
+		fprintf(stderr, "Error: can't create input thread\n");
+		return;
+	}
+	uic->uic_thread_started = true;
+
+	while (!is_stop) {
+		fds[0].fd = xc_wake_fd(ctx);
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		fds[1].fd = xc_fd(ctx);
+		fds[1].events = xc_fd_events(ctx);
+		fds[1].revents = 0;
+		nr = 2 + xc_swarm_fds(ctx, fds + 2);
 
-	xmpp_timed_handler_add(conn, ui_console_timed_cb,
-			       UI_CONSOLE_INPUT_PERIOD, ui);
-	xmpp_run(ctx);
+		rc = poll(fds, nr, xc_timeout(ctx));
+		if (rc < 0 && errno != EINTR)
+			break;
+
+		xc_run_once(ctx, fds[1].revents);
+		if (!is_stop && ui_console_drain(uic))
+			xc_run_once(ctx, 0);
+	}
 }
 
-static void ui_console_print(struct xc_ui *ui, const char *msg)
+static void ui_console_print(struct xc_ui *ui, const struct xc_record *rec)
 {
-	printf("%s\n", msg);
+	struct xc_store *store = &ui->ui_ctx->c_store;
+
+	printf("%s: %s\n", xc_dir_name(rec->rec_dir),
+	       xc_store_payload(store, rec));
 }
 
 static bool ui_console_is_done(struct xc_ui *ui)
@@ -158,9 +514,7 @@ static bool ui_console_is_done(struct xc_ui *ui)
 
 static void ui_console_quit(struct xc_ui *ui)
 {
-	xmpp_ctx_t *ctx = ui->ui_ctx->c_ctx;
-
-	xmpp_stop(ctx);
+	is_stop = true;
 }
 
 struct xc_ui_ops xc_ui_ops_console = {
@@ -19,6 +19,8 @@
 
 #ifdef BUILD_UI_GTK
 
+#include "misc.h"
+#include "pretty.h"
 #include "ui.h"
 #include "xmpp.h"
 
@@ -36,13 +38,101 @@ struct xc_ui_gtk {
 	GtkWidget       *uig_status_tls;
 	GtkWidget       *uig_status_conn;
 	GtkWidget       *uig_status_spinner;
+	GtkWidget       *uig_status_stats;
 	GtkSourceBuffer *uig_buffer;
 	GtkTextMark     *uig_mark;
+	/* Scratch buffer for text which is inserted by a frame. */
+	GString         *uig_pending;
+	GArray          *uig_spans;
+	GtkTextTag      *uig_tags[XC_PRETTY_KINDS_NR];
+	guint            uig_tick_id;
+	/* Tasks formatting large records, ordered by sequence numbers. */
+	GQueue           uig_jobs;
+	uint64_t         uig_job_next;
+	/* Cancelled by fini, completions of running jobs are ignored then. */
+	GCancellable    *uig_jobs_cancel;
+	/* Bytes per nanosecond of formatting in the main thread. */
+	double           uig_format_rate;
+	/* Next records to be shown by the text and the list views. */
+	uint64_t         uig_text_next;
+	uint64_t         uig_list_next;
+	/* Number of lines which were trimmed from the head of the log. */
+	guint64          uig_line_offset;
+	guint            uig_line_digits;
+	GtkSourceGutterRenderer *uig_line_renderer;
+	/* Stanza list mode. */
+	GtkWidget       *uig_stack;
+	GtkWidget       *uig_list;
+	GtkListStore    *uig_list_store;
+	GtkSourceBuffer *uig_detail;
+	struct xc_pretty uig_pretty;
+	uint64_t         uig_time_base;
+	bool             uig_is_list;
 	bool             uig_done;
 };
 
+/* Formatting of a large record in a worker thread. */
+struct ui_gtk_job {
+	uint64_t         j_seq;
+	xc_dir_t         j_dir;
+	/* Copy of the payload, the store may reuse its arena meanwhile. */
+	char            *j_xml;
+	size_t           j_len;
+	struct xc_pretty j_pretty;
+	int              j_rc;
+	/* Set by the completion callback in the main thread. */
+	bool             j_done;
+};
+
+/*
+ * GSource which dispatches libstrophe events within the GTK main loop. It
+ * watches the connection socket and wakes up by timeout for the timer wheel
+ * and libstrophe timed handlers. Sockets of a swarm on the UI loop are
+ * watched by index of the connection.
+ */
+struct ui_gtk_source {
+	GSource        uis_source;
+	struct xc_ctx *uis_ctx;
+	gpointer       uis_tag;
+	gpointer       uis_wake_tag;
+	int            uis_fd;
+	struct pollfd  uis_swarm_fds[XC_SWARM_FDS_MAX];
+	gpointer       uis_swarm_tags[XC_SWARM_FDS_MAX];
+	int            uis_swarm_cur[XC_SWARM_FDS_MAX];
+	unsigned       uis_swarm_nr;
+};
+
 #define UI_GTK_TITLE_TEXT "XMPP Console"
-#define UI_GTK_EVENT_LOOP_TIMEOUT 10
+
+/*
+ * The log is trimmed when it exceeds the scrollback by this fraction, so
+ * lines are deleted from the head in large chunks rather than one by one.
+ */
+#define UI_GTK_TRIM_CHUNK(lines) ((lines) / 8 + 1)
+
+/* Number of payload bytes which are shown in a row of the stanza list. */
+#define UI_GTK_LIST_SNIPPET 256
+/* Minimal batch of rows which is added with the model detached. */
+#define UI_GTK_LIST_DETACH 1024
+
+/*
+ * Every record in the log is formatted with the same flags. A record goes to
+ * a worker thread when formatting it in place would exceed the budget at the
+ * rate measured on records of UI_GTK_RATE_MIN and larger. The threshold is
+ * kept within [UI_GTK_ASYNC_MIN, UI_GTK_ASYNC_MAX].
+ */
+#define UI_GTK_LOG_FLAGS \
+	(XC_PRETTY_INDENT | XC_PRETTY_FOLD | XC_PRETTY_SPANS)
+#define UI_GTK_FORMAT_BUDGET_NS 100000
+#define UI_GTK_RATE_MIN 512
+#define UI_GTK_ASYNC_MIN (2 * 1024)
+#define UI_GTK_ASYNC_MAX (16 * 1024)
+#define UI_GTK_JOBS_MAX 4
+
+enum {
+	UI_GTK_LIST_COL_SEQ,
+	UI_GTK_LIST_COLS_NR,
+};
 
 static gboolean ui_gtk_quit_cb(GObject *obj, gpointer data)
 {
@@ -74,6 +164,8 @@ static gboolean ui_gtk_input_cb(GObject *obj, GdkEventKey *event, gpointer data)
 		gtk_text_buffer_get_bounds (buffer, &start, &end);
 		text = gtk_text_buffer_get_text(buffer, &start, &end, FALSE);
 		xc_send(ui->ui_ctx, text);
+		/* Flush the stanza without waiting for the next wakeup. */
+		xc_run_once(ui->ui_ctx, 0);
 		g_free(text);
 		gtk_text_buffer_set_text(buffer, "", -1);
 		return TRUE;
@@ -81,18 +173,91 @@ static gboolean ui_gtk_input_cb(GObject *obj, GdkEventKey *event, gpointer data)
 	return FALSE;
 }
 
-static gboolean ui_gtk_timed_cb(gpointer data)
+/* libstrophe creates a new socket on every connection attempt. */
+static void ui_gtk_source_watch(GSource  *source,
+				gpointer *tag,
+				int      *cur,
+				int       fd,
+				short     events)
 {
-	struct xc_ui     *ui = data;
-	struct xc_ui_gtk *ui_gtk = ui->ui_priv;
-	xmpp_ctx_t       *xmpp_ctx = ui->ui_ctx->c_ctx;
+	if (fd != *cur) {
+		if (*tag != NULL)
+			g_source_remove_unix_fd(source, *tag);
+		*tag = fd >= 0 ? g_source_add_unix_fd(source, fd, G_IO_IN) :
+				 NULL;
+		*cur = fd;
+	}
+	if (*tag != NULL) {
+		/* GIOCondition values match poll(2) events on Unix. */
+		g_source_modify_unix_fd(source, *tag, (GIOCondition)events);
+	}
+}
 
-	xmpp_run_once(xmpp_ctx,
-		      ui_gtk->uig_done ? UI_GTK_EVENT_LOOP_TIMEOUT : 1);
+static gboolean ui_gtk_source_prepare(GSource *source, gint *timeout)
+{
+	struct ui_gtk_source *uis = (struct ui_gtk_source *)source;
+	struct xc_ctx        *ctx = uis->uis_ctx;
+	unsigned              nr;
+	unsigned              i;
+	int                   wait;
 
-	return TRUE;
+	ui_gtk_source_watch(source, &uis->uis_tag, &uis->uis_fd, xc_fd(ctx),
+			    xc_fd_events(ctx));
+	nr = xc_swarm_fds(ctx, uis->uis_swarm_fds);
+	for (i = 0; i < MAX(nr, uis->uis_swarm_nr); ++i) {
+		ui_gtk_source_watch(source, &uis->uis_swarm_tags[i],
+				    &uis->uis_swarm_cur[i],
+				    i < nr ? uis->uis_swarm_fds[i].fd : -1,
+				    uis->uis_swarm_fds[i].events);
+	}
+	uis->uis_swarm_nr = nr;
+	/* Negative ready time disables the timeout. */
+	wait = xc_timeout(ctx);
+	g_source_set_ready_time(source, wait < 0 ? -1 :
+				g_source_get_time(source) + (gint64)wait * 1000);
+	*timeout = -1;
+
+	return FALSE;
 }
 
+static gboolean ui_gtk_source_check(GSource *source)
+{
+	struct ui_gtk_source *uis = (struct ui_gtk_source *)source;
+	unsigned              i;
+
+	if ((uis->uis_tag != NULL &&
+	     g_source_query_unix_fd(source, uis->uis_tag) != 0) ||
+	    g_source_query_unix_fd(source, uis->uis_wake_tag) != 0)
+		return TRUE;
+	for (i = 0; i < uis->uis_swarm_nr; ++i) {
+		if (uis->uis_swarm_tags[i] != NULL &&
+		    g_source_query_unix_fd(source,
+					   uis->uis_swarm_tags[i]) != 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static gboolean ui_gtk_source_dispatch(GSource     *source,
+				       GSourceFunc  callback,
+				       gpointer     data)
+{
+	struct ui_gtk_source *uis = (struct ui_gtk_source *)source;
+	GIOCondition          revents = 0;
+
+	if (uis->uis_tag != NULL)
+		revents = g_source_query_unix_fd(source, uis->uis_tag);
+	xc_run_once(uis->uis_ctx, (short)revents);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs ui_gtk_source_funcs = {
+	.prepare  = ui_gtk_source_prepare,
+	.check    = ui_gtk_source_check,
+	.dispatch = ui_gtk_source_dispatch,
+};
+
 static void ui_gtk_status_set(struct xc_ui *ui, const gchar *status)
 {
 	struct xc_ui_gtk *ui_gtk = ui->ui_priv;
@@ -173,6 +338,752 @@ static char *ui_gtk_dialog_password(struct xc_ui *ui)
 	return password;
 }
 
+static void ui_gtk_line_renderer_resize(struct xc_ui_gtk *ui_gtk,
+					guint64           line)
+{
+	GtkSourceGutterRendererText *renderer;
+	gchar                        text[24];
+	gint                         width;
+	guint                        digits;
+
+	digits = (guint)g_snprintf(text, sizeof(text), "%" G_GUINT64_FORMAT,
+				   line);
+	if (digits == ui_gtk->uig_line_digits)
+		return;
+
+	memset(text, '0', digits);
+	renderer = GTK_SOURCE_GUTTER_RENDERER_TEXT(ui_gtk->uig_line_renderer);
+	gtk_source_gutter_renderer_text_measure(renderer, text, &width, NULL);
+	gtk_source_gutter_renderer_set_size(ui_gtk->uig_line_renderer, width);
+	ui_gtk->uig_line_digits = digits;
+}
+
+/*
+ * Replacement for the builtin line numbers which continues numbering after
+ * the head of the log is trimmed.
+ */
+static void ui_gtk_line_query_cb(GtkSourceGutterRenderer      *renderer,
+				 GtkTextIter                  *start,
+				 GtkTextIter                  *end,
+				 GtkSourceGutterRendererState  state,
+				 gpointer                      data)
+{
+	struct xc_ui_gtk *ui_gtk = data;
+	gchar             text[24];
+	gint              len;
+
+	len = g_snprintf(text, sizeof(text), "%" G_GUINT64_FORMAT,
+			 ui_gtk->uig_line_offset +
+			 gtk_text_iter_get_line(start) + 1);
+	gtk_source_gutter_renderer_text_set_text(
+		GTK_SOURCE_GUTTER_RENDERER_TEXT(renderer), text, len);
+}
+
+/* Deletes lines from the head of the log when it exceeds the scrollback. */
+static void ui_gtk_trim(struct xc_ui_gtk *ui_gtk, size_t scrollback)
+{
+	GtkTextBuffer *buffer = GTK_TEXT_BUFFER(ui_gtk->uig_buffer);
+	GtkTextIter    start;
+	GtkTextIter    end;
+	gint           lines;
+
+	/* The last line is empty, because every message ends with '\n'. */
+	lines = gtk_text_buffer_get_line_count(buffer) - 1;
+	if (scrollback == 0 ||
+	    (size_t)lines <= scrollback + UI_GTK_TRIM_CHUNK(scrollback))
+		return;
+
+	lines -= (gint)scrollback;
+	gtk_text_buffer_get_start_iter(buffer, &start);
+	gtk_text_buffer_get_iter_at_line(buffer, &end, lines);
+	gtk_text_buffer_delete(buffer, &start, &end);
+	ui_gtk->uig_line_offset += (guint64)lines;
+}
+
+static bool ui_gtk_is_at_bottom(GtkWidget *scrollable)
+{
+	GtkAdjustment *adj;
+
+	adj = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(scrollable));
+	return gtk_adjustment_get_value(adj) +
+	       gtk_adjustment_get_page_size(adj) >=
+	       gtk_adjustment_get_upper(adj) - 1.0;
+}
+
+static void ui_gtk_job_free(struct ui_gtk_job *job)
+{
+	xc_pretty_fini(&job->j_pretty);
+	g_free(job->j_xml);
+	g_free(job);
+}
+
+static void ui_gtk_job_thread(GTask        *task,
+			      gpointer      source,
+			      gpointer      data,
+			      GCancellable *cancellable)
+{
+	struct ui_gtk_job *job = data;
+
+	job->j_rc = xc_pretty_format(&job->j_pretty, job->j_xml, job->j_len,
+				     UI_GTK_LOG_FLAGS);
+	g_task_return_boolean(task, TRUE);
+}
+
+/* Size of records which are too expensive to format in the main thread. */
+static size_t ui_gtk_async_min(const struct xc_ui_gtk *ui_gtk)
+{
+	double len = ui_gtk->uig_format_rate * UI_GTK_FORMAT_BUDGET_NS;
+
+	if (ui_gtk->uig_format_rate == 0 || len > UI_GTK_ASYNC_MAX)
+		return UI_GTK_ASYNC_MAX;
+	return len < UI_GTK_ASYNC_MIN ? UI_GTK_ASYNC_MIN : (size_t)len;
+}
+
+static void ui_gtk_rate_update(struct xc_ui_gtk *ui_gtk,
+			       size_t            len,
+			       uint64_t          ns)
+{
+	double rate = (double)len / (double)MAX(ns, 1);
+	double prev = ui_gtk->uig_format_rate;
+
+	ui_gtk->uig_format_rate = prev == 0 ? rate : (prev * 7 + rate) / 8;
+}
+
+/*
+ * Starts formatting of large records within [seq, next), 'done' is called
+ * in the main thread when a job finishes. A job is freed together with its
+ * task when both the queue and the callback drop it.
+ */
+static void ui_gtk_jobs_start(struct xc_ui        *ui,
+			      uint64_t             seq,
+			      uint64_t             next,
+			      GAsyncReadyCallback  done)
+{
+	struct xc_ui_gtk       *ui_gtk = ui->ui_priv;
+	struct xc_store        *store = &ui->ui_ctx->c_store;
+	size_t                  async_min = ui_gtk_async_min(ui_gtk);
+	const struct xc_record *rec;
+	struct ui_gtk_job      *job;
+	GTask                  *task;
+
+	seq = MAX(seq, ui_gtk->uig_job_next);
+	for (; seq < next &&
+	       g_queue_get_length(&ui_gtk->uig_jobs) < UI_GTK_JOBS_MAX; ++seq) {
+		rec = xc_store_get(store, seq);
+		if (rec->rec_len < async_min)
+			continue;
+
+		job = g_new(struct ui_gtk_job, 1);
+		job->j_seq = seq;
+		job->j_dir = rec->rec_dir;
+		job->j_len = rec->rec_len;
+		job->j_xml = g_malloc(rec->rec_len);
+		memcpy(job->j_xml, xc_store_payload(store, rec), rec->rec_len);
+		xc_pretty_init(&job->j_pretty);
+		job->j_rc = 0;
+		job->j_done = false;
+
+		task = g_task_new(NULL, ui_gtk->uig_jobs_cancel, done, ui);
+		g_task_set_task_data(task, job,
+				     (GDestroyNotify)ui_gtk_job_free);
+		g_task_run_in_thread(task, ui_gtk_job_thread);
+		g_queue_push_tail(&ui_gtk->uig_jobs, task);
+	}
+	ui_gtk->uig_job_next = seq;
+}
+
+/* Drops jobs of records before 'seq'. Running ones finish in background. */
+static void ui_gtk_jobs_drop(struct xc_ui_gtk *ui_gtk, uint64_t seq)
+{
+	struct ui_gtk_job *job;
+	GTask             *task;
+
+	while ((task = g_queue_peek_head(&ui_gtk->uig_jobs)) != NULL) {
+		job = g_task_get_task_data(task);
+		if (job->j_seq >= seq)
+			break;
+		g_queue_pop_head(&ui_gtk->uig_jobs);
+		g_object_unref(task);
+	}
+}
+
+static void ui_gtk_text_append(struct xc_ui_gtk            *ui_gtk,
+			       xc_dir_t                     dir,
+			       const char                  *text,
+			       size_t                       len,
+			       const struct xc_pretty_span *spans,
+			       size_t                       spans_nr)
+{
+	GString               *pending = ui_gtk->uig_pending;
+	struct xc_pretty_span  span;
+	size_t                 base;
+	size_t                 i;
+
+	g_string_append(pending, xc_dir_name(dir));
+	g_string_append(pending, ": ");
+	base = pending->len;
+	g_string_append_len(pending, text, (gssize)len);
+	g_string_append_c(pending, '\n');
+	for (i = 0; i < spans_nr; ++i) {
+		span = spans[i];
+		span.ps_off += base;
+		g_array_append_val(ui_gtk->uig_spans, span);
+	}
+}
+
+static void ui_gtk_text_append_pretty(struct xc_ui_gtk       *ui_gtk,
+				      xc_dir_t                dir,
+				      const struct xc_pretty *pretty,
+				      int                     rc,
+				      const char             *xml,
+				      size_t                  len)
+{
+	/* Show the record as is if formatting failed. */
+	if (rc == 0) {
+		ui_gtk_text_append(ui_gtk, dir, pretty->p_buf, pretty->p_len,
+				   pretty->p_spans, pretty->p_spans_nr);
+	} else {
+		ui_gtk_text_append(ui_gtk, dir, xml, len, NULL, 0);
+	}
+}
+
+/* Inserts the pending text with a single insert and applies its spans. */
+static void ui_gtk_text_insert(struct xc_ui *ui)
+{
+	struct xc_ui_gtk      *ui_gtk = ui->ui_priv;
+	GtkTextBuffer         *buffer = GTK_TEXT_BUFFER(ui_gtk->uig_buffer);
+	GString               *pending = ui_gtk->uig_pending;
+	GArray                *spans = ui_gtk->uig_spans;
+	struct xc_pretty_span *span;
+	GtkTextIter            start;
+	GtkTextIter            end;
+	gint                   offset;
+	size_t                 pos = 0;
+	guint                  i;
+	bool                   is_bottom;
+
+	if (pending->len == 0)
+		return;
+
+	/* Check it before the insert changes the adjustment. */
+	is_bottom = ui_gtk_is_at_bottom(ui_gtk->uig_view);
+	offset = gtk_text_buffer_get_char_count(buffer);
+	gtk_text_buffer_get_end_iter(buffer, &end);
+	gtk_text_buffer_insert(buffer, &end, pending->str, (gint)pending->len);
+
+	/* Spans are in bytes, but iterators move by characters. */
+	gtk_text_buffer_get_iter_at_offset(buffer, &start, offset);
+	for (i = 0; i < spans->len; ++i) {
+		span = &g_array_index(spans, struct xc_pretty_span, i);
+		gtk_text_iter_forward_chars(&start, (gint)g_utf8_strlen(
+			pending->str + pos, (gssize)(span->ps_off - pos)));
+		end = start;
+		gtk_text_iter_forward_chars(&end, (gint)g_utf8_strlen(
+			pending->str + span->ps_off, (gssize)span->ps_len));
+		gtk_text_buffer_apply_tag(buffer,
+					  ui_gtk->uig_tags[span->ps_kind],
+					  &start, &end);
+		start = end;
+		pos = span->ps_off + span->ps_len;
+	}
+	g_string_truncate(pending, 0);
+	g_array_set_size(spans, 0);
+
+	ui_gtk_trim(ui_gtk, ui->ui_ctx->c_scrollback);
+	ui_gtk_line_renderer_resize(ui_gtk, ui_gtk->uig_line_offset +
+				    gtk_text_buffer_get_line_count(buffer));
+	if (is_bottom) {
+		gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(ui_gtk->uig_view),
+					     ui_gtk->uig_mark, 0, FALSE, 0, 0);
+	}
+}
+
+/*
+ * Moves new records to the log buffer. Small records are formatted in place,
+ * large ones by worker threads and the following records wait for them to
+ * keep the order. Records before uig_job_next without a job were found small
+ * by ui_gtk_jobs_start(), the later ones are checked here the same way and
+ * the flush stops at a large one until a job is started for it.
+ */
+static void ui_gtk_text_flush(struct xc_ui *ui)
+{
+	struct xc_ui_gtk       *ui_gtk = ui->ui_priv;
+	struct xc_store        *store = &ui->ui_ctx->c_store;
+	size_t                  scrollback = ui->ui_ctx->c_scrollback;
+	size_t                  async_min = ui_gtk_async_min(ui_gtk);
+	const struct xc_record *rec;
+	struct ui_gtk_job      *job;
+	const char             *payload;
+	GTask                  *task;
+	uint64_t                start = 0;
+	uint64_t                seq;
+	uint64_t                next;
+	bool                    is_timed;
+	int                     rc;
+
+	next = xc_store_next(store);
+	seq = MAX(ui_gtk->uig_text_next, xc_store_first(store));
+	/* Every record takes a line at least, older ones would be trimmed. */
+	if (scrollback > 0 && next - seq > scrollback)
+		seq = next - scrollback;
+	ui_gtk_jobs_drop(ui_gtk, seq);
+
+	for (; seq < next; ++seq) {
+		rec = xc_store_get(store, seq);
+		/* Jobs are started in order, so the first one is for 'seq'. */
+		task = g_queue_peek_head(&ui_gtk->uig_jobs);
+		job = task != NULL ? g_task_get_task_data(task) : NULL;
+		if (job != NULL && job->j_seq == seq) {
+			if (!job->j_done)
+				break;
+			ui_gtk_text_append_pretty(ui_gtk, job->j_dir,
+						  &job->j_pretty, job->j_rc,
+						  job->j_xml, job->j_len);
+			g_queue_pop_head(&ui_gtk->uig_jobs);
+			g_object_unref(task);
+			continue;
+		}
+		if (seq >= ui_gtk->uig_job_next && rec->rec_len >= async_min)
+			break;
+
+		payload = xc_store_payload(store, rec);
+		is_timed = rec->rec_len >= UI_GTK_RATE_MIN;
+		if (is_timed)
+			start = xc_time_ns();
+		rc = xc_pretty_format(&ui_gtk->uig_pretty, payload,
+				      rec->rec_len, UI_GTK_LOG_FLAGS);
+		if (is_timed) {
+			ui_gtk_rate_update(ui_gtk, rec->rec_len,
+					   xc_time_ns() - start);
+		}
+		ui_gtk_text_append_pretty(ui_gtk, rec->rec_dir,
+					  &ui_gtk->uig_pretty, rc,
+					  payload, rec->rec_len);
+	}
+	ui_gtk->uig_text_next = seq;
+	ui_gtk->uig_job_next = MAX(ui_gtk->uig_job_next, seq);
+	ui_gtk_text_insert(ui);
+}
+
+/* Adds rows for new records and removes rows of evicted ones. */
+static void ui_gtk_list_flush(struct xc_ui *ui)
+{
+	struct xc_ui_gtk *ui_gtk = ui->ui_priv;
+	struct xc_store  *store = &ui->ui_ctx->c_store;
+	GtkTreeView      *view = GTK_TREE_VIEW(ui_gtk->uig_list);
+	GtkTreeModel     *model = GTK_TREE_MODEL(ui_gtk->uig_list_store);
+	GtkTreePath      *path;
+	GtkTreeIter       iter;
+	guint64           row_seq;
+	uint64_t          first;
+	uint64_t          next;
+	uint64_t          seq;
+	gint              rows;
+	bool              is_bottom;
+	bool              is_detached;
+
+	first = xc_store_first(store);
+	next = xc_store_next(store);
+	if (ui_gtk->uig_list_next == next)
+		return;
+
+	seq = MAX(ui_gtk->uig_list_next, first);
+	is_bottom = ui_gtk_is_at_bottom(ui_gtk->uig_list);
+	/*
+	 * Row signals are expensive for a large batch. Detach the model when
+	 * the view is going to be scrolled to the bottom anyway.
+	 */
+	is_detached = is_bottom && next - seq > UI_GTK_LIST_DETACH;
+	if (is_detached) {
+		g_object_ref(model);
+		gtk_tree_view_set_model(view, NULL);
+	}
+
+	while (gtk_tree_model_get_iter_first(model, &iter)) {
+		gtk_tree_model_get(model, &iter, UI_GTK_LIST_COL_SEQ, &row_seq,
+				   -1);
+		if (row_seq >= first)
+			break;
+		gtk_list_store_remove(ui_gtk->uig_list_store, &iter);
+	}
+	for (; seq < next; ++seq) {
+		gtk_list_store_insert_with_values(ui_gtk->uig_list_store,
+						  NULL, -1,
+						  UI_GTK_LIST_COL_SEQ,
+						  (guint64)seq, -1);
+	}
+	ui_gtk->uig_list_next = next;
+
+	if (is_detached) {
+		gtk_tree_view_set_model(view, model);
+		g_object_unref(model);
+	}
+	rows = gtk_tree_model_iter_n_children(model, NULL);
+	if (is_bottom && rows > 0) {
+		path = gtk_tree_path_new_from_indices(rows - 1, -1);
+		gtk_tree_view_scroll_to_cell(view, path, NULL, FALSE, 0, 0);
+		gtk_tree_path_free(path);
+	}
+}
+
+/*
+ * Finishes a job in the main thread. The log waits for it in order, so the
+ * records behind it are flushed right away and the freed slot is given to
+ * the next large record. Nothing polls the workers meanwhile.
+ */
+static void ui_gtk_job_done_cb(GObject      *source,
+			       GAsyncResult *result,
+			       gpointer      data)
+{
+	struct xc_ui      *ui = data;
+	GTask             *task = G_TASK(result);
+	struct ui_gtk_job *job = g_task_get_task_data(task);
+	struct xc_ui_gtk  *ui_gtk;
+
+	/* The UI is finalized and 'ui' mustn't be touched. */
+	if (g_cancellable_is_cancelled(g_task_get_cancellable(task)))
+		return;
+
+	job->j_done = true;
+	ui_gtk = ui->ui_priv;
+	if (ui_gtk->uig_done || ui_gtk->uig_is_list)
+		return;
+	ui_gtk_text_flush(ui);
+	ui_gtk_jobs_start(ui, ui_gtk->uig_text_next,
+			  xc_store_next(&ui->ui_ctx->c_store),
+			  ui_gtk_job_done_cb);
+}
+
+static gboolean ui_gtk_flush_tick_cb(GtkWidget     *widget,
+				     GdkFrameClock *clock,
+				     gpointer       data)
+{
+	struct xc_ui     *ui = data;
+	struct xc_ui_gtk *ui_gtk = ui->ui_priv;
+
+	if (!ui_gtk->uig_done) {
+		if (ui_gtk->uig_is_list) {
+			ui_gtk_list_flush(ui);
+		} else {
+			/* Completions of the jobs flush the rest. */
+			ui_gtk_text_flush(ui);
+			ui_gtk_jobs_start(ui, ui_gtk->uig_text_next,
+					  xc_store_next(&ui->ui_ctx->c_store),
+					  ui_gtk_job_done_cb);
+		}
+	}
+	ui_gtk->uig_tick_id = 0;
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Views pick up new records from the store once per frame. Inserting every
+ * stanza separately makes GtkSourceView re-highlight and re-layout the view
+ * for each of them, which freezes the window under a flood. Only the active
+ * view is updated, the other one catches up when it is shown.
+ */
+static void ui_gtk_flush_schedule(struct xc_ui *ui)
+{
+	struct xc_ui_gtk *ui_gtk = ui->ui_priv;
+
+	/* The window is always mapped unlike the views in the stack. */
+	if (ui_gtk->uig_tick_id == 0) {
+		ui_gtk->uig_tick_id = gtk_widget_add_tick_callback(
+			ui_gtk->uig_window, ui_gtk_flush_tick_cb, ui, NULL);
+	}
+}
+
+static const struct xc_record *ui_gtk_list_record(struct xc_ui *ui,
+						  GtkTreeModel *model,
+						  GtkTreeIter  *iter)
+{
+	guint64 seq;
+
+	gtk_tree_model_get(model, iter, UI_GTK_LIST_COL_SEQ, &seq, -1);
+	return xc_store_get(&ui->ui_ctx->c_store, seq);
+}
+
+/* Cells are formatted on demand, so only visible rows cost anything. */
+static void ui_gtk_list_time_cb(GtkTreeViewColumn *column,
+				GtkCellRenderer   *cell,
+				GtkTreeModel      *model,
+				GtkTreeIter       *iter,
+				gpointer           data)
+{
+	struct xc_ui           *ui = data;
+	struct xc_ui_gtk       *ui_gtk = ui->ui_priv;
+	const struct xc_record *rec;
+	gchar                   text[32];
+
+	rec = ui_gtk_list_record(ui, model, iter);
+	text[0] = '\0';
+	if (rec != NULL) {
+		g_snprintf(text, sizeof(text), "%.3f",
+			   (double)(rec->rec_time - ui_gtk->uig_time_base) /
+			   1e9);
+	}
+	g_object_set(cell, "text", text, NULL);
+}
+
+static void ui_gtk_list_dir_cb(GtkTreeViewColumn *column,
+			       GtkCellRenderer   *cell,
+			       GtkTreeModel      *model,
+			       GtkTreeIter       *iter,
+			       gpointer           data)
+{
+	const struct xc_record *rec;
+
+	rec = ui_gtk_list_record(data, model, iter);
+	g_object_set(cell, "text", rec != NULL ? xc_dir_name(rec->rec_dir) : "",
+		     NULL);
+}
+
+static void ui_gtk_markup_append(GString    *markup,
+				 const char *text,
+				 size_t      len)
+{
+	gchar *valid;
+	gchar *escaped;
+
+	valid = g_utf8_make_valid(text, (gssize)len);
+	g_strdelimit(valid, "\r\n\t", ' ');
+	escaped = g_markup_escape_text(valid, -1);
+	g_string_append(markup, escaped);
+	g_free(escaped);
+	g_free(valid);
+}
+
+static void ui_gtk_list_summary_cb(GtkTreeViewColumn *column,
+				   GtkCellRenderer   *cell,
+				   GtkTreeModel      *model,
+				   GtkTreeIter       *iter,
+				   gpointer           data)
+{
+	struct xc_ui           *ui = data;
+	struct xc_store        *store = &ui->ui_ctx->c_store;
+	const struct xc_record *rec;
+	const char             *payload;
+	GString                *markup;
+
+	rec = ui_gtk_list_record(ui, model, iter);
+	if (rec == NULL) {
+		g_object_set(cell, "markup", "", NULL);
+		return;
+	}
+
+	payload = xc_store_payload(store, rec);
+	markup = g_string_sized_new(UI_GTK_LIST_SNIPPET * 2);
+	if (rec->rec_name_len > 0) {
+		g_string_append(markup, "<b>");
+		ui_gtk_markup_append(markup, payload + rec->rec_name_off,
+				     rec->rec_name_len);
+		g_string_append(markup, "</b> ");
+	}
+	if (rec->rec_ns_len > 0) {
+		g_string_append(markup, "<i>");
+		ui_gtk_markup_append(markup, payload + rec->rec_ns_off,
+				     rec->rec_ns_len);
+		g_string_append(markup, "</i> ");
+	}
+	ui_gtk_markup_append(markup, payload,
+			     MIN(rec->rec_len, UI_GTK_LIST_SNIPPET));
+	g_object_set(cell, "markup", markup->str, NULL);
+	g_string_free(markup, TRUE);
+}
+
+/* Shows the whole record pretty-printed in the detail view. */
+static void ui_gtk_list_activated_cb(GtkTreeView       *view,
+				     GtkTreePath       *path,
+				     GtkTreeViewColumn *column,
+				     gpointer           data)
+{
+	struct xc_ui           *ui = data;
+	struct xc_ui_gtk       *ui_gtk = ui->ui_priv;
+	struct xc_store        *store = &ui->ui_ctx->c_store;
+	GtkTreeModel           *model = gtk_tree_view_get_model(view);
+	const struct xc_record *rec;
+	const char             *payload;
+	GtkTreeIter             iter;
+	int                     rc;
+
+	if (!gtk_tree_model_get_iter(model, &iter, path))
+		return;
+	rec = ui_gtk_list_record(ui, model, &iter);
+	if (rec == NULL)
+		return;
+
+	payload = xc_store_payload(store, rec);
+	rc = xc_pretty_format(&ui_gtk->uig_pretty, payload, rec->rec_len,
+			      XC_PRETTY_INDENT | XC_PRETTY_FOLD);
+	gtk_text_buffer_set_text(GTK_TEXT_BUFFER(ui_gtk->uig_detail),
+				 rc == 0 ? ui_gtk->uig_pretty.p_buf : payload,
+				 -1);
+}
+
+/*
+ * Pages through a capture file when the list is scrolled to its edge. Newer
+ * records are added by the flush as they are fed, an older part replaces
+ * the rows and the row at the edge keeps its position.
+ */
+static void ui_gtk_list_edge_cb(GtkScrolledWindow *scrolled,
+				GtkPositionType    pos,
+				gpointer           data)
+{
+	struct xc_ui     *ui = data;
+	struct xc_ui_gtk *ui_gtk = ui->ui_priv;
+	struct xc_store  *store = &ui->ui_ctx->c_store;
+	GtkTreeView      *view = GTK_TREE_VIEW(ui_gtk->uig_list);
+	GtkTreeModel     *model = GTK_TREE_MODEL(ui_gtk->uig_list_store);
+	GtkTreePath      *start;
+	GtkTreePath      *end;
+	GtkTreeIter       iter;
+	guint64           row_seq;
+	uint64_t          first;
+	uint64_t          next;
+	uint64_t          seq;
+	bool              older = pos == GTK_POS_TOP;
+	bool              found;
+
+	if (pos != GTK_POS_TOP && pos != GTK_POS_BOTTOM)
+		return;
+	if (!gtk_tree_view_get_visible_range(view, &start, &end))
+		return;
+	found = gtk_tree_model_get_iter(model, &iter, older ? start : end);
+	gtk_tree_path_free(start);
+	gtk_tree_path_free(end);
+	if (!found)
+		return;
+	gtk_tree_model_get(model, &iter, UI_GTK_LIST_COL_SEQ, &row_seq, -1);
+	seq = row_seq;
+	if (!xc_file_page(ui->ui_ctx, older, &seq) || !older)
+		return;
+
+	/* All rows are replaced, so the model is detached. */
+	first = xc_store_first(store);
+	next = xc_store_next(store);
+	g_object_ref(model);
+	gtk_tree_view_set_model(view, NULL);
+	gtk_list_store_clear(ui_gtk->uig_list_store);
+	for (row_seq = first; row_seq < next; ++row_seq) {
+		gtk_list_store_insert_with_values(ui_gtk->uig_list_store,
+						  NULL, -1,
+						  UI_GTK_LIST_COL_SEQ,
+						  row_seq, -1);
+	}
+	ui_gtk->uig_list_next = next;
+	gtk_tree_view_set_model(view, model);
+	g_object_unref(model);
+	if (seq < next) {
+		start = gtk_tree_path_new_from_indices((gint)(seq - first), -1);
+		gtk_tree_view_scroll_to_cell(view, start, NULL, TRUE,
+					     older ? 0.0 : 1.0, 0);
+		gtk_tree_path_free(start);
+	}
+
+	/* The log is rebuilt from the loaded part when it is shown. */
+	gtk_text_buffer_set_text(GTK_TEXT_BUFFER(ui_gtk->uig_buffer), "", 0);
+	ui_gtk->uig_line_offset = 0;
+	ui_gtk_jobs_drop(ui_gtk, UINT64_MAX);
+	ui_gtk->uig_job_next = first;
+	ui_gtk->uig_text_next = first;
+}
+
+static void ui_gtk_mode_toggled_cb(GtkToggleButton *button, gpointer data)
+{
+	struct xc_ui     *ui = data;
+	struct xc_ui_gtk *ui_gtk = ui->ui_priv;
+
+	ui_gtk->uig_is_list = gtk_toggle_button_get_active(button);
+	gtk_stack_set_visible_child_name(GTK_STACK(ui_gtk->uig_stack),
+					 ui_gtk->uig_is_list ? "list" : "text");
+	ui_gtk_flush_schedule(ui);
+}
+
+static GtkTreeViewColumn *ui_gtk_list_column_new(const gchar         *title,
+						 gint                 width,
+						 GtkTreeCellDataFunc  func,
+						 struct xc_ui        *ui)
+{
+	GtkTreeViewColumn *column;
+	GtkCellRenderer   *cell;
+
+	cell = gtk_cell_renderer_text_new();
+	g_object_set(cell, "ellipsize", PANGO_ELLIPSIZE_END,
+		     "single-paragraph-mode", TRUE, NULL);
+	column = gtk_tree_view_column_new();
+	gtk_tree_view_column_set_title(column, title);
+	gtk_tree_view_column_pack_start(column, cell, TRUE);
+	gtk_tree_view_column_set_cell_data_func(column, cell, func, ui, NULL);
+	/* Fixed height mode requires fixed sizing of all columns. */
+	gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+	if (width > 0)
+		gtk_tree_view_column_set_fixed_width(column, width);
+	else
+		gtk_tree_view_column_set_expand(column, TRUE);
+
+	return column;
+}
+
+/*
+ * Looks up a style of the XML language the way GtkSourceView highlights it:
+ * the scheme entry of the language, then the entries it maps to.
+ */
+static GtkSourceStyle *ui_gtk_style_get(GtkSourceStyleScheme *scheme,
+					GtkSourceLanguage    *lang,
+					const char           *id)
+{
+	GtkSourceStyle *style = NULL;
+
+	while (id != NULL) {
+		style = gtk_source_style_scheme_get_style(scheme, id);
+		if (style != NULL || lang == NULL)
+			break;
+		id = gtk_source_language_get_style_fallback(lang, id);
+	}
+	return style;
+}
+
+/*
+ * Text tags for spans take colors of the XML language in the style scheme,
+ * so the log looks as it did with the highlighting of GtkSourceView.
+ */
+static void ui_gtk_tags_init(struct xc_ui_gtk  *ui_gtk,
+			     GtkSourceBuffer   *buffer,
+			     GtkSourceLanguage *lang)
+{
+	static const char *styles[XC_PRETTY_KINDS_NR] = {
+		[XC_PRETTY_TAG]     = "xml:element-name",
+		[XC_PRETTY_ATTR]    = "xml:attribute-name",
+		[XC_PRETTY_VALUE]   = "xml:attribute-value",
+		[XC_PRETTY_COMMENT] = "xml:comment",
+	};
+	static const char *fallbacks[XC_PRETTY_KINDS_NR] = {
+		[XC_PRETTY_TAG]     = "def:keyword",
+		[XC_PRETTY_ATTR]    = "def:type",
+		[XC_PRETTY_VALUE]   = "def:string",
+		[XC_PRETTY_COMMENT] = "def:comment",
+	};
+	GtkSourceStyleScheme *scheme;
+	GtkSourceStyle       *style;
+	size_t                i;
+
+	scheme = gtk_source_buffer_get_style_scheme(buffer);
+	for (i = 0; i < ARRAY_SIZE(styles); ++i) {
+		ui_gtk->uig_tags[i] = gtk_text_buffer_create_tag(
+			GTK_TEXT_BUFFER(buffer), NULL, NULL);
+		if (scheme == NULL)
+			continue;
+		style = ui_gtk_style_get(scheme, lang, styles[i]);
+		if (style == NULL) {
+			style = gtk_source_style_scheme_get_style(scheme,
+								  fallbacks[i]);
+		}
+		if (style != NULL)
+			gtk_source_style_apply(style, ui_gtk->uig_tags[i]);
+	}
+}
+
 /*
  *  <-----Box for status bar---->
  *
@@ -180,9 +1091,9 @@ static char *ui_gtk_dialog_password(struct xc_ui *ui)
  * | Status bar with JID and TLS |        |
  * +-----------------------------+        |
  * |                             |  ^     |
- * |  SourceView for displaying  |  |     |
- * |       the XMPP stream       |  |     |
- * |                             |  |    Box
+ * |  Stack of SourceView and    |  |     |
+ * |  stanza list for displaying |  |     |
+ * |       the XMPP stream       |  |    Box
  * |                             | Paned  |
  * +-----------------------------+  |     |
  * |                             |  |     |
@@ -193,7 +1104,16 @@ static char *ui_gtk_dialog_password(struct xc_ui *ui)
  *
  * Status bar:
  * +-Frame-----------------------+
- * |         JID      |TLS|STATUS|
+ * |     JID  |LIST|TLS|STATUS   |
+ * +-----------------------------+
+ *
+ * Stanza list:
+ * +-----------------------------+
+ * | TreeView with a row per     |
+ * | record                      |
+ * +-----------------------------+
+ * | SourceView with the record  |
+ * | selected in the list        |
  * +-----------------------------+
  */
 
@@ -212,7 +1132,16 @@ static int ui_gtk_init(struct xc_ui *ui)
 	GtkWidget                *scrolled;
 	GtkWidget                *scrolled_input;
 	GtkWidget                *box;
+	GtkWidget                *stack;
 	gboolean                  check;
+	/* Stanza list. */
+	GtkListStore             *list_store;
+	GtkWidget                *list;
+	GtkWidget                *list_paned;
+	GtkWidget                *scrolled_list;
+	GtkWidget                *scrolled_detail;
+	GtkWidget                *detail;
+	GtkSourceBuffer          *detail_buffer;
 	/* Status bar. */
 	GtkWidget                *status_frame;
 	GtkWidget                *status_box;
@@ -220,6 +1149,10 @@ static int ui_gtk_init(struct xc_ui *ui)
 	GtkWidget                *status_tls;
 	GtkWidget                *status_conn;
 	GtkWidget                *status_spinner;
+	GtkWidget                *status_list;
+	GtkWidget                *status_stats;
+	GtkSourceGutter          *gutter;
+	GtkSourceGutterRenderer  *line_renderer;
 
 	check = gtk_init_check(NULL, NULL);
 	if (!check)
@@ -240,12 +1173,26 @@ static int ui_gtk_init(struct xc_ui *ui)
 	gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(input), GTK_WRAP_WORD);
 	gtk_widget_set_sensitive(input, FALSE);
 
-	buffer = gtk_source_buffer_new_with_language(lang);
+	/*
+	 * The log isn't highlighted by the language, because it would tokenize
+	 * large stanzas in the main thread. Spans from xc_pretty are applied
+	 * as tags with the colors of the language instead.
+	 */
+	buffer = gtk_source_buffer_new(NULL);
 	gtk_text_buffer_get_end_iter(GTK_TEXT_BUFFER(buffer), &buffer_end);
 	buffer_mark = gtk_text_buffer_create_mark (GTK_TEXT_BUFFER(buffer),
 						NULL, &buffer_end, FALSE);
+	/* The log is never edited, so don't keep undo history for it. */
+	gtk_source_buffer_set_max_undo_levels(buffer, 0);
 	view = gtk_source_view_new_with_buffer(buffer);
-	gtk_source_view_set_show_line_numbers(GTK_SOURCE_VIEW(view), TRUE);
+	gutter = gtk_source_view_get_gutter(GTK_SOURCE_VIEW(view),
+					    GTK_TEXT_WINDOW_LEFT);
+	line_renderer = gtk_source_gutter_renderer_text_new();
+	gtk_source_gutter_renderer_set_alignment(line_renderer, 1.0, 0.5);
+	gtk_source_gutter_renderer_set_padding(line_renderer, 4, -1);
+	gtk_source_gutter_insert(gutter, line_renderer, 0);
+	g_signal_connect(G_OBJECT(line_renderer), "query-data",
+			 G_CALLBACK(ui_gtk_line_query_cb), ui_gtk);
 	gtk_text_view_set_editable(GTK_TEXT_VIEW(view), FALSE);
 	gtk_text_view_set_cursor_visible(GTK_TEXT_VIEW(view), FALSE);
 	gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(view), GTK_WRAP_CHAR);
@@ -255,6 +1202,40 @@ static int ui_gtk_init(struct xc_ui *ui)
 	gtk_widget_set_vexpand(scrolled, TRUE);
 	gtk_container_add(GTK_CONTAINER(scrolled), view);
 
+	/* The model keeps only sequence numbers of records in the store. */
+	list_store = gtk_list_store_new(UI_GTK_LIST_COLS_NR, G_TYPE_UINT64);
+	list = gtk_tree_view_new_with_model(GTK_TREE_MODEL(list_store));
+	gtk_tree_view_append_column(GTK_TREE_VIEW(list),
+		ui_gtk_list_column_new("Time", 90, ui_gtk_list_time_cb, ui));
+	gtk_tree_view_append_column(GTK_TREE_VIEW(list),
+		ui_gtk_list_column_new("Dir", 50, ui_gtk_list_dir_cb, ui));
+	gtk_tree_view_append_column(GTK_TREE_VIEW(list),
+		ui_gtk_list_column_new("Stanza", 0, ui_gtk_list_summary_cb,
+				       ui));
+	gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(list), TRUE);
+	gtk_tree_view_set_activate_on_single_click(GTK_TREE_VIEW(list), TRUE);
+
+	scrolled_list = gtk_scrolled_window_new(NULL, NULL);
+	gtk_widget_set_vexpand(scrolled_list, TRUE);
+	gtk_container_add(GTK_CONTAINER(scrolled_list), list);
+
+	detail_buffer = gtk_source_buffer_new_with_language(lang);
+	gtk_source_buffer_set_max_undo_levels(detail_buffer, 0);
+	detail = gtk_source_view_new_with_buffer(detail_buffer);
+	gtk_text_view_set_editable(GTK_TEXT_VIEW(detail), FALSE);
+	gtk_text_view_set_wrap_mode(GTK_TEXT_VIEW(detail), GTK_WRAP_CHAR);
+	scrolled_detail = gtk_scrolled_window_new(NULL, NULL);
+	gtk_container_add(GTK_CONTAINER(scrolled_detail), detail);
+	gtk_widget_set_size_request(scrolled_detail, -1, 150);
+
+	list_paned = gtk_paned_new(GTK_ORIENTATION_VERTICAL);
+	gtk_paned_pack1(GTK_PANED(list_paned), scrolled_list, TRUE, TRUE);
+	gtk_paned_pack2(GTK_PANED(list_paned), scrolled_detail, FALSE, TRUE);
+
+	stack = gtk_stack_new();
+	gtk_stack_add_named(GTK_STACK(stack), scrolled, "text");
+	gtk_stack_add_named(GTK_STACK(stack), list_paned, "list");
+
 	scrolled_input = gtk_scrolled_window_new(NULL, NULL);
 	gtk_widget_set_hexpand(scrolled_input, FALSE);
 	gtk_widget_set_vexpand(scrolled_input, TRUE);
@@ -262,7 +1243,7 @@ static int ui_gtk_init(struct xc_ui *ui)
 	gtk_widget_set_size_request(scrolled_input, -1, 100);
 
 	paned = gtk_paned_new(GTK_ORIENTATION_VERTICAL);
-	gtk_paned_pack1(GTK_PANED(paned), scrolled, TRUE, TRUE);
+	gtk_paned_pack1(GTK_PANED(paned), stack, TRUE, TRUE);
 	gtk_paned_pack2(GTK_PANED(paned), scrolled_input, FALSE, FALSE);
 	gtk_paned_set_wide_handle(GTK_PANED(paned), TRUE);
 
@@ -271,11 +1252,15 @@ static int ui_gtk_init(struct xc_ui *ui)
 	gtk_widget_set_sensitive(status_tls, FALSE);
 	status_conn = gtk_label_new(NULL);
 	status_spinner = gtk_spinner_new();
+	status_list = gtk_toggle_button_new_with_label("Stanza list");
+	status_stats = gtk_label_new(NULL);
 	status_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
 	gtk_box_pack_start(GTK_BOX(status_box), status_jid, TRUE, TRUE, 0);
 	gtk_box_pack_end(GTK_BOX(status_box), status_spinner, FALSE, FALSE, 0);
 	gtk_box_pack_end(GTK_BOX(status_box), status_conn, FALSE, FALSE, 0);
 	gtk_box_pack_end(GTK_BOX(status_box), status_tls, FALSE, FALSE, 0);
+	gtk_box_pack_end(GTK_BOX(status_box), status_stats, FALSE, FALSE, 0);
+	gtk_box_pack_end(GTK_BOX(status_box), status_list, FALSE, FALSE, 0);
 	status_frame = gtk_frame_new(NULL);
 	gtk_container_add(GTK_CONTAINER(status_frame), status_box);
 	gtk_container_set_border_width(GTK_CONTAINER(status_frame), 10);
@@ -294,10 +1279,35 @@ static int ui_gtk_init(struct xc_ui *ui)
 	ui_gtk->uig_mark   = buffer_mark;
 	ui_gtk->uig_done   = false;
 
+	ui_gtk->uig_pending = g_string_sized_new(4096);
+	ui_gtk->uig_spans = g_array_new(FALSE, FALSE,
+					sizeof(struct xc_pretty_span));
+	ui_gtk->uig_tick_id = 0;
+	ui_gtk->uig_job_next = 0;
+	g_queue_init(&ui_gtk->uig_jobs);
+	ui_gtk->uig_jobs_cancel = g_cancellable_new();
+	ui_gtk->uig_format_rate = 0;
+	ui_gtk_tags_init(ui_gtk, buffer, lang);
+	ui_gtk->uig_line_offset   = 0;
+	ui_gtk->uig_line_digits   = 0;
+	ui_gtk->uig_line_renderer = line_renderer;
+	ui_gtk_line_renderer_resize(ui_gtk, 1);
+
+	ui_gtk->uig_text_next  = 0;
+	ui_gtk->uig_list_next  = 0;
+	ui_gtk->uig_stack      = stack;
+	ui_gtk->uig_list       = list;
+	ui_gtk->uig_list_store = list_store;
+	ui_gtk->uig_detail     = detail_buffer;
+	ui_gtk->uig_time_base  = xc_time_ns();
+	ui_gtk->uig_is_list    = false;
+	xc_pretty_init(&ui_gtk->uig_pretty);
+
 	ui_gtk->uig_status_jid     = status_jid;
 	ui_gtk->uig_status_tls     = status_tls;
 	ui_gtk->uig_status_conn    = status_conn;
 	ui_gtk->uig_status_spinner = status_spinner;
+	ui_gtk->uig_status_stats   = status_stats;
 
 	ui->ui_priv = ui_gtk;
 
@@ -305,6 +1315,12 @@ static int ui_gtk_init(struct xc_ui *ui)
 			 G_CALLBACK(ui_gtk_quit_cb), ui);
 	g_signal_connect(G_OBJECT(input), "key-press-event",
 			 G_CALLBACK(ui_gtk_input_cb), ui);
+	g_signal_connect(G_OBJECT(list), "row-activated",
+			 G_CALLBACK(ui_gtk_list_activated_cb), ui);
+	g_signal_connect(G_OBJECT(scrolled_list), "edge-reached",
+			 G_CALLBACK(ui_gtk_list_edge_cb), ui);
+	g_signal_connect(G_OBJECT(status_list), "toggled",
+			 G_CALLBACK(ui_gtk_mode_toggled_cb), ui);
 	gtk_window_set_position(GTK_WINDOW(window), GTK_WIN_POS_CENTER);
 	gtk_widget_show_all(window);
 
@@ -313,6 +1329,16 @@ static int ui_gtk_init(struct xc_ui *ui)
 
 static void ui_gtk_fini(struct xc_ui *ui)
 {
+	struct xc_ui_gtk *ui_gtk = ui->ui_priv;
+
+	/* Running jobs outlive the UI, their completions become no-op. */
+	g_cancellable_cancel(ui_gtk->uig_jobs_cancel);
+	g_object_unref(ui_gtk->uig_jobs_cancel);
+	ui_gtk_jobs_drop(ui_gtk, UINT64_MAX);
+	xc_pretty_fini(&ui_gtk->uig_pretty);
+	g_object_unref(ui_gtk->uig_list_store);
+	g_array_free(ui_gtk->uig_spans, TRUE);
+	g_string_free(ui_gtk->uig_pending, TRUE);
 	free(ui->ui_priv);
 	ui->ui_priv = NULL;
 }
@@ -353,33 +1379,45 @@ static void ui_gtk_state_set(struct xc_ui *ui, xc_ui_state_t state)
 		ui_gtk_status_set(ui, "[offline]");
 		gtk_widget_set_sensitive(ui_gtk->uig_input, FALSE);
 		break;
+	case XC_UI_OFFLINE:
+		ui_gtk_status_set(ui, "[read-only]");
+		gtk_widget_set_sensitive(ui_gtk->uig_input, FALSE);
+		break;
 	}
 }
 
 static void ui_gtk_run(struct xc_ui *ui)
 {
-	g_timeout_add(UI_GTK_EVENT_LOOP_TIMEOUT, ui_gtk_timed_cb, ui);
+	struct ui_gtk_source *uis;
+	GSource              *source;
+	size_t                i;
+
+	source = g_source_new(&ui_gtk_source_funcs, sizeof(*uis));
+	uis = (struct ui_gtk_source *)source;
+	uis->uis_ctx = ui->ui_ctx;
+	uis->uis_tag = NULL;
+	uis->uis_fd  = -1;
+	for (i = 0; i < ARRAY_SIZE(uis->uis_swarm_cur); ++i)
+		uis->uis_swarm_cur[i] = -1;
+	uis->uis_wake_tag = g_source_add_unix_fd(source,
+						 xc_wake_fd(ui->ui_ctx),
+						 G_IO_IN);
+	g_source_set_name(source, "xmppconsole libstrophe");
+	g_source_attach(source, NULL);
+
 	gtk_main();
+
+	g_source_destroy(source);
+	g_source_unref(source);
 }
 
-static void ui_gtk_print(struct xc_ui *ui, const char *msg)
+static void ui_gtk_print(struct xc_ui *ui, const struct xc_record *rec)
 {
 	struct xc_ui_gtk *ui_gtk = ui->ui_priv;
-	GtkSourceBuffer  *buffer = ui_gtk->uig_buffer;
-	GtkTextIter       end;
-	GString          *text;
 
-	if (!ui_gtk->uig_done) {
-		text = g_string_new(msg);
-		g_string_append(text, "\n");
-		gtk_text_buffer_get_end_iter(GTK_TEXT_BUFFER(buffer), &end);
-		gtk_text_buffer_insert(GTK_TEXT_BUFFER(buffer), &end,
-				       text->str, -1);
-		g_string_free(text, TRUE);
-		/* TODO Scroll only when it is at the bottom. */
-		gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(ui_gtk->uig_view),
-					     ui_gtk->uig_mark, 0, FALSE, 0, 0);
-	}
+	/* The record is picked up from the store by the next frame. */
+	if (!ui_gtk->uig_done)
+		ui_gtk_flush_schedule(ui);
 }
 
 static bool ui_gtk_is_done(struct xc_ui *ui)
@@ -394,6 +1432,14 @@ static void ui_gtk_quit(struct xc_ui *ui)
 	gtk_main_quit();
 }
 
+static void ui_gtk_stats_set(struct xc_ui *ui, const char *stats)
+{
+	struct xc_ui_gtk *ui_gtk = ui->ui_priv;
+
+	if (!ui_gtk->uig_done)
+		gtk_label_set_text(GTK_LABEL(ui_gtk->uig_status_stats), stats);
+}
+
 struct xc_ui_ops xc_ui_ops_gtk = {
 	.uio_init       = ui_gtk_init,
 	.uio_fini       = ui_gtk_fini,
@@ -403,6 +1449,7 @@ struct xc_ui_ops xc_ui_ops_gtk = {
 	.uio_print      = ui_gtk_print,
 	.uio_is_done    = ui_gtk_is_done,
 	.uio_quit       = ui_gtk_quit,
+	.uio_stats_set  = ui_gtk_stats_set,
 };
 
 #endif /* BUILD_UI_GTK */
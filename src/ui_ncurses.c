@@ -26,7 +26,7 @@
 
 #ifdef BUILD_UI_NCURSES
 
-#include "list.h"
+#include "misc.h"
 #include "ui.h"
 #include "xmpp.h"
 
@@ -40,20 +40,28 @@
 #include <curses.h>
 #include <errno.h>
 #include <locale.h>
+#include <poll.h>
 #include <readline/history.h>
 #include <readline/readline.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strophe.h>
+#include <unistd.h>
 #include <wchar.h>
 #include <wctype.h>
 
+/*
+ * A line refers to a part of a record's payload in the store. Lines are kept
+ * in a ring which is allocated once, so eviction of the oldest line is just
+ * increment of 'lines_first'.
+ */
 struct ui_ncurses_line {
-	char *line;
-	size_t chars_nr;
-	uint32_t magic;
-	struct xc_list_link link;
+	uint64_t seq;
+	uint32_t off;
+	uint32_t len;
+	uint32_t chars_nr;
 };
 
 struct xc_ui_ncurses {
@@ -62,25 +70,39 @@ struct xc_ui_ncurses {
 	WINDOW *win_inp;
 	size_t win_inp_offset;
 	size_t win_inp_pos;
-	size_t lines_nr;
 	const char *last_status;
-	struct xc_list lines;
-	struct ui_ncurses_line *line_current;
+	struct ui_ncurses_line *lines;
+	size_t lines_max;
+	/* Monotonic numbers of the oldest line and the next one. */
+	uint64_t lines_first;
+	uint64_t lines_next;
+	/* The 1st visible line when the log is paged. */
+	uint64_t line_current;
 	bool paged;
+	/*
+	 * Fenwick tree over the lines ring with number of rows every line
+	 * occupies. It is rebuilt when the terminal width changes.
+	 */
+	uint64_t *rows_tree;
+	size_t rows_step;
+	int rows_cols;
+	/* The log window has changes which aren't on the screen yet. */
+	bool log_dirty;
+	uint64_t frame_time;
+	/* Statistics which are shown before the status. */
+	char stats[192];
 };
 
-#define UI_NCURSES_INPUT_TIMEOUT 1
-#define UI_NCURSES_LINES_MAX 1024
-#define UI_NCURSES_LINE_MAGIC 0xdeadbeef
 #define UI_NCURSES_TERMINAL_TITLE "xmppconsole"
+/* Minimal period between refreshes of the log window, in milliseconds. */
+#define UI_NCURSES_FRAME_PERIOD 16
 
-#define XC_LINE_TO_ROWS(line) (((line)->chars_nr + COLS - 1) / COLS)
+/* Empty line occupies a row too. */
+#define XC_LINE_TO_ROWS(line) \
+	((line)->chars_nr == 0 ? 1 : ((line)->chars_nr + COLS - 1) / COLS)
 /* Number of visible rows. The last row is always empty because of '\n'. */
 #define XC_LOG_ROWS ((int)LINES - 3)
-
-static struct xc_list_descr ui_ncurses_lines_descr =
-	XC_LIST_DESCR("log lines", struct ui_ncurses_line, link, magic,
-		      UI_NCURSES_LINE_MAGIC);
+#define XC_LINE(priv, nr) (&(priv)->lines[(nr) % (priv)->lines_max])
 
 #define max(a, b)         \
   ({ typeof(a) _a = a;    \
@@ -215,23 +237,241 @@ static size_t ui_ncurses_strnlen(const char *s, size_t wlen_max, size_t offset)
 	return len;
 }
 
-static void ui_ncurses_line_destroy_first(struct xc_ui_ncurses *priv)
+/* Adds 'delta' to the slot 'slot' of the lines ring. */
+static void ui_ncurses_rows_add(struct xc_ui_ncurses *priv,
+				size_t slot,
+				int64_t delta)
+{
+	size_t i;
+
+	for (i = slot + 1; i <= priv->lines_max; i += i & -i)
+		priv->rows_tree[i] += delta;
+}
+
+/* Returns sum of rows for slots [0, nr). */
+static uint64_t ui_ncurses_rows_prefix(struct xc_ui_ncurses *priv, size_t nr)
+{
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i = nr; i > 0; i -= i & -i)
+		sum += priv->rows_tree[i];
+
+	return sum;
+}
+
+/* Returns the slot which contains row 'row' counting from slot 0. */
+static size_t ui_ncurses_rows_search(struct xc_ui_ncurses *priv, uint64_t row)
+{
+	size_t pos = 0;
+	size_t step;
+
+	for (step = priv->rows_step; step > 0; step >>= 1) {
+		if (pos + step <= priv->lines_max &&
+		    priv->rows_tree[pos + step] <= row) {
+			pos += step;
+			row -= priv->rows_tree[pos];
+		}
+	}
+	return pos;
+}
+
+static void ui_ncurses_rows_set(struct xc_ui_ncurses *priv, uint64_t nr)
+{
+	size_t slot = nr % priv->lines_max;
+	uint64_t old;
+
+	old = ui_ncurses_rows_prefix(priv, slot + 1) -
+	      ui_ncurses_rows_prefix(priv, slot);
+	ui_ncurses_rows_add(priv, slot,
+			    (int64_t)XC_LINE_TO_ROWS(XC_LINE(priv, nr)) -
+			    (int64_t)old);
+}
+
+/*
+ * Drops the oldest lines whose records are evicted from the store, so they
+ * are neither drawn as blank rows nor counted by the tree.
+ */
+static void ui_ncurses_lines_trim(struct xc_ui_ncurses *priv)
+{
+	uint64_t first = xc_store_first(&g_ctx->c_store);
+	uint64_t old;
+	size_t slot;
+
+	while (priv->lines_first < priv->lines_next &&
+	       XC_LINE(priv, priv->lines_first)->seq < first) {
+		slot = priv->lines_first % priv->lines_max;
+		old = ui_ncurses_rows_prefix(priv, slot + 1) -
+		      ui_ncurses_rows_prefix(priv, slot);
+		ui_ncurses_rows_add(priv, slot, -(int64_t)old);
+		++priv->lines_first;
+	}
+	if (priv->line_current < priv->lines_first)
+		priv->line_current = priv->lines_first;
+}
+
+/*
+ * Trims lines of evicted records and rebuilds the tree in linear time if the
+ * terminal width has changed.
+ */
+static void ui_ncurses_rows_sync(struct xc_ui_ncurses *priv)
+{
+	uint64_t nr;
+	size_t i;
+	size_t j;
+
+	if (priv->lines == NULL)
+		return;
+	ui_ncurses_lines_trim(priv);
+	if (priv->rows_cols == COLS)
+		return;
+
+	memset(priv->rows_tree, 0,
+	       (priv->lines_max + 1) * sizeof(*priv->rows_tree));
+	for (nr = priv->lines_first; nr < priv->lines_next; ++nr) {
+		priv->rows_tree[nr % priv->lines_max + 1] =
+			XC_LINE_TO_ROWS(XC_LINE(priv, nr));
+	}
+	for (i = 1; i <= priv->lines_max; ++i) {
+		j = i + (i & -i);
+		if (j <= priv->lines_max)
+			priv->rows_tree[j] += priv->rows_tree[i];
+	}
+	priv->rows_cols = COLS;
+}
+
+/* Number of rows which lines [from, to) occupy. */
+static uint64_t ui_ncurses_rows_range(struct xc_ui_ncurses *priv,
+				      uint64_t from,
+				      uint64_t to)
 {
-	struct ui_ncurses_line *item = xc_list_dequeue(&priv->lines);
+	size_t a = from % priv->lines_max;
+	size_t b = to % priv->lines_max;
+
+	if (from == to)
+		return 0;
+	if (a < b)
+		return ui_ncurses_rows_prefix(priv, b) -
+		       ui_ncurses_rows_prefix(priv, a);
+	/* The range wraps around the end of the ring. */
+	return ui_ncurses_rows_prefix(priv, priv->lines_max) -
+	       ui_ncurses_rows_prefix(priv, a) +
+	       ui_ncurses_rows_prefix(priv, b);
+}
 
-	if (item != NULL) {
-		if (priv->line_current == item)
-			priv->line_current = xc_list_head(&priv->lines);
-		free(item->line);
-		free(item);
+/*
+ * Returns the line which contains row 'row' counting from the oldest line or
+ * 'lines_next' if there is no such row.
+ */
+static uint64_t ui_ncurses_line_at_row(struct xc_ui_ncurses *priv,
+				       uint64_t row)
+{
+	size_t first = priv->lines_first % priv->lines_max;
+	uint64_t base;
+	uint64_t tail;
+
+	if (row >= ui_ncurses_rows_range(priv, priv->lines_first,
+					 priv->lines_next))
+		return priv->lines_next;
+
+	base = ui_ncurses_rows_prefix(priv, first);
+	tail = ui_ncurses_rows_prefix(priv, priv->lines_max) - base;
+	if (row < tail) {
+		return priv->lines_first +
+		       (ui_ncurses_rows_search(priv, base + row) - first);
 	}
+	return priv->lines_first + (priv->lines_max - first) +
+	       ui_ncurses_rows_search(priv, row - tail);
+}
+
+/* Row of the line 'nr' counting from the oldest line. */
+static uint64_t ui_ncurses_row_of_line(struct xc_ui_ncurses *priv, uint64_t nr)
+{
+	return ui_ncurses_rows_range(priv, priv->lines_first, nr);
+}
+
+static struct ui_ncurses_line *ui_ncurses_line_add(struct xc_ui_ncurses *priv)
+{
+	if (priv->lines_next - priv->lines_first == priv->lines_max) {
+		++priv->lines_first;
+		if (priv->line_current < priv->lines_first)
+			priv->line_current = priv->lines_first;
+	}
+	return XC_LINE(priv, priv->lines_next++);
+}
+
+/* Returns the first line of record 'seq' or of the next record. */
+static uint64_t ui_ncurses_line_of_seq(struct xc_ui_ncurses *priv,
+				       uint64_t seq)
+{
+	uint64_t lo = priv->lines_first;
+	uint64_t hi = priv->lines_next;
+	uint64_t mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (XC_LINE(priv, mid)->seq < seq)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Loads an older or a newer part of the capture file which is viewed. The
+ * current line stays on the same record. Returns false if nothing is loaded.
+ */
+static bool ui_ncurses_page(struct xc_ui_ncurses *priv, bool older)
+{
+	uint64_t seq;
+
+	if (priv->line_current >= priv->lines_next)
+		return false;
+
+	seq = XC_LINE(priv, priv->line_current)->seq;
+	if (!xc_file_page(g_ctx, older, &seq))
+		return false;
+
+	/* Lines of the previous part are trimmed with their records. */
+	ui_ncurses_rows_sync(priv);
+	priv->line_current = ui_ncurses_line_of_seq(priv, seq);
+	return true;
+}
+
+/* Prefix which is displayed before the 1st line of a record. */
+static void ui_ncurses_prefix(const struct xc_record *rec,
+			      char                   *buf,
+			      size_t                  size)
+{
+	snprintf(buf, size, "%s: ", xc_dir_name(rec->rec_dir));
+}
+
+static void ui_ncurses_line_draw(struct xc_ui_ncurses   *priv,
+				 struct ui_ncurses_line *line)
+{
+	struct xc_store        *store = &g_ctx->c_store;
+	const struct xc_record *rec = xc_store_get(store, line->seq);
+	char                    prefix[16];
+
+	/* Lines of evicted records are trimmed by ui_ncurses_rows_sync(). */
+	if (rec != NULL) {
+		if (line->off == 0) {
+			ui_ncurses_prefix(rec, prefix, sizeof(prefix));
+			waddstr(priv->win_log, prefix);
+		}
+		waddnstr(priv->win_log, xc_store_payload(store, rec) + line->off,
+			 line->len);
+	}
+	waddstr(priv->win_log, "\n");
 }
 
 static void ui_ncurses_status_set(struct xc_ui_ncurses *priv, const char *status)
 {
 	const char *jid = NULL;
 	const char *secure = "";
-	char buf[64];
+	const char *stats = priv->stats;
+	char buf[256];
 	size_t len;
 
 	priv->last_status = status;
@@ -246,11 +486,14 @@ static void ui_ncurses_status_set(struct xc_ui_ncurses *priv, const char *status
 					 "[TLS] " : "[PLAIN] ";
 			}
 		}
-		len = strlen(status) + strlen(secure) +
+		len = strlen(status) + strlen(secure) + strlen(stats) + 1 +
 		      (jid != NULL ? strlen(jid) : 0);
 		if (len + 2 > COLS)
+			stats = "";
+		if (len - strlen(priv->stats) + 1 > COLS)
 			secure = "";
-		snprintf(buf, sizeof(buf), "%s%s", secure, status);
+		snprintf(buf, sizeof(buf), "%s%s%s%s", stats,
+			 *stats != '\0' ? " " : "", secure, status);
 		len = strlen(buf);
 
 		mvwaddstr(priv->win_sep, 0, 1, jid != NULL ? jid : "");
@@ -328,39 +571,42 @@ static void ui_ncurses_redisplay_cb(void)
 
 static void ui_ncurses_redisplay_log(struct xc_ui_ncurses *priv)
 {
-	struct ui_ncurses_line *p = NULL;
-	struct ui_ncurses_line *tmp;
+	uint64_t p = 0;
+	uint64_t total;
 	size_t rows;
 	size_t i;
 
 	rows = XC_LOG_ROWS < 0 ? 0 : (size_t)XC_LOG_ROWS;
 
+	werase(priv->win_log);
+	if (priv->lines == NULL)
+		goto out;
+
+	ui_ncurses_rows_sync(priv);
 	if (!priv->paged) {
-		tmp = xc_list_tail(&priv->lines);
-		i = 0;
-		while (tmp != NULL && i < rows) {
-			p = tmp;
-			i += XC_LINE_TO_ROWS(p);
-			tmp = xc_list_prev(&priv->lines, tmp);
-		}
+		total = ui_ncurses_rows_range(priv, priv->lines_first,
+					      priv->lines_next);
+		p = total > rows ?
+		    ui_ncurses_line_at_row(priv, total - rows) :
+		    priv->lines_first;
 		/*
 		 * This is a hack to print all the required lines. Otherwise,
 		 * it may happen that the last line will never be printed.
 		 */
-		rows = i;
+		rows = ui_ncurses_rows_range(priv, p, priv->lines_next);
 	} else {
 		p = priv->line_current;
 	}
 
-	werase(priv->win_log);
 	i = 0;
-	while (p != NULL && i < rows) {
-		waddstr(priv->win_log, p->line);
-		waddstr(priv->win_log, "\n");
-		i += XC_LINE_TO_ROWS(p);
-		p = xc_list_next(&priv->lines, p);
+	while (p < priv->lines_next && i < rows) {
+		ui_ncurses_line_draw(priv, XC_LINE(priv, p));
+		i += XC_LINE_TO_ROWS(XC_LINE(priv, p));
+		++p;
 	}
 
+out:
+	priv->log_dirty = false;
 	wrefresh(priv->win_log);
 	ui_ncurses_redisplay_cursor(priv);
 }
@@ -399,32 +645,32 @@ static void ui_ncurses_input_cb(char *line)
 static void ui_ncurses_scrollup(size_t nr)
 {
 	struct xc_ui_ncurses *priv = g_ui->ui_priv;
+	uint64_t total;
+	uint64_t row;
 	size_t rows;
-	size_t i;
 
 	rows = XC_LOG_ROWS < 0 ? 0 : (size_t)XC_LOG_ROWS;
+	if (priv->lines == NULL)
+		return;
 
+	ui_ncurses_rows_sync(priv);
 	if (!priv->paged) {
 		/* Find the 1st visible line. */
-		priv->line_current = xc_list_tail(&priv->lines);
-		for (i = 0; priv->line_current != NULL;) {
-			i += XC_LINE_TO_ROWS(priv->line_current);
-			if (i >= rows)
-				break;
+		total = ui_ncurses_rows_range(priv, priv->lines_first,
+					      priv->lines_next);
+		priv->paged = total >= rows && total > 0;
+		if (priv->paged) {
 			priv->line_current =
-				xc_list_prev(&priv->lines, priv->line_current);
+				ui_ncurses_line_at_row(priv, total - rows);
 		}
-		priv->paged = priv->line_current != NULL;
 	}
 
-	for (i = 0; i < nr && priv->line_current != NULL;) {
+	if (priv->paged) {
+		row = ui_ncurses_row_of_line(priv, priv->line_current);
+		if (row < nr && ui_ncurses_page(priv, true))
+			row = ui_ncurses_row_of_line(priv, priv->line_current);
 		priv->line_current =
-				xc_list_prev(&priv->lines, priv->line_current);
-		if (priv->line_current != NULL)
-			i += XC_LINE_TO_ROWS(priv->line_current);
-	}
-	if (priv->line_current == NULL && priv->paged) {
-		priv->line_current = xc_list_head(&priv->lines);
+			ui_ncurses_line_at_row(priv, row > nr ? row - nr : 0);
 	}
 
 	ui_ncurses_redisplay_log(priv);
@@ -433,33 +679,56 @@ static void ui_ncurses_scrollup(size_t nr)
 static void ui_ncurses_scrolldown(size_t nr)
 {
 	struct xc_ui_ncurses *priv = g_ui->ui_priv;
-	struct ui_ncurses_line *p;
+	uint64_t target;
 	size_t rows;
-	size_t i;
 
 	rows = XC_LOG_ROWS < 0 ? 0 : (size_t)XC_LOG_ROWS;
-
+	if (priv->lines == NULL)
+		return;
+
+	ui_ncurses_rows_sync(priv);
+	if (priv->paged &&
+	    ui_ncurses_rows_range(priv, priv->line_current,
+				  priv->lines_next) < rows + nr)
+		(void)ui_ncurses_page(priv, false);
 	if (priv->paged) {
-		for (i = 0; i < nr && priv->line_current != NULL;) {
-			i += XC_LINE_TO_ROWS(priv->line_current);
-			priv->line_current =
-				xc_list_next(&priv->lines, priv->line_current);
-		}
+		target = ui_ncurses_row_of_line(priv, priv->line_current) + nr;
+		priv->line_current = ui_ncurses_line_at_row(priv, target);
+		if (priv->line_current < priv->lines_next &&
+		    ui_ncurses_row_of_line(priv, priv->line_current) < target)
+			++priv->line_current;
 		/* Check whether we have enough lines to fill the window. */
-		for (i = 0, p = priv->line_current; p != NULL;) {
-			i += XC_LINE_TO_ROWS(p);
-			if (i >= rows)
-				break;
-			p = xc_list_next(&priv->lines, p);
-		}
-		priv->paged = p != NULL;
-		if (!priv->paged)
-			priv->line_current = NULL;
+		priv->paged = ui_ncurses_rows_range(priv, priv->line_current,
+						    priv->lines_next) >= rows;
 	}
 
 	ui_ncurses_redisplay_log(priv);
 }
 
+static void ui_ncurses_scroll_top(void)
+{
+	struct xc_ui_ncurses *priv = g_ui->ui_priv;
+	size_t rows;
+
+	rows = XC_LOG_ROWS < 0 ? 0 : (size_t)XC_LOG_ROWS;
+	if (priv->lines == NULL)
+		return;
+
+	ui_ncurses_rows_sync(priv);
+	priv->line_current = priv->lines_first;
+	priv->paged = ui_ncurses_rows_range(priv, priv->lines_first,
+					    priv->lines_next) >= rows;
+	ui_ncurses_redisplay_log(priv);
+}
+
+static void ui_ncurses_scroll_bottom(void)
+{
+	struct xc_ui_ncurses *priv = g_ui->ui_priv;
+
+	priv->paged = false;
+	ui_ncurses_redisplay_log(priv);
+}
+
 static int ui_ncurses_pageup_cb()
 {
 	size_t nr;
@@ -498,6 +767,18 @@ static int ui_ncurses_down_cb()
 	return 0;
 }
 
+static int ui_ncurses_top_cb()
+{
+	ui_ncurses_scroll_top();
+	return 0;
+}
+
+static int ui_ncurses_bottom_cb()
+{
+	ui_ncurses_scroll_bottom();
+	return 0;
+}
+
 static void ui_ncurses_rl_init(void)
 {
 	rl_bind_key ('\t', rl_insert);
@@ -527,6 +808,9 @@ static void ui_ncurses_rl_init(void)
 	/* Alt + arrows */
 	rl_bind_keyseq("\\e[1;3A", ui_ncurses_up_cb);
 	rl_bind_keyseq("\\e[1;3B", ui_ncurses_down_cb);
+	/* Ctrl + Home and End. */
+	rl_bind_keyseq("\\e[1;5H", ui_ncurses_top_cb);
+	rl_bind_keyseq("\\e[1;5F", ui_ncurses_bottom_cb);
 
 	rl_catch_signals = 0;
 	rl_catch_sigwinch = 0;
@@ -579,16 +863,26 @@ static int ui_ncurses_init(struct xc_ui *ui)
 	priv->win_inp = newwin(1, COLS, LINES - 1, 0);
 
 	scrollok(priv->win_log, TRUE);
-	wtimeout(priv->win_inp, UI_NCURSES_INPUT_TIMEOUT);
+	/* The event loop polls STDIN, so wgetch() must not block. */
+	nodelay(priv->win_inp, TRUE);
 	wbkgd(priv->win_sep, g_sep_color);
 
-	xc_list_init(&priv->lines, &ui_ncurses_lines_descr);
 	priv->win_inp_offset = 0;
 	priv->win_inp_pos = 0;
-	priv->lines_nr = 0;
-	priv->line_current = NULL;
+	/* Lines are allocated when the scrollback size is known. */
+	priv->lines = NULL;
+	priv->lines_max = 0;
+	priv->lines_first = 0;
+	priv->lines_next = 0;
+	priv->line_current = 0;
 	priv->paged = false;
+	priv->rows_tree = NULL;
+	priv->rows_step = 0;
+	priv->rows_cols = 0;
+	priv->log_dirty = false;
+	priv->frame_time = 0;
 	priv->last_status = "";
+	priv->stats[0] = '\0';
 	ui->ui_priv = priv;
 
 	/* We need a global pointer to access it from readline callbacks. */
@@ -605,10 +899,8 @@ static void ui_ncurses_fini(struct xc_ui *ui)
 {
 	struct xc_ui_ncurses *priv = ui->ui_priv;
 
-	while (!xc_list_is_empty(&priv->lines)) {
-		ui_ncurses_line_destroy_first(priv);
-	}
-	xc_list_fini(&priv->lines);
+	free(priv->rows_tree);
+	free(priv->lines);
 	delwin(priv->win_inp);
 	delwin(priv->win_sep);
 	delwin(priv->win_log);
@@ -673,6 +965,19 @@ static void ui_ncurses_state_set(struct xc_ui *ui, xc_ui_state_t state)
 		break;
 	case XC_UI_INITED:
 		g_ctx = ui->ui_ctx;
+		if (priv->lines == NULL) {
+			priv->lines_max = g_ctx->c_scrollback;
+			priv->lines = malloc(priv->lines_max *
+					     sizeof(*priv->lines));
+			priv->rows_tree = calloc(priv->lines_max + 1,
+						 sizeof(*priv->rows_tree));
+			assert(priv->lines != NULL && priv->rows_tree != NULL);
+			for (priv->rows_step = 1;
+			     priv->rows_step * 2 <= priv->lines_max;
+			     priv->rows_step *= 2)
+				;
+			priv->rows_cols = COLS;
+		}
 		ui_ncurses_status_set(priv, "");
 		ui_ncurses_rl_init();
 		break;
@@ -688,22 +993,53 @@ static void ui_ncurses_state_set(struct xc_ui *ui, xc_ui_state_t state)
 	case XC_UI_DISCONNECTED:
 		ui_ncurses_status_set(priv, "[offline]");
 		break;
+	case XC_UI_OFFLINE:
+		ui_ncurses_status_set(priv, "[read-only]");
+		break;
 	}
 	ui_ncurses_redisplay_cursor(priv);
 }
 
-static void ui_ncurses_run(struct xc_ui *ui)
+/* Puts pending changes of the log window on the screen. */
+static void ui_ncurses_frame_flush(struct xc_ui_ncurses *priv)
 {
-	struct xc_ui_ncurses *priv = ui->ui_priv;
-	xmpp_ctx_t           *ctx = ui->ui_ctx->c_ctx;
-	int                   c;
+	if (!priv->log_dirty)
+		return;
+
+	wnoutrefresh(priv->win_log);
+	ui_ncurses_move_cursor(priv, priv->win_inp_pos);
+	wnoutrefresh(priv->win_inp);
+	doupdate();
+	priv->log_dirty = false;
+	priv->frame_time = xc_time_ms();
+}
+
+static int ui_ncurses_timeout(struct xc_ui_ncurses *priv, struct xc_ctx *ctx)
+{
+	int      timeout = xc_timeout(ctx);
+	uint64_t elapsed;
+
+	if (priv->log_dirty) {
+		elapsed = xc_time_ms() - priv->frame_time;
+		if (elapsed >= UI_NCURSES_FRAME_PERIOD)
+			return 0;
+		elapsed = UI_NCURSES_FRAME_PERIOD - elapsed;
+		if (timeout < 0 || (uint64_t)timeout > elapsed)
+			timeout = (int)elapsed;
+	}
+	return timeout;
+}
+
+/* Handles all input which is available without blocking. */
+static void ui_ncurses_input(struct xc_ui_ncurses *priv)
+{
+	int c;
 
 	while (!is_stop) {
 		c = wgetch(priv->win_inp);
 		switch (c) {
 		case ERR:
-			xmpp_run_once(ctx, 1);
-			break;
+			return;
 		case KEY_RESIZE:
 			ui_ncurses_resize(priv);
 			break;
@@ -719,52 +1055,100 @@ static void ui_ncurses_run(struct xc_ui *ui)
 	}
 }
 
-static void ui_ncurses_print(struct xc_ui *ui, const char *msg)
+/*
+ * The loop sleeps in poll(2) until either STDIN or the connection socket is
+ * ready, sockets of a swarm on the UI loop are polled as well. SIGWINCH
+ * interrupts poll(2) and wgetch() returns KEY_RESIZE then.
+ *
+ * Received stanzas are added to the log window, but the terminal is
+ * refreshed at most once per UI_NCURSES_FRAME_PERIOD or when the loop has
+ * nothing to do. So a burst of stanzas doesn't cause a flush per stanza.
+ */
+static void ui_ncurses_run(struct xc_ui *ui)
 {
 	struct xc_ui_ncurses *priv = ui->ui_priv;
-	struct ui_ncurses_line *item;
-	const char *s = msg;
-	const char *p;
+	struct xc_ctx        *ctx = ui->ui_ctx;
+	struct pollfd         fds[3 + XC_SWARM_FDS_MAX];
+	unsigned              nr;
+	int                   rc;
 
-	do {
-		if (*s == '\0')
+	while (!is_stop) {
+		fds[0].fd = STDIN_FILENO;
+		fds[0].events = POLLIN;
+		fds[0].revents = 0;
+		/* Negative fd is ignored by poll(2). */
+		fds[1].fd = xc_fd(ctx);
+		fds[1].events = xc_fd_events(ctx);
+		fds[1].revents = 0;
+		fds[2].fd = xc_wake_fd(ctx);
+		fds[2].events = POLLIN;
+		fds[2].revents = 0;
+		nr = 3 + xc_swarm_fds(ctx, fds + 3);
+
+		rc = poll(fds, nr, ui_ncurses_timeout(priv, ctx));
+		if (rc < 0 && errno != EINTR)
 			break;
 
-		item = malloc(sizeof *item);
-		if (item == NULL)
+		ui_ncurses_input(priv);
+		if (!is_stop)
+			xc_run_once(ctx, fds[1].revents);
+		if (rc == 0 || xc_time_ms() - priv->frame_time >=
+			       UI_NCURSES_FRAME_PERIOD)
+			ui_ncurses_frame_flush(priv);
+	}
+}
+
+static void ui_ncurses_print(struct xc_ui *ui, const struct xc_record *rec)
+{
+	struct xc_ui_ncurses   *priv = ui->ui_priv;
+	struct xc_store        *store = &ui->ui_ctx->c_store;
+	struct ui_ncurses_line *item;
+	const char             *msg = xc_store_payload(store, rec);
+	const char             *end = msg + rec->rec_len;
+	const char             *s = msg;
+	const char             *p;
+	char                    prefix[16];
+
+	ui_ncurses_prefix(rec, prefix, sizeof(prefix));
+	do {
+		if (s == end || priv->lines == NULL)
 			break;
 
-		p = strchr(s, '\n');
-		if (p == NULL) {
-			item->line = strdup(s);
-		} else {
-			item->line = strndup(s, p - s);
+		p = memchr(s, '\n', end - s);
+		item = ui_ncurses_line_add(priv);
+		item->seq = rec->rec_seq;
+		item->off = (uint32_t)(s - msg);
+		item->len = (uint32_t)((p == NULL ? end : p) - s);
+		item->chars_nr = ui_ncurses_strnwidth(s, item->len, 0);
+		if (item->off == 0)
+			item->chars_nr += ui_ncurses_strwidth(prefix, 0);
+		ui_ncurses_rows_sync(priv);
+		ui_ncurses_rows_set(priv, priv->lines_next - 1);
+		if (p != NULL) {
 			s = p + 1;
-			while (*s != '\0' && *s == '\r')
+			while (s != end && *s == '\r')
 				++s;
 		}
-		if (item->line == NULL) {
-			free(item);
-			break;
-		}
-
-		item->chars_nr = ui_ncurses_strwidth(s, 0);
-		xc_list_insert_tail(&priv->lines, item);
-		if (priv->lines_nr >= UI_NCURSES_LINES_MAX) {
-			ui_ncurses_line_destroy_first(priv);
-		} else {
-			++priv->lines_nr;
-		}
 	} while (p != NULL);
 
 	if (!priv->paged) {
-		waddstr(priv->win_log, msg);
+		waddstr(priv->win_log, prefix);
+		waddnstr(priv->win_log, msg, rec->rec_len);
 		waddstr(priv->win_log, "\n");
-		wrefresh(priv->win_log);
-		ui_ncurses_redisplay_cursor(priv);
+		/* The window is refreshed by the event loop. */
+		priv->log_dirty = true;
 	}
 }
 
+static void ui_ncurses_stats_set(struct xc_ui *ui, const char *stats)
+{
+	struct xc_ui_ncurses *priv = ui->ui_priv;
+
+	snprintf(priv->stats, sizeof(priv->stats), "%s", stats);
+	ui_ncurses_redisplay_sep(priv);
+	ui_ncurses_redisplay_cursor(priv);
+}
+
 static bool ui_ncurses_is_done(struct xc_ui *ui)
 {
 	return is_done;
@@ -784,8 +1168,10 @@ struct xc_ui_ops xc_ui_ops_ncurses = {
 	.uio_print      = ui_ncurses_print,
 	.uio_is_done    = ui_ncurses_is_done,
 	.uio_quit       = ui_ncurses_quit,
+	.uio_stats_set  = ui_ncurses_stats_set,
 };
 
+#undef XC_LINE
 #undef XC_LOG_ROWS
 #undef XC_LINE_TO_ROWS
 
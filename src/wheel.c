@@ -0,0 +1,135 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wheel.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define WHEEL_TIMER_MAGIC 0x57484c54
+
+static const struct xc_list_descr wheel_slot_descr =
+	XC_LIST_DESCR("wheel slot", struct xc_timer, tm_link, tm_magic,
+		      WHEEL_TIMER_MAGIC);
+
+static struct xc_list *wheel_slot(struct xc_wheel *wheel, uint64_t tick)
+{
+	return &wheel->w_slots[tick % XC_WHEEL_SLOTS];
+}
+
+void xc_wheel_init(struct xc_wheel *wheel, uint64_t now)
+{
+	size_t i;
+
+	for (i = 0; i < XC_WHEEL_SLOTS; ++i)
+		xc_list_init(&wheel->w_slots[i], &wheel_slot_descr);
+	wheel->w_now = now;
+	wheel->w_timers_nr = 0;
+}
+
+void xc_wheel_fini(struct xc_wheel *wheel)
+{
+	struct xc_timer *timer;
+	size_t           i;
+
+	for (i = 0; i < XC_WHEEL_SLOTS; ++i) {
+		while ((timer = xc_list_dequeue(&wheel->w_slots[i])) != NULL)
+			timer->tm_is_armed = false;
+		xc_list_fini(&wheel->w_slots[i]);
+	}
+	wheel->w_timers_nr = 0;
+}
+
+void xc_timer_init(struct xc_timer *timer, xc_timer_cb cb, void *userdata)
+{
+	memset(timer, 0, sizeof(*timer));
+	timer->tm_cb = cb;
+	timer->tm_userdata = userdata;
+}
+
+void xc_timer_arm(struct xc_wheel *wheel, struct xc_timer *timer,
+		  uint64_t expire)
+{
+	if (timer->tm_is_armed)
+		xc_timer_disarm(wheel, timer);
+
+	/* An expired timer fires on the next tick. */
+	timer->tm_expire = expire > wheel->w_now ? expire : wheel->w_now + 1;
+	timer->tm_is_armed = true;
+	xc_list_enqueue(wheel_slot(wheel, timer->tm_expire), timer);
+	++wheel->w_timers_nr;
+}
+
+void xc_timer_disarm(struct xc_wheel *wheel, struct xc_timer *timer)
+{
+	if (!timer->tm_is_armed)
+		return;
+
+	xc_list_del(wheel_slot(wheel, timer->tm_expire), timer);
+	timer->tm_is_armed = false;
+	assert(wheel->w_timers_nr > 0);
+	--wheel->w_timers_nr;
+}
+
+void xc_wheel_advance(struct xc_wheel *wheel, uint64_t now)
+{
+	struct xc_timer *timer;
+	struct xc_timer *next;
+	struct xc_list  *slot;
+	uint64_t         tick;
+
+	/* After a long stall every slot is checked once. */
+	tick = now - wheel->w_now > XC_WHEEL_SLOTS ?
+	       now - XC_WHEEL_SLOTS : wheel->w_now;
+	while (tick < now && wheel->w_timers_nr > 0) {
+		/* Timers armed by callbacks go to the following slots. */
+		wheel->w_now = ++tick;
+		slot = wheel_slot(wheel, tick);
+		timer = xc_list_head(slot);
+		while (timer != NULL) {
+			next = xc_list_next(slot, timer);
+			if (timer->tm_expire <= now) {
+				xc_timer_disarm(wheel, timer);
+				/* Callback may re-arm the timer or free it. */
+				timer->tm_cb(timer, timer->tm_userdata);
+				/* Callback may have disarmed 'next' too. */
+				next = xc_list_head(slot);
+				while (next != NULL && next->tm_expire > now)
+					next = xc_list_next(slot, next);
+			}
+			timer = next;
+		}
+	}
+	wheel->w_now = now;
+}
+
+int xc_wheel_timeout(struct xc_wheel *wheel, uint64_t now)
+{
+	uint64_t tick;
+
+	if (wheel->w_timers_nr == 0)
+		return -1;
+
+	for (tick = wheel->w_now + 1;
+	     tick < wheel->w_now + XC_WHEEL_SLOTS; ++tick) {
+		if (!xc_list_is_empty(wheel_slot(wheel, tick)))
+			break;
+	}
+	return tick > now ? (int)(tick - now) : 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * XMPP Console - a tool for XMPP hackers
+ *
+ * Copyright (C) 2020 Dmitry Podgorny <pasis.ua@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __XC_WHEEL_H__
+#define __XC_WHEEL_H__
+
+#include "list.h"
+
+#include <stdbool.h>	/* bool */
+#include <stdint.h>	/* uint64_t */
+
+/*
+ * Hashed timer wheel with a tick of 1 ms. A timer is put to the slot of its
+ * expiration time modulo the number of slots, so adding and removing a timer
+ * is O(1) regardless of the number of timers. Timers which expire in the
+ * same tick fire in the order they were added.
+ *
+ * The wheel is driven by xc_wheel_advance(), timers must not be armed from
+ * other threads.
+ */
+
+#define XC_WHEEL_SLOTS 512
+
+struct xc_timer;
+
+typedef void (*xc_timer_cb)(struct xc_timer *timer, void *userdata);
+
+struct xc_timer {
+	struct xc_list_link  tm_link;
+	uint32_t             tm_magic;
+	/* Expiration time in milliseconds. */
+	uint64_t             tm_expire;
+	xc_timer_cb          tm_cb;
+	void                *tm_userdata;
+	bool                 tm_is_armed;
+};
+
+struct xc_wheel {
+	struct xc_list w_slots[XC_WHEEL_SLOTS];
+	/* The last processed tick. */
+	uint64_t       w_now;
+	unsigned long  w_timers_nr;
+};
+
+void xc_wheel_init(struct xc_wheel *wheel, uint64_t now);
+/* Disarms the remaining timers. */
+void xc_wheel_fini(struct xc_wheel *wheel);
+/* Fires the timers which expire not later than 'now'. */
+void xc_wheel_advance(struct xc_wheel *wheel, uint64_t now);
+/* Returns milliseconds till the next non-empty slot or -1. */
+int  xc_wheel_timeout(struct xc_wheel *wheel, uint64_t now);
+
+void xc_timer_init(struct xc_timer *timer, xc_timer_cb cb, void *userdata);
+/* Re-arms the timer if it is armed already. */
+void xc_timer_arm(struct xc_wheel *wheel, struct xc_timer *timer,
+		  uint64_t expire);
+void xc_timer_disarm(struct xc_wheel *wheel, struct xc_timer *timer);
+
+#endif /* __XC_WHEEL_H__ */
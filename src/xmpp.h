@@ -20,20 +20,132 @@
 #ifndef __XMPPCONSOLE_XMPP_H__
 #define __XMPPCONSOLE_XMPP_H__
 
+#include "backoff.h"
+#include "phases.h"
+#include "rtt.h"
+#include "store.h"
+#include "wheel.h"
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <strophe.h>
+#include <sys/select.h>
 
 /* Forward declarations */
+struct xc_capture_file;
 struct xc_options;
+struct xc_replay;
+struct xc_swarm;
 struct xc_ui;
 
+struct xc_ctx;
+
+/*
+ * Tap receives every captured piece of the stream after it is appended to
+ * the store. Payload doesn't contain the "SENT: "/"RECV: " prefix.
+ */
+typedef void (*xc_tap_cb)(struct xc_ctx          *ctx,
+			  const struct xc_record *rec,
+			  void                   *userdata);
+
+struct xc_tap {
+	xc_tap_cb  t_cb;
+	void      *t_userdata;
+};
+
+#define XC_TAPS_MAX 8
+
 struct xc_ctx {
 	xmpp_ctx_t     *c_ctx;
 	xmpp_conn_t    *c_conn;
+	/*
+	 * Logger of libstrophe. Traffic of the negotiation is captured from
+	 * its debug messages. An established session is captured by a stanza
+	 * handler and xc_send(), the logger is detached then unless debug
+	 * output is enabled.
+	 */
+	xmpp_log_t      c_log;
 	const char     *c_host;
 	unsigned short  c_port;
+	/*
+	 * Peer address of the last established connection. The first retry
+	 * connects to it directly and skips name resolution.
+	 */
+	char            c_addr[INET6_ADDRSTRLEN];
+	unsigned short  c_addr_port;
+	struct xc_backoff c_backoff;
+	struct xc_timer c_reconnect_timer;
 	struct xc_ui   *c_ui;
-	int             c_attempts;
+	struct xc_store c_store;
+	struct xc_tap   c_taps[XC_TAPS_MAX];
+	size_t          c_taps_nr;
+	/* Number of lines a UI keeps in its log history. */
+	size_t          c_scrollback;
+	int             c_fd;
+	int             c_wake[2];
+	atomic_bool     c_wake_pending;
+	uint64_t        c_last_io;
+	/* Incremented on every connection attempt. */
+	uint32_t        c_conn_id;
+	/* Phases of the last attempts, indexed by c_conn_id. */
+	struct xc_phases c_phases[XC_PHASES_HISTORY];
+	/* Breakdown of the last finished attempt for the status bar. */
+	char            c_login[128];
+	/* Machine readable lines of finished attempts are written here. */
+	FILE           *c_timings;
+	/* Flight recorder dumps the store to c_dump_path.N. */
+	const char     *c_dump_path;
+	unsigned        c_dumps_nr;
+	atomic_bool     c_dump_pending;
+	/*
+	 * Capture file which is fed to the store instead of a connection.
+	 * Records [c_file_first, c_file_end) of the file are loaded, the
+	 * first of them has sequence number c_file_seq. c_file_shift moves
+	 * the wall clock time of the file to the monotonic clock.
+	 */
+	struct xc_capture_file *c_file;
+	uint64_t        c_file_first;
+	uint64_t        c_file_end;
+	uint64_t        c_file_seq;
+	uint64_t        c_file_shift;
+	/* Advanced by xc_run_once(), its next expiry bounds xc_timeout(). */
+	struct xc_wheel c_wheel;
+	struct xc_replay *c_replay;
+	/* Connections for load testing, the UI shows only their counters. */
+	struct xc_swarm *c_swarm;
+	/* Round-trip times of requests, shown in the status bar. */
+	struct xc_rtt   c_rtt;
+	struct xc_timer c_stats_timer;
+	/* Stream management resumptions, shown in the status bar. */
+	unsigned        c_resume_tries;
+	unsigned        c_resume_nr;
+	/* Time from the start of the attempt to the last resumption. */
+	uint64_t        c_resume_time;
+	bool            c_resume_pending;
+#ifdef HAVE_XMPP_CONN_GET_SM_STATE
+	/* Stream management state which is carried over reconnects. */
+	xmpp_sm_state_t *c_sm_state;
+#endif
+	/*
+	 * Connection is prepared in a helper thread while the password is
+	 * typed. Records aren't printed until the thread is joined, the
+	 * first of them is c_prelogin_seq.
+	 */
+	atomic_bool     c_prelogin_stop;
+	uint64_t        c_prelogin_seq;
+	bool            c_prelogin;
+	/* Last id generated for a request without id. */
+	unsigned long   c_iq_id;
 	bool            c_is_done;
+	/* Session of the current connection is established. */
+	bool            c_is_online;
+	bool            c_in_send;
+	/* Raw mode is requested, c_is_raw is chosen for every attempt. */
+	bool            c_raw_mode;
 	bool            c_is_raw;
 	bool            c_tls_disable;
 	bool            c_tls_legacy;
@@ -41,6 +153,58 @@ struct xc_ctx {
 
 int xc_connect(struct xc_ctx *ctx, struct xc_options *opts, bool reconnect);
 void xc_send(struct xc_ctx *ctx, const char *msg);
+void xc_send_buf(struct xc_ctx *ctx, const char *msg, size_t len);
+/*
+ * Same as xc_send_buf() with the ends of complete top-level units which the
+ * caller's framer found in the message, so stanzas needn't be framed again.
+ */
+void xc_send_units(struct xc_ctx *ctx,
+		   const char    *msg,
+		   size_t         len,
+		   const size_t  *ends,
+		   size_t         ends_nr);
+
+/*
+ * Moves the loaded part of the capture file by a step, so a UI can page
+ * through files larger than its scrollback. Newer records are appended by
+ * the event loop. Older ones replace the records in the store, those up to
+ * 'seq' are loaded before it returns and the event loop feeds the rest.
+ * 'seq' is updated to the sequence number of the same record after the
+ * reload, or of the nearest loaded one. Returns false if there is no
+ * capture file or nothing more to load in the direction.
+ */
+bool xc_file_page(struct xc_ctx *ctx, bool older, uint64_t *seq);
+
+int  xc_tap_add(struct xc_ctx *ctx, xc_tap_cb cb, void *userdata);
+void xc_tap(struct xc_ctx *ctx, xc_dir_t dir, const char *data, size_t len);
 void xc_quit(struct xc_ctx *ctx);
+/* Requests a flight recorder dump, safe to call from a signal handler. */
+void xc_dump_request(struct xc_ctx *ctx);
+
+/* The swarm is limited by select(2) in libstrophe, see xc_swarm_nr_max(). */
+#define XC_SWARM_FDS_MAX FD_SETSIZE
+
+/*
+ * Helpers for UI modules which run their own event loop. A UI polls xc_fd()
+ * for xc_fd_events() and xc_wake_fd() for POLLIN with timeout xc_timeout()
+ * along with its own file descriptors and calls xc_run_once() after every
+ * wakeup. Received events for xc_fd() are passed in revents. Negative
+ * xc_timeout() means no timeout, as for poll(2).
+ *
+ * A swarm without worker threads has sockets of its own. They are polled
+ * along with xc_fd(), xc_swarm_fds() fills up to XC_SWARM_FDS_MAX of them
+ * with their events. Their revents aren't passed to xc_run_once().
+ *
+ * xc_wakeup() interrupts the poll from another thread or a signal handler.
+ * Wakeups are cleared by xc_run_once(), so work queued by other threads must
+ * be consumed after xc_run_once().
+ */
+int   xc_fd(struct xc_ctx *ctx);
+int   xc_wake_fd(struct xc_ctx *ctx);
+void  xc_wakeup(struct xc_ctx *ctx);
+short xc_fd_events(struct xc_ctx *ctx);
+int   xc_timeout(struct xc_ctx *ctx);
+void  xc_run_once(struct xc_ctx *ctx, short revents);
+unsigned xc_swarm_fds(struct xc_ctx *ctx, struct pollfd *fds);
 
 #endif /* __XMPPCONSOLE_XMPP_H__ */
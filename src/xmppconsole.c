@@ -24,25 +24,55 @@
  * Main purpose of the tool is to study XEPs and debug servers behavior.
  *
  * For GTK UI, main priority is given to the GTK main loop, libstrophe
- * loop is executed in a timer callback. This is done in order to improve
- * responsiveness of the UI.
+ * events are dispatched from a GSource which watches the connection socket.
+ * This is done in order to improve responsiveness of the UI.
  */
 
+#include "backoff.h"
+#include "capture.h"
+#include "framer.h"
 #include "misc.h"
+#include "phases.h"
+#include "replay.h"
+#include "rtt.h"
+#include "swarm.h"
 #include "ui.h"
 #include "xmpp.h"
 
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strophe.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 struct xc_options {
 	unsigned short xo_port;
+	size_t xo_scrollback;
+	size_t xo_recorder_size;
+	char *xo_recorder;
+	char *xo_capture;
+	unsigned xo_capture_fsync;
+	char *xo_open;
+	char *xo_replay;
+	double xo_replay_speed;
+	char *xo_rtt_stats;
+	char *xo_timings;
+	unsigned xo_swarm;
+	double xo_swarm_rate;
+	unsigned xo_swarm_threads;
+	unsigned long xo_reconnect_min;
+	unsigned long xo_reconnect_max;
+	unsigned xo_reconnect_tries;
 	char *xo_jid;
 	char *xo_passwd;
 	char *xo_host;
@@ -57,9 +87,61 @@ struct xc_options {
 	bool xo_tls_trust;
 };
 
+#define XC_SCROLLBACK_DEFAULT 100000
+/* Average line size which is used to scale the store for scrollback. */
+#define XC_SCROLLBACK_LINE_SIZE 128
+
+/* Default size of the flight recorder in MiB. */
+#define XC_RECORDER_SIZE_DEFAULT 64
+/* Average stanza size which is used to scale the store for the recorder. */
+#define XC_RECORDER_RECORD_SIZE 512
+
+/* Reconnect delays in milliseconds, the first retry is immediate. */
+#define XC_RECONNECT_MIN 500
+#define XC_RECONNECT_MAX 30000
 #define XC_RECONNECT_TRIES 5
-#define XC_RECONNECT_TIMER 5000
 #define XC_CONN_RAW_FEATURES_TIMEOUT 5000
+/*
+ * Max time the prelogin thread sleeps, it checks the stop flag after it.
+ * The timer wheel isn't a libstrophe handler and the only timed handler of
+ * the prelogin is the features timeout, so the thread really sleeps.
+ */
+#define XC_PRELOGIN_TIMEOUT 50
+
+/*
+ * Event loop timeouts for UIs that poll the connection socket themselves.
+ * libstrophe doesn't export the deadline of its timed handlers. They are
+ * used only for timeouts of the negotiation, so the loop wakes up once in
+ * XC_LOOP_TIMEOUT_NEGOTIATION until the attempt is finished. An established
+ * session sleeps until the socket or the timer wheel is ready.
+ * Without send queue length (libstrophe older than 0.12) we don't know when
+ * to wait for POLLOUT. So a short timeout is kept for a while after I/O, and
+ * all the time while a swarm runs on the UI loop.
+ */
+#define XC_LOOP_TIMEOUT_NEGOTIATION 1000
+#define XC_LOOP_TIMEOUT_BURST 5
+#define XC_LOOP_BURST_PERIOD 50
+/* Max TLS record is 16KiB and libstrophe reads by 4KiB. */
+#define XC_LOOP_TLS_READS 4
+/* Records of a capture file which are fed to the UI per iteration. */
+#define XC_LOOP_FILE_RECORDS 256
+/* A page moves the loaded part of a capture file by this many records. */
+#define XC_FILE_PAGE_STEP 1024
+/* Statistics in the status bar are updated at most once per period. */
+#define XC_STATS_PERIOD 250
+
+/* Swarm counters in the status bar are sampled once per period. */
+#define XC_SWARM_STATS_PERIOD 1000
+#define XC_SWARM_THREADS_MAX 1024
+
+#define XC_NS_SM "urn:xmpp:sm:3"
+
+/* Pending requests which are tracked for round-trip times. */
+#define XC_RTT_PENDING_MAX (64 * 1024)
+/* Requests in a message which get generated ids without allocations. */
+#define XC_IQ_IDS_MAX 64
+/* Length of the generated id attribute. */
+#define XC_IQ_ID_SIZE 32
 
 static bool verbose_level = false;
 
@@ -77,6 +159,64 @@ static const char *xc_version = VERSION;
 static const char *xc_version = "unknown";
 #endif
 
+static struct xc_phases *xc_phases_cur(struct xc_ctx *ctx)
+{
+	return &ctx->c_phases[ctx->c_conn_id % XC_PHASES_HISTORY];
+}
+
+static void xc_phase(struct xc_ctx *ctx, xc_phase_t phase)
+{
+	xc_phases_mark(xc_phases_cur(ctx), phase);
+}
+
+/* Schedules an update of the statistics in the status bar. */
+static void xc_stats_update(struct xc_ctx *ctx)
+{
+	if (!ctx->c_stats_timer.tm_is_armed) {
+		xc_timer_arm(&ctx->c_wheel, &ctx->c_stats_timer,
+			     xc_time_ms() + XC_STATS_PERIOD);
+	}
+}
+
+/*
+ * Finishes the current connection attempt with either established session
+ * or a failure. Failed attempts before it are taken from the history.
+ */
+static void xc_phases_finish(struct xc_ctx *ctx)
+{
+	struct xc_phases *ph = xc_phases_cur(ctx);
+	struct xc_phases *prev;
+	char              line[256];
+	uint32_t          failed = 0;
+	size_t            len;
+
+	if (ph->ph_conn != ctx->c_conn_id || ph->ph_is_done)
+		return;
+
+	ph->ph_is_done = true;
+	if (ctx->c_timings != NULL) {
+		xc_phases_format_line(ph, line, sizeof(line));
+		fprintf(ctx->c_timings, "%s\n", line);
+	}
+
+	while (failed + 1 < XC_PHASES_HISTORY &&
+	       failed + 1 < ctx->c_conn_id) {
+		prev = &ctx->c_phases[(ctx->c_conn_id - failed - 1) %
+				      XC_PHASES_HISTORY];
+		if (!prev->ph_is_done ||
+		    xc_phases_is_marked(prev, XC_PHASE_READY))
+			break;
+		++failed;
+	}
+	xc_phases_format(ph, ctx->c_login, sizeof(ctx->c_login));
+	if (failed > 0) {
+		len = strlen(ctx->c_login);
+		snprintf(ctx->c_login + len, sizeof(ctx->c_login) - len,
+			 " after %u failed", (unsigned)failed);
+	}
+	xc_stats_update(ctx);
+}
+
 static int xc_conn_raw_error_handler(xmpp_conn_t *conn,
 				     xmpp_stanza_t *stanza,
 				     void *userdata)
@@ -89,11 +229,14 @@ static int xc_conn_raw_proceedtls_handler(xmpp_conn_t *conn,
 					  xmpp_stanza_t *stanza,
 					  void *userdata)
 {
+	struct xc_ctx *ctx = userdata;
 	int rc = -1;
 
 	if (xc_streq(xmpp_stanza_get_name(stanza), "proceed")) {
+		xc_phase(ctx, XC_PHASE_TLS_PROCEED);
 		rc = xmpp_conn_tls_start(conn);
 		if (rc == 0) {
+			xc_phase(ctx, XC_PHASE_TLS_DONE);
 			xmpp_handler_delete(conn, xc_conn_raw_error_handler);
 			xmpp_conn_open_stream_default(conn);
 		}
@@ -114,6 +257,69 @@ static int xc_conn_raw_missing_features_handler(xmpp_conn_t *conn,
 	return 0;
 }
 
+/*
+ * libstrophe doesn't call user handlers until the session is established,
+ * so the negotiation is captured from debug messages "RECV: <data>" and
+ * "SENT: <data>". Data sent by xc_send() is captured in xc_send_slice().
+ */
+static void xc_log_cb(void             *userdata,
+		      xmpp_log_level_t  level,
+		      const char       *area,
+		      const char       *msg)
+{
+	struct xc_ctx *ctx = userdata;
+
+	/* Traffic of the swarm isn't displayed. */
+	if (ctx->c_swarm == NULL && !ctx->c_is_online &&
+	    level == XMPP_LEVEL_DEBUG && msg[0] != '\0' &&
+	    msg[1] != '\0' && msg[2] != '\0' && msg[3] != '\0' &&
+	    msg[4] == ':' && msg[5] == ' ') {
+		if (memcmp(msg, "RECV", 4) == 0)
+			xc_tap(ctx, XC_DIR_RECV, msg + 6, strlen(msg + 6));
+		else if (!ctx->c_in_send && memcmp(msg, "SENT", 4) == 0)
+			xc_tap(ctx, XC_DIR_SENT, msg + 6, strlen(msg + 6));
+	}
+
+	/* Debug output */
+	if (verbose_level)
+		printf("[%d] %s: %s\n", level, area, msg);
+}
+
+/* Received stanzas of an established session. */
+static int xc_recv_handler(xmpp_conn_t   *conn,
+			   xmpp_stanza_t *stanza,
+			   void          *userdata)
+{
+	struct xc_ctx *ctx = userdata;
+	char          *buf;
+	size_t         len;
+
+	if (ctx->c_swarm == NULL &&
+	    xmpp_stanza_to_text(stanza, &buf, &len) == XMPP_EOK) {
+		xc_tap(ctx, XC_DIR_RECV, buf, len);
+		xmpp_free(ctx->c_ctx, buf);
+	}
+	return 1;
+}
+
+/* Session is established and the user can send stanzas. */
+static void xc_connected(struct xc_ctx *ctx)
+{
+	xc_phase(ctx, XC_PHASE_READY);
+	xc_phases_finish(ctx);
+	ctx->c_is_online = true;
+	/* Enabled from the next stanza, the current one is logged already. */
+	xmpp_handler_add(ctx->c_conn, xc_recv_handler, NULL, NULL, NULL, ctx);
+	ctx->c_log.handler = verbose_level ? xc_log_cb : NULL;
+	xc_ui_connected(ctx->c_ui);
+	if (xc_ui_is_done(ctx->c_ui)) {
+		xmpp_disconnect(ctx->c_conn);
+		return;
+	}
+	if (ctx->c_replay != NULL)
+		xc_replay_start(ctx->c_replay);
+}
+
 static int xc_conn_raw_features_handler(xmpp_conn_t *conn,
 					xmpp_stanza_t *stanza,
 					void *userdata)
@@ -122,6 +328,7 @@ static int xc_conn_raw_features_handler(xmpp_conn_t *conn,
 	bool secured = !!xmpp_conn_is_secured(conn);
 	xmpp_stanza_t *child;
 
+	xc_phase(ctx, XC_PHASE_FEATURES);
 	xmpp_timed_handler_delete(conn, xc_conn_raw_missing_features_handler);
 
 	/* Establish TLS session if it is supported and not disabled */
@@ -138,9 +345,10 @@ static int xc_conn_raw_features_handler(xmpp_conn_t *conn,
 		return 0;
 	}
 
-	xc_ui_connected(ctx->c_ui);
-	if (xc_ui_is_done(ctx->c_ui))
-		xmpp_disconnect(conn);
+	/* The prelogin ends here, libstrophe logs in over a new connection. */
+	if (ctx->c_prelogin)
+		return 0;
+	xc_connected(ctx);
 
 	return 0;
 }
@@ -155,17 +363,77 @@ static void xc_handle_connect_raw(xmpp_conn_t *conn, struct xc_ctx *ctx)
 			       XC_CONN_RAW_FEATURES_TIMEOUT, NULL);
 }
 
-static int xc_reconnect_cb(xmpp_ctx_t *xmpp_ctx, void *userdata)
+/* Gives up silently when retries are exhausted. */
+static void xc_reconnect_schedule(struct xc_ctx *ctx)
+{
+	uint64_t delay;
+
+	if (xc_backoff_next(&ctx->c_backoff, &delay)) {
+		xc_timer_arm(&ctx->c_wheel, &ctx->c_reconnect_timer,
+			     xc_time_ms() + delay);
+	}
+}
+
+static void xc_reconnect_cb(struct xc_timer *timer, void *userdata)
 {
 	struct xc_ctx *ctx = userdata;
-	int            rc = 0;
 
-	++ctx->c_attempts;
-	if (ctx->c_attempts <= XC_RECONNECT_TRIES)
-		rc = xc_connect(ctx, NULL, false);
+	if (xc_connect(ctx, NULL, false) != 0)
+		xc_reconnect_schedule(ctx);
+}
 
-	/* Don't remove timed handler if connection fails, reconnect later */
-	return rc == 0 ? 0 : 1;
+/*
+ * Remembers the peer address for the first retry and for the login after
+ * a prelogin.
+ */
+static void xc_addr_cache(struct xc_ctx *ctx)
+{
+	struct sockaddr_storage ss;
+	socklen_t               len = sizeof(ss);
+	char                    port[8];
+	int                     rc;
+
+	ctx->c_addr[0] = '\0';
+	if (ctx->c_fd < 0 ||
+	    getpeername(ctx->c_fd, (struct sockaddr *)&ss, &len) != 0)
+		return;
+
+	rc = getnameinfo((struct sockaddr *)&ss, len, ctx->c_addr,
+			 sizeof(ctx->c_addr), port, sizeof(port),
+			 NI_NUMERICHOST | NI_NUMERICSERV);
+	if (rc != 0) {
+		ctx->c_addr[0] = '\0';
+		return;
+	}
+	ctx->c_addr_port = (unsigned short)strtoul(port, NULL, 10);
+}
+
+/* Dumps the flight recorder, does nothing if it isn't enabled. */
+static void xc_dump(struct xc_ctx *ctx)
+{
+	char *path;
+	int   rc;
+
+	if (ctx->c_dump_path == NULL)
+		return;
+
+	path = malloc(strlen(ctx->c_dump_path) + 12);
+	if (path == NULL)
+		return;
+	sprintf(path, "%s.%u", ctx->c_dump_path, ++ctx->c_dumps_nr);
+	rc = xc_capture_dump(path, &ctx->c_store);
+	if (rc != 0) {
+		fprintf(stderr, "Error: failed to dump traffic to %s: %s\n",
+			path, strerror(-rc));
+	}
+	free(path);
+}
+
+void xc_dump_request(struct xc_ctx *ctx)
+{
+	/* The dump is done by the event loop in xc_run_once(). */
+	atomic_store(&ctx->c_dump_pending, true);
+	xc_wakeup(ctx);
 }
 
 static void xc_conn_handler(xmpp_conn_t         *conn,
@@ -184,18 +452,19 @@ static void xc_conn_handler(xmpp_conn_t         *conn,
 
 	switch (status) {
 	case XMPP_CONN_CONNECT:
-		ctx->c_attempts = 0;
+		xc_backoff_reset(&ctx->c_backoff);
+		xc_addr_cache(ctx);
 		if (ctx->c_is_raw) {
 			/* Special case for raw mode. */
 			xc_handle_connect_raw(conn, ctx);
 			break;
 		}
-		xc_ui_connected(ctx->c_ui);
-		if (xc_ui_is_done(ctx->c_ui))
-			xmpp_disconnect(conn);
+		xc_connected(ctx);
 		break;
 	case XMPP_CONN_RAW_CONNECT:
 		assert(ctx->c_is_raw);
+		xc_phase(ctx, XC_PHASE_CONNECTED);
+		xc_addr_cache(ctx);
 		if (ctx->c_tls_legacy && !ctx->c_tls_disable) {
 			int rc;
 
@@ -204,48 +473,94 @@ static void xc_conn_handler(xmpp_conn_t         *conn,
 				xmpp_disconnect(conn);
 				break;
 			}
+			xc_phase(ctx, XC_PHASE_TLS_DONE);
 		}
 		xmpp_conn_open_stream_default(conn);
 		break;
 	default:
+		/* libstrophe has closed the socket. */
+		ctx->c_fd = -1;
+		/* Failed prelogin falls back to the full login. */
+		if (ctx->c_prelogin)
+			break;
+		xc_phases_finish(ctx);
+#ifdef HAVE_XMPP_CONN_GET_SM_STATE
+		/* Keep the session and unacked stanzas for resumption. */
+		if (ctx->c_sm_state == NULL)
+			ctx->c_sm_state = xmpp_conn_get_sm_state(conn);
+#endif
+		if (ctx->c_replay != NULL)
+			xc_replay_stop(ctx->c_replay);
 		xc_ui_disconnected(ctx->c_ui);
 		if (ctx->c_is_done || xc_ui_is_done(ctx->c_ui))
 			xc_ui_quit(ctx->c_ui);
 		else {
-			xmpp_global_timed_handler_add(ctx->c_ctx,
-						      xc_reconnect_cb,
-						      XC_RECONNECT_TIMER, ctx);
+			/*
+			 * Save the traffic before an established session is
+			 * lost. Failed reconnect attempts would only repeat
+			 * the same dump.
+			 */
+			if (ctx->c_is_online)
+				xc_dump(ctx);
+			xc_reconnect_schedule(ctx);
+		}
+		if (ctx->c_is_online) {
+			xmpp_handler_delete(conn, xc_recv_handler);
+			ctx->c_log.handler = xc_log_cb;
 		}
+		ctx->c_is_online = false;
 	}
 }
 
-static void xc_configure(struct xc_ctx *ctx, struct xc_options *opts)
+static long xc_conn_flags(struct xc_options *opts)
 {
 	long xmpp_flags;
 
-	assert(opts->xo_jid != NULL);
-
 	xmpp_flags = opts->xo_tls_disable ?  XMPP_CONN_FLAG_DISABLE_TLS :
 		     opts->xo_tls_trust ?    XMPP_CONN_FLAG_TRUST_TLS :
 					     XMPP_CONN_FLAG_MANDATORY_TLS;
 	xmpp_flags |= opts->xo_tls_legacy ?  XMPP_CONN_FLAG_LEGACY_SSL : 0;
 	xmpp_flags |= opts->xo_auth_legacy ? XMPP_CONN_FLAG_LEGACY_AUTH : 0;
-	xmpp_conn_set_flags(ctx->c_conn, xmpp_flags);
+
+	return xmpp_flags;
+}
+
+static void xc_configure(struct xc_ctx *ctx, struct xc_options *opts)
+{
+	assert(opts->xo_jid != NULL);
+
+	xmpp_conn_set_flags(ctx->c_conn, xc_conn_flags(opts));
 	xmpp_conn_set_jid(ctx->c_conn, opts->xo_jid);
 	if (opts->xo_passwd != NULL) {
 		xmpp_conn_set_pass(ctx->c_conn, opts->xo_passwd);
 	}
 	ctx->c_host        = opts->xo_host;
 	ctx->c_port        = opts->xo_port;
-	ctx->c_attempts    = 0;
-	ctx->c_is_raw      = opts->xo_raw_mode;
+	ctx->c_raw_mode    = opts->xo_raw_mode;
 	ctx->c_tls_disable = opts->xo_tls_disable;
 	ctx->c_tls_legacy  = opts->xo_tls_legacy;
+	xc_backoff_init(&ctx->c_backoff, opts->xo_reconnect_min,
+			opts->xo_reconnect_max, opts->xo_reconnect_tries,
+			xc_time_ns() ^ (uint64_t)getpid());
+}
+
+/* Global pointer for callbacks without userdata. */
+static struct xc_ctx *g_sock_ctx;
+
+static int xc_sockopt_cb(xmpp_conn_t *conn, void *sock)
+{
+	if (g_sock_ctx != NULL && g_sock_ctx->c_conn == conn) {
+		g_sock_ctx->c_fd = *(int *)sock;
+		xc_phase(g_sock_ctx, XC_PHASE_RESOLVED);
+	}
+	return 0;
 }
 
 int xc_connect(struct xc_ctx *ctx, struct xc_options *opts, bool reconnect)
 {
-	int rc;
+	const char     *host;
+	unsigned short  port;
+	int             rc;
 
 	if (opts != NULL) {
 		if (ctx->c_conn != NULL)
@@ -253,88 +568,605 @@ int xc_connect(struct xc_ctx *ctx, struct xc_options *opts, bool reconnect)
 		ctx->c_conn = xmpp_conn_new(ctx->c_ctx);
 		assert(ctx->c_conn != NULL);
 		xc_configure(ctx, opts);
+		g_sock_ctx = ctx;
+		xmpp_conn_set_sockopt_callback(ctx->c_conn, xc_sockopt_cb);
 	}
 
 	assert(ctx->c_conn != NULL);
+#ifdef HAVE_XMPP_CONN_GET_SM_STATE
+	/* libstrophe sends <resume/> instead of binding a new resource. */
+	if (ctx->c_sm_state != NULL) {
+		if (xmpp_conn_set_sm_state(ctx->c_conn,
+					   ctx->c_sm_state) != XMPP_EOK)
+			xmpp_free_sm_state(ctx->c_sm_state);
+		ctx->c_sm_state = NULL;
+	}
+#endif
+	ctx->c_fd = -1;
+	/* Reconnects after a prelogin are done by libstrophe. */
+	ctx->c_is_raw = ctx->c_raw_mode || ctx->c_prelogin;
+	++ctx->c_conn_id;
+	xc_phases_start(xc_phases_cur(ctx), ctx->c_conn_id);
+
+	/* TLS certificate is still verified against the JID domain. */
+	host = ctx->c_host;
+	port = ctx->c_port;
+	if (ctx->c_backoff.bo_attempts <= 1 && ctx->c_addr[0] != '\0') {
+		host = ctx->c_addr;
+		port = ctx->c_addr_port;
+	}
 
 	rc = ctx->c_is_raw ?
-		xmpp_connect_raw(ctx->c_conn, ctx->c_host, ctx->c_port,
-				 xc_conn_handler, ctx) :
-		xmpp_connect_client(ctx->c_conn, ctx->c_host, ctx->c_port,
-				    xc_conn_handler, ctx);
-	if (rc == XMPP_EOK)
-		xc_ui_connecting(ctx->c_ui);
-	else if (reconnect) {
-		xmpp_global_timed_handler_add(ctx->c_ctx, xc_reconnect_cb,
-					      XC_RECONNECT_TIMER, ctx);
+		xmpp_connect_raw(ctx->c_conn, host, port, xc_conn_handler,
+				 ctx) :
+		xmpp_connect_client(ctx->c_conn, host, port, xc_conn_handler,
+				    ctx);
+	if (rc == XMPP_EOK) {
+		/* Name resolution is done, the socket is connecting. */
+		xc_phase(ctx, XC_PHASE_RESOLVED);
+		if (!ctx->c_prelogin)
+			xc_ui_connecting(ctx->c_ui);
+	} else {
+		xc_phases_finish(ctx);
+		if (reconnect)
+			xc_reconnect_schedule(ctx);
 	}
 
 	return (rc == XMPP_EOK || reconnect) ? 0 : -1;
 }
 
-static bool should_display(const char *msg)
+int xc_tap_add(struct xc_ctx *ctx, xc_tap_cb cb, void *userdata)
 {
-	/* Display only sent and received stanzas. */
-	return strncmp(msg, "SENT:", 5) == 0 ||
-	       strncmp(msg, "RECV:", 5) == 0;
+	if (ctx->c_taps_nr >= ARRAY_SIZE(ctx->c_taps))
+		return -ENOSPC;
+
+	ctx->c_taps[ctx->c_taps_nr].t_cb = cb;
+	ctx->c_taps[ctx->c_taps_nr].t_userdata = userdata;
+	++ctx->c_taps_nr;
+
+	return 0;
 }
 
-static void xc_log_cb(void             *userdata,
-		      xmpp_log_level_t  level,
-		      const char       *area,
-		      const char       *msg)
+static void xc_tap_record(struct xc_ctx *ctx, const struct xc_record *rec)
 {
-	struct xc_ctx *ctx = userdata;
+	size_t i;
 
-	if (should_display(msg))
-		xc_ui_print(ctx->c_ui, msg);
+	for (i = 0; i < ctx->c_taps_nr; ++i)
+		ctx->c_taps[i].t_cb(ctx, rec, ctx->c_taps[i].t_userdata);
+	/* UI isn't thread-safe, the prelogin thread doesn't print. */
+	if (!ctx->c_prelogin)
+		xc_ui_print(ctx->c_ui, rec);
+}
 
-	/* Debug output */
-	if (verbose_level)
-		printf("[%d] %s: %s\n", level, area, msg);
+void xc_tap(struct xc_ctx *ctx, xc_dir_t dir, const char *data, size_t len)
+{
+	xc_tap_record(ctx, xc_store_append(&ctx->c_store, xc_time_ns(), dir,
+					   ctx->c_conn_id, data, len));
+}
+
+static bool xc_file_is_loading(struct xc_ctx *ctx)
+{
+	return ctx->c_file != NULL && ctx->c_file->cf_nr < ctx->c_file_end;
+}
+
+/*
+ * Feeds a portion of the capture file, so the UI stays responsive while
+ * a large file is loaded. Returns true if there are more records.
+ */
+static bool xc_file_feed(struct xc_ctx *ctx)
+{
+	const struct xc_cap_block *blk;
+	const struct xc_record    *rec;
+	int                        i;
+
+	for (i = 0; i < XC_LOOP_FILE_RECORDS; ++i) {
+		if (!xc_file_is_loading(ctx))
+			return false;
+		blk = xc_capture_file_next(ctx->c_file);
+		if (blk == NULL) {
+			/* The file is truncated. */
+			ctx->c_file_end = ctx->c_file->cf_nr;
+			return false;
+		}
+		if (ctx->c_file_shift == 0)
+			ctx->c_file_shift = blk->cb_time - xc_time_ns();
+		rec = xc_store_append(&ctx->c_store,
+				      blk->cb_time - ctx->c_file_shift,
+				      (xc_dir_t)blk->cb_dir, blk->cb_conn,
+				      (const char *)(blk + 1), blk->cb_len);
+		xc_tap_record(ctx, rec);
+	}
+	return true;
+}
+
+/* Number of records of the capture file which are loaded at once. */
+static uint64_t xc_file_window(struct xc_ctx *ctx)
+{
+	return ctx->c_scrollback > 0 ? ctx->c_scrollback : UINT64_MAX;
+}
+
+/* Starts loading of the window which begins with record 'first'. */
+static void xc_file_load(struct xc_ctx *ctx, uint64_t first)
+{
+	uint64_t records_nr = ctx->c_file->cf_records_nr;
+	uint64_t window = xc_file_window(ctx);
+
+	xc_store_clear(&ctx->c_store);
+	ctx->c_file_first = first;
+	ctx->c_file_end = records_nr - first > window ? first + window :
+							 records_nr;
+	ctx->c_file_seq = xc_store_next(&ctx->c_store);
+	xc_capture_file_seek(ctx->c_file, first);
+}
+
+bool xc_file_page(struct xc_ctx *ctx, bool older, uint64_t *seq)
+{
+	struct xc_store *store = &ctx->c_store;
+	uint64_t         records_nr;
+	uint64_t         window;
+	uint64_t         step;
+	uint64_t         first;
+	uint64_t         nr;
+
+	if (ctx->c_file == NULL)
+		return false;
+
+	records_nr = ctx->c_file->cf_records_nr;
+	window = xc_file_window(ctx);
+	step = MIN(MAX(window / 2, 1), XC_FILE_PAGE_STEP);
+	if (!older) {
+		if (xc_file_is_loading(ctx) || ctx->c_file_end >= records_nr)
+			return false;
+		/*
+		 * Newer records are appended by the event loop as on open, the
+		 * store evicts the oldest ones and the rest keep their numbers.
+		 */
+		ctx->c_file_end = MIN(ctx->c_file_end + step, records_nr);
+		return true;
+	}
+
+	/* Records which didn't fit the store are evicted already. */
+	first = ctx->c_file_first + (xc_store_first(store) - ctx->c_file_seq);
+	nr = ctx->c_file_first + (MAX(*seq, ctx->c_file_seq) - ctx->c_file_seq);
+	if (first == 0)
+		return false;
+	first = first > step ? first - step : 0;
+
+	/*
+	 * Sequence numbers only grow, so older records need a reload. Only the
+	 * records up to 'seq' are loaded here, the event loop feeds the rest.
+	 */
+	xc_file_load(ctx, first);
+	nr = MAX(nr, first);
+	while (ctx->c_file->cf_nr <= nr && xc_file_feed(ctx))
+		;
+
+	*seq = MAX(ctx->c_file_seq + (nr - first), xc_store_first(store));
+	if (*seq >= xc_store_next(store) &&
+	    xc_store_next(store) > xc_store_first(store))
+		*seq = xc_store_next(store) - 1;
+
+	return true;
+}
+
+static bool xc_is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/* Returns the root element of a unit if it's a stanza or NULL. */
+static const char *xc_unit_stanza(const char *unit, size_t len)
+{
+	static const char *const stanzas[] = { "iq", "message", "presence" };
+	const char              *end = unit + len;
+	const char              *tag = unit;
+	const char              *p;
+	size_t                   i;
+
+	while (tag < end && xc_is_space(*tag))
+		++tag;
+	if (tag == end || *tag != '<')
+		return NULL;
+
+	for (p = tag + 1; p < end && !xc_is_space(*p) && *p != '/' &&
+			  *p != '>'; ++p)
+		;
+	for (i = 0; i < ARRAY_SIZE(stanzas); ++i) {
+		if ((size_t)(p - tag - 1) == strlen(stanzas[i]) &&
+		    memcmp(tag + 1, stanzas[i], (size_t)(p - tag - 1)) == 0)
+			return tag;
+	}
+	return NULL;
+}
+
+/* Appends a piece of a unit to 'buf', or sends it if there is no buffer. */
+static void xc_unit_put(struct xc_ctx *ctx,
+			char          *buf,
+			size_t        *pos,
+			const char    *data,
+			size_t         len)
+{
+	if (buf == NULL) {
+		if (len > 0)
+			xmpp_send_raw(ctx->c_conn, data, len);
+	} else {
+		memcpy(buf + *pos, data, len);
+		*pos += len;
+	}
+}
+
+/*
+ * Sends unit [start, end) of a slice. Ids generated for requests within the
+ * unit are inserted at their offsets, '*id' is advanced past them. A unit
+ * without ids which isn't a stanza is sent as is. Otherwise, only the unit
+ * is copied: stanzas are parsed from a string and passed to xmpp_send().
+ */
+static void xc_send_unit(struct xc_ctx      *ctx,
+			 const char         *data,
+			 size_t              start,
+			 size_t              end,
+			 const size_t       *offs,
+			 char              (*ids)[XC_IQ_ID_SIZE],
+			 size_t              ids_nr,
+			 size_t             *id)
+{
+	xmpp_stanza_t *stanza = NULL;
+	const char    *tag;
+	size_t         tag_off;
+	size_t         first = *id;
+	size_t         size = end - start + 1;
+	size_t         pos = 0;
+	size_t         i;
+	char          *buf;
+
+	tag = xc_unit_stanza(data + start, end - start);
+	/* Ids are inserted into the start tag, so they follow its offset. */
+	tag_off = tag != NULL ? (size_t)(tag - data - start) : 0;
+	for (; *id < ids_nr && offs[*id] < end; ++*id)
+		size += strlen(ids[*id]);
+	if (tag == NULL && *id == first) {
+		xmpp_send_raw(ctx->c_conn, data + start, end - start);
+		return;
+	}
+
+	/* Without memory the pieces are sent raw. */
+	buf = malloc(size);
+	for (i = first; i < *id; ++i) {
+		xc_unit_put(ctx, buf, &pos, data + start, offs[i] - start);
+		xc_unit_put(ctx, buf, &pos, ids[i], strlen(ids[i]));
+		start = offs[i];
+	}
+	xc_unit_put(ctx, buf, &pos, data + start, end - start);
+	if (buf == NULL)
+		return;
+
+	buf[pos] = '\0';
+	if (tag != NULL) {
+		stanza = xmpp_stanza_new_from_string(ctx->c_ctx,
+						     buf + tag_off);
+	}
+	if (stanza != NULL) {
+		xmpp_send(ctx->c_conn, stanza);
+		xmpp_stanza_release(stanza);
+	} else {
+		xmpp_send_raw(ctx->c_conn, buf, pos);
+	}
+	free(buf);
+}
+
+/*
+ * libstrophe counts stanzas for stream management only when they are sent
+ * with xmpp_send(). Its state is handed over by xmpp_conn_get_sm_state()
+ * only when the connection is down, so it isn't mirrored here. Stanzas of
+ * a session which libstrophe negotiated go through xmpp_send() and it
+ * applies the state itself.
+ */
+static bool xc_send_is_counted(struct xc_ctx *ctx)
+{
+#ifdef HAVE_XMPP_CONN_GET_SM_STATE
+	return !ctx->c_is_raw;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Sends a slice unit by unit. 'ends' are offsets after units found by the
+ * framer of the input, relative to the message which begins 'base' bytes
+ * before the slice. Without them, the slice is framed here. Data after the
+ * last unit is sent as one.
+ */
+static void xc_send_stanzas(struct xc_ctx      *ctx,
+			    const char         *data,
+			    size_t              len,
+			    const size_t       *ends,
+			    size_t              ends_nr,
+			    size_t              base,
+			    const size_t       *offs,
+			    char              (*ids)[XC_IQ_ID_SIZE],
+			    size_t              ids_nr)
+{
+	struct xc_framer framer;
+	size_t           start = 0;
+	size_t           end;
+	size_t           id = 0;
+	size_t           i = 0;
+	size_t           n;
+
+	xc_framer_init(&framer);
+	while (start < len) {
+		if (ends != NULL) {
+			while (i < ends_nr && ends[i] <= base + start)
+				++i;
+			end = i < ends_nr && ends[i] - base < len ?
+			      ends[i] - base : len;
+		} else {
+			n = xc_framer_next(&framer, data + start, len - start);
+			end = n > 0 ? start + n : len;
+		}
+		xc_send_unit(ctx, data, start, end, offs, ids, ids_nr, &id);
+		start = end;
+	}
+}
+
+/*
+ * Sends a part of a message which doesn't re-open the stream. Requests
+ * without id get a generated one, so replies can be matched to measure
+ * RTT. Slices of the message and the ids are passed to the store as they
+ * are. They are passed to libstrophe the same way unless stanzas are
+ * counted, then only stanzas and units with ids are copied. Arrays on the
+ * stack fit XC_IQ_IDS_MAX requests, larger pastes get them from the heap.
+ */
+static void xc_send_slice(struct xc_ctx *ctx,
+			  const char    *data,
+			  size_t         len,
+			  const size_t  *ends,
+			  size_t         ends_nr,
+			  size_t         base)
+{
+	struct iovec            iov_buf[XC_IQ_IDS_MAX * 2 + 1];
+	char                    ids_buf[XC_IQ_IDS_MAX][XC_IQ_ID_SIZE];
+	size_t                  offs_buf[XC_IQ_IDS_MAX];
+	struct iovec           *iov = iov_buf;
+	char                  (*ids)[XC_IQ_ID_SIZE] = ids_buf;
+	size_t                 *offs = offs_buf;
+	const struct xc_record *rec;
+	size_t                  pos = 0;
+	size_t                  nr;
+	size_t                  i;
+	int                     n = 0;
+
+	if (len == 0)
+		return;
+
+	nr = xc_rtt_iq_without_id(data, len, offs, XC_IQ_IDS_MAX);
+	if (nr > XC_IQ_IDS_MAX) {
+		iov = malloc((nr * 2 + 1) * sizeof(*iov));
+		ids = malloc(nr * sizeof(*ids));
+		offs = malloc(nr * sizeof(*offs));
+		if (iov == NULL || ids == NULL || offs == NULL) {
+			free(iov);
+			free(ids);
+			free(offs);
+			iov = iov_buf;
+			ids = ids_buf;
+			offs = offs_buf;
+			/* Only the first requests are tracked. */
+			nr = XC_IQ_IDS_MAX;
+		} else {
+			(void)xc_rtt_iq_without_id(data, len, offs, nr);
+		}
+	}
+	for (i = 0; i < nr; ++i) {
+		iov[n].iov_base = (void *)(data + pos);
+		iov[n++].iov_len = offs[i] - pos;
+		iov[n].iov_base = ids[i];
+		iov[n++].iov_len = (size_t)snprintf(ids[i], sizeof(ids[i]),
+						    " id='xc%lu'",
+						    ++ctx->c_iq_id);
+		pos = offs[i];
+	}
+	iov[n].iov_base = (void *)(data + pos);
+	iov[n++].iov_len = len - pos;
+
+	ctx->c_in_send = true;
+	if (xc_send_is_counted(ctx)) {
+		xc_send_stanzas(ctx, data, len, ends, ends_nr, base, offs, ids,
+				nr);
+	} else {
+		for (i = 0; i < (size_t)n; ++i) {
+			if (iov[i].iov_len > 0)
+				xmpp_send_raw(ctx->c_conn, iov[i].iov_base,
+					      iov[i].iov_len);
+		}
+	}
+	ctx->c_in_send = false;
+	rec = xc_store_appendv(&ctx->c_store, xc_time_ns(), XC_DIR_SENT,
+			       ctx->c_conn_id, iov, n);
+	xc_tap_record(ctx, rec);
+
+	if (iov != iov_buf) {
+		free(iov);
+		free(ids);
+		free(offs);
+	}
 }
 
 void xc_send(struct xc_ctx *ctx, const char *msg)
 {
-	const char *tag_stream;
-	const char *tag_xml;
-	const char *ptr;
-	char       *buf;
-	size_t      len;
+	xc_send_buf(ctx, msg, strlen(msg));
+}
+
+void xc_send_buf(struct xc_ctx *ctx, const char *msg, size_t len)
+{
+	xc_send_units(ctx, msg, len, NULL, 0);
+}
+
+/*
+ * Sends a message which may re-open a stream. The message is scanned once
+ * and its slices are passed to libstrophe without copying.
+ */
+void xc_send_units(struct xc_ctx *ctx,
+		   const char    *msg,
+		   size_t         len,
+		   const size_t  *ends,
+		   size_t         ends_nr)
+{
+	size_t start;
+	size_t end;
+
+	/* Capture file is read-only. */
+	if (ctx->c_conn == NULL)
+		return;
 
-	tag_stream = strstr(msg, "<stream:stream");
-	if (tag_stream != NULL) {
+	if (xc_framer_find_stream(msg, len, &start, &end)) {
 		/*
 		 * Re-open a stream. We have to reset libstrophe's parser with
 		 * a xmpp_conn_open_stream-like function.
 		 */
-		tag_xml = strstr(msg, "<?");
-		ptr = tag_xml != NULL && tag_xml < tag_stream ? tag_xml : tag_stream;
-		if (msg < ptr) {
-			len = (size_t)(ptr - msg);
-			buf = malloc(len + 1);
-			if (buf != NULL) {
-				strncpy(buf, msg, len);
-				buf[len] = '\0';
-				xmpp_send_raw_string(ctx->c_conn, "%s", buf);
-				free(buf);
-			}
-		}
+		xc_send_slice(ctx, msg, start, ends, ends_nr, 0);
 		/* TODO Don't ignore attributes in the users tag. */
 		xmpp_conn_open_stream_default(ctx->c_conn);
-		ptr = strstr(tag_stream, ">");
-		if (ptr != NULL && *(ptr + 1) != '\0') {
-			xmpp_send_raw_string(ctx->c_conn, "%s", ptr + 1);
-		}
+		xc_send_slice(ctx, msg + end, len - end, ends, ends_nr, end);
 	} else {
-		xmpp_send_raw_string(ctx->c_conn, "%s", msg);
+		xc_send_slice(ctx, msg, len, ends, ends_nr, 0);
+	}
+	ctx->c_last_io = xc_time_ms();
+}
+
+int xc_fd(struct xc_ctx *ctx)
+{
+	if (ctx->c_conn == NULL || xmpp_conn_is_disconnected(ctx->c_conn))
+		return -1;
+	return ctx->c_fd;
+}
+
+static int xc_wake_init(struct xc_ctx *ctx)
+{
+	int rc;
+	int i;
+
+	rc = pipe(ctx->c_wake);
+	for (i = 0; rc == 0 && i < 2; ++i) {
+		rc = fcntl(ctx->c_wake[i], F_SETFL, O_NONBLOCK)
+		  ?: fcntl(ctx->c_wake[i], F_SETFD, FD_CLOEXEC);
+	}
+	atomic_init(&ctx->c_wake_pending, false);
+
+	return rc;
+}
+
+static void xc_wake_fini(struct xc_ctx *ctx)
+{
+	close(ctx->c_wake[0]);
+	close(ctx->c_wake[1]);
+}
+
+static void xc_wake_clear(struct xc_ctx *ctx)
+{
+	char buf[64];
+
+	if (atomic_exchange(&ctx->c_wake_pending, false)) {
+		while (read(ctx->c_wake[0], buf, sizeof(buf)) > 0)
+			;
+	}
+}
+
+int xc_wake_fd(struct xc_ctx *ctx)
+{
+	return ctx->c_wake[0];
+}
+
+void xc_wakeup(struct xc_ctx *ctx)
+{
+	int saved_errno = errno;
+
+	/* Only the first wakeup writes to the pipe. */
+	if (!atomic_exchange(&ctx->c_wake_pending, true))
+		(void)write(ctx->c_wake[1], "", 1);
+	errno = saved_errno;
+}
+
+short xc_fd_events(struct xc_ctx *ctx)
+{
+	short events = POLLIN;
+
+	if (xc_fd(ctx) < 0)
+		return 0;
+	/* Wait for the non-blocking connect(2) to complete. */
+	if (xmpp_conn_is_connecting(ctx->c_conn))
+		events |= POLLOUT;
+#ifdef HAVE_XMPP_CONN_SEND_QUEUE_LEN
+	if (xmpp_conn_send_queue_len(ctx->c_conn) > 0)
+		events |= POLLOUT;
+#endif
+	return events;
+}
+
+unsigned xc_swarm_fds(struct xc_ctx *ctx, struct pollfd *fds)
+{
+	return ctx->c_swarm != NULL ? xc_swarm_pollfds(ctx->c_swarm, fds) : 0;
+}
+
+/* Returns -1 when only the socket can wake the loop up. */
+static int xc_timeout_io(struct xc_ctx *ctx)
+{
+	if (xc_file_is_loading(ctx))
+		return 0;
+	/* Sockets of the swarm are polled along with xc_fd(). */
+	if (ctx->c_swarm != NULL &&
+	    xc_swarm_is_negotiating(ctx->c_swarm))
+		return XC_LOOP_TIMEOUT_NEGOTIATION;
+#ifndef HAVE_XMPP_CONN_SEND_QUEUE_LEN
+	if (ctx->c_swarm != NULL && ctx->c_swarm->sw_conf.swc_threads == 0)
+		return XC_LOOP_TIMEOUT_BURST;
+#endif
+	if (ctx->c_conn == NULL || xmpp_conn_is_disconnected(ctx->c_conn))
+		return -1;
+	if (!xc_phases_cur(ctx)->ph_is_done)
+		return XC_LOOP_TIMEOUT_NEGOTIATION;
+#ifndef HAVE_XMPP_CONN_SEND_QUEUE_LEN
+	if (xc_time_ms() - ctx->c_last_io < XC_LOOP_BURST_PERIOD)
+		return XC_LOOP_TIMEOUT_BURST;
+#endif
+	return -1;
+}
+
+int xc_timeout(struct xc_ctx *ctx)
+{
+	int timeout = xc_timeout_io(ctx);
+	int wheel = xc_wheel_timeout(&ctx->c_wheel, xc_time_ms());
+
+	if (timeout < 0)
+		return wheel;
+	return wheel >= 0 && wheel < timeout ? wheel : timeout;
+}
+
+void xc_run_once(struct xc_ctx *ctx, short revents)
+{
+	int nr = 1;
+	int i;
+
+	xc_wake_clear(ctx);
+	if (atomic_exchange(&ctx->c_dump_pending, false))
+		xc_dump(ctx);
+	if (xc_file_is_loading(ctx))
+		(void)xc_file_feed(ctx);
+	if ((revents & POLLIN) != 0) {
+		ctx->c_last_io = xc_time_ms();
+		if (ctx->c_conn != NULL && xmpp_conn_is_secured(ctx->c_conn))
+			nr = XC_LOOP_TLS_READS;
 	}
+	for (i = 0; i < nr; ++i)
+		xmpp_run_once(ctx->c_ctx, 0);
+	/* The wheel isn't a libstrophe timed handler, so it doesn't poll. */
+	xc_wheel_advance(&ctx->c_wheel, xc_time_ms());
 }
 
 void xc_quit(struct xc_ctx *ctx)
 {
 	ctx->c_is_done = true;
-	if (xmpp_conn_is_connected(ctx->c_conn))
+	if (ctx->c_conn != NULL && xmpp_conn_is_connected(ctx->c_conn))
 		xmpp_disconnect(ctx->c_conn);
 	else
 		xc_ui_quit(ctx->c_ui);
@@ -343,6 +1175,7 @@ void xc_quit(struct xc_ctx *ctx)
 static void xc_usage(FILE *stream, const char *name)
 {
 	fprintf(stream, "Usage: %s [OPTIONS] <JID> [PASSWORD]\n", name);
+	fprintf(stream, "       %s [OPTIONS] --open <FILE>\n", name);
 	fprintf(stream, "OPTIONS:\n"
 			"  --help\t\tPrint this help\n"
 			"  --host, -h <HOST>\tConnect to the host instead of "
@@ -355,6 +1188,38 @@ static void xc_usage(FILE *stream, const char *name)
 			"  --legacy-ssl\t\tLegacy SSL mode (without STARTTLS "
 								"support)\n"
 			"  --legacy-auth\t\tAllow insecure legacy authentication\n"
+			"  --scrollback <LINES>\tNumber of lines in the log "
+						"history (default %d)\n"
+			"  --flight-recorder <FILE>\n"
+			"\t\t\tKeep recent traffic in memory and dump it to "
+			"FILE.N\n\t\t\ton SIGUSR1 or disconnect\n"
+			"  --flight-recorder-size <MIB>\n"
+			"\t\t\tMemory for the flight recorder (default %d)\n"
+			"  --capture <FILE>\tWrite all traffic to FILE\n"
+			"  --capture-fsync <N>\tSync the capture file every "
+			"N records\n\t\t\t(default 0, only on exit)\n"
+			"  --open <FILE>\t\tView a capture file instead of "
+						"connecting\n"
+			"  --replay <FILE>\tSend stanzas from a capture file "
+						"after connecting\n"
+			"  --replay-speed <N>\tReplay N times faster or 'max' "
+						"(default 1)\n"
+			"  --rtt-stats <FILE>\tWrite round-trip times of "
+			"requests to FILE on exit,\n\t\t\t'-' for stdout\n"
+			"  --swarm <N>\t\tOpen N connections for load testing, "
+			"JID is a\n\t\t\ttemplate like bot%%d@domain\n"
+			"  --swarm-rate <N>\tStart N connections per second "
+			"(default 0, no limit)\n"
+			"  --swarm-threads <N>\tRun the swarm in N worker "
+			"threads (default 0,\n\t\t\tin the UI event loop)\n"
+			"  --reconnect-min <MS>\tMin delay between reconnects "
+			"(default %d)\n"
+			"  --reconnect-max <MS>\tMax delay between reconnects "
+			"(default %d)\n"
+			"  --reconnect-tries <N>\tGive up after N reconnects, "
+			"0 for unlimited\n\t\t\t(default %d)\n"
+			"  --timings <FILE>\tWrite phases of every connection "
+			"attempt to FILE\n"
 			"  --ui, -u <NAME>\tUse specified UI. Available: any, "
 #ifdef BUILD_UI_GTK
 			"gtk, "
@@ -364,28 +1229,61 @@ static void xc_usage(FILE *stream, const char *name)
 #endif
 			"console.\n"
 			"  --verbose, -v\t\tPrint debug messages\n"
-			"  --version\t\tPrint version and exit\n"
+			"  --version\t\tPrint version and exit\n",
+			XC_SCROLLBACK_DEFAULT, XC_RECORDER_SIZE_DEFAULT,
+			XC_RECONNECT_MIN, XC_RECONNECT_MAX, XC_RECONNECT_TRIES
 		);
 }
 
+static bool xc_parse_ulong(const char *name, const char *str,
+			   unsigned long *out)
+{
+	char *endptr;
+
+	errno = 0;
+	*out = strtoul(str, &endptr, 10);
+	if (errno != 0 || *str == '\0' || *str == '-' || *endptr != '\0') {
+		fprintf(stderr, "Invalid value for %s: %s\n", name, str);
+		return false;
+	}
+	return true;
+}
+
 static bool xc_options_parse(int argc, char **argv, struct xc_options *opts)
 {
 	int c;
 	int arg_nr;
 	int base = 10;
 	long tmp_long;
+	unsigned long tmp_ulong;
 	char *endptr;
 	const char *tmp_str;
 	const char *name;
 
 	static struct option long_opts[] = {
+		{ "capture", required_argument, 0, 0 },
+		{ "capture-fsync", required_argument, 0, 0 },
 		{ "disable-tls", no_argument, 0, 0 },
+		{ "flight-recorder", required_argument, 0, 0 },
+		{ "flight-recorder-size", required_argument, 0, 0 },
 		{ "help", no_argument, 0, 0 },
 		{ "host", no_argument, 0, 'h' },
 		{ "legacy-auth", no_argument, 0, 0 },
 		{ "legacy-ssl", no_argument, 0, 0 },
 		{ "noauth", no_argument, 0, 'n' },
+		{ "open", required_argument, 0, 0 },
+		{ "reconnect-max", required_argument, 0, 0 },
+		{ "reconnect-min", required_argument, 0, 0 },
+		{ "reconnect-tries", required_argument, 0, 0 },
+		{ "replay", required_argument, 0, 0 },
+		{ "replay-speed", required_argument, 0, 0 },
+		{ "rtt-stats", required_argument, 0, 0 },
 		{ "port", required_argument, 0, 'p' },
+		{ "scrollback", required_argument, 0, 0 },
+		{ "swarm", required_argument, 0, 0 },
+		{ "swarm-rate", required_argument, 0, 0 },
+		{ "swarm-threads", required_argument, 0, 0 },
+		{ "timings", required_argument, 0, 0 },
 		{ "trust-tls-cert", no_argument, 0, 't' },
 		{ "ui", required_argument, 0, 'u' },
 		{ "verbose", no_argument, 0, 'v' },
@@ -395,6 +1293,12 @@ static bool xc_options_parse(int argc, char **argv, struct xc_options *opts)
 	const char *short_opts = "h:np:tu:v";
 
 	memset(opts, 0, sizeof(*opts));
+	opts->xo_scrollback = XC_SCROLLBACK_DEFAULT;
+	opts->xo_recorder_size = XC_RECORDER_SIZE_DEFAULT;
+	opts->xo_replay_speed = 1;
+	opts->xo_reconnect_min = XC_RECONNECT_MIN;
+	opts->xo_reconnect_max = XC_RECONNECT_MAX;
+	opts->xo_reconnect_tries = XC_RECONNECT_TRIES;
 
 	while (1) {
 		int index = 0;
@@ -447,6 +1351,84 @@ static bool xc_options_parse(int argc, char **argv, struct xc_options *opts)
 				opts->xo_tls_legacy = true;
 			} else if (xc_streq(name, "legacy-auth")) {
 				opts->xo_auth_legacy = true;
+			} else if (xc_streq(name, "scrollback")) {
+				if (!xc_parse_ulong(name, optarg, &tmp_ulong) ||
+				    tmp_ulong == 0)
+					return false;
+				opts->xo_scrollback = (size_t)tmp_ulong;
+			} else if (xc_streq(name, "flight-recorder")) {
+				free(opts->xo_recorder);
+				opts->xo_recorder = strdup(optarg);
+			} else if (xc_streq(name, "flight-recorder-size")) {
+				if (!xc_parse_ulong(name, optarg, &tmp_ulong) ||
+				    tmp_ulong == 0 || tmp_ulong > SIZE_MAX >> 20)
+					return false;
+				opts->xo_recorder_size = (size_t)tmp_ulong;
+			} else if (xc_streq(name, "capture")) {
+				free(opts->xo_capture);
+				opts->xo_capture = strdup(optarg);
+			} else if (xc_streq(name, "capture-fsync")) {
+				if (!xc_parse_ulong(name, optarg, &tmp_ulong) ||
+				    tmp_ulong > UINT_MAX)
+					return false;
+				opts->xo_capture_fsync = (unsigned)tmp_ulong;
+			} else if (xc_streq(name, "open")) {
+				free(opts->xo_open);
+				opts->xo_open = strdup(optarg);
+			} else if (xc_streq(name, "replay")) {
+				free(opts->xo_replay);
+				opts->xo_replay = strdup(optarg);
+			} else if (xc_streq(name, "rtt-stats")) {
+				free(opts->xo_rtt_stats);
+				opts->xo_rtt_stats = strdup(optarg);
+			} else if (xc_streq(name, "swarm")) {
+				if (!xc_parse_ulong(name, optarg, &tmp_ulong) ||
+				    tmp_ulong == 0 || tmp_ulong > INT_MAX)
+					return false;
+				opts->xo_swarm = (unsigned)tmp_ulong;
+			} else if (xc_streq(name, "swarm-rate")) {
+				errno = 0;
+				opts->xo_swarm_rate = strtod(optarg, &endptr);
+				if (errno != 0 || *endptr != '\0' ||
+				    !(opts->xo_swarm_rate >= 0)) {
+					fprintf(stderr, "Invalid value for %s: "
+						"%s\n", name, optarg);
+					return false;
+				}
+			} else if (xc_streq(name, "swarm-threads")) {
+				if (!xc_parse_ulong(name, optarg, &tmp_ulong) ||
+				    tmp_ulong > XC_SWARM_THREADS_MAX)
+					return false;
+				opts->xo_swarm_threads = (unsigned)tmp_ulong;
+			} else if (xc_streq(name, "reconnect-min")) {
+				if (!xc_parse_ulong(name, optarg,
+						    &opts->xo_reconnect_min))
+					return false;
+			} else if (xc_streq(name, "reconnect-max")) {
+				if (!xc_parse_ulong(name, optarg,
+						    &opts->xo_reconnect_max))
+					return false;
+			} else if (xc_streq(name, "reconnect-tries")) {
+				if (!xc_parse_ulong(name, optarg, &tmp_ulong) ||
+				    tmp_ulong > UINT_MAX)
+					return false;
+				opts->xo_reconnect_tries = (unsigned)tmp_ulong;
+			} else if (xc_streq(name, "timings")) {
+				free(opts->xo_timings);
+				opts->xo_timings = strdup(optarg);
+			} else if (xc_streq(name, "replay-speed")) {
+				if (xc_streq(optarg, "max")) {
+					opts->xo_replay_speed = 0;
+					break;
+				}
+				errno = 0;
+				opts->xo_replay_speed = strtod(optarg, &endptr);
+				if (errno != 0 || *endptr != '\0' ||
+				    !(opts->xo_replay_speed > 0)) {
+					fprintf(stderr, "Invalid value for %s: "
+						"%s\n", name, optarg);
+					return false;
+				}
 			} else if (xc_streq(name, "version")) {
 				opts->xo_version = true;
 				return true;
@@ -457,13 +1439,40 @@ static bool xc_options_parse(int argc, char **argv, struct xc_options *opts)
 		}
 	}
 
+	if (opts->xo_open != NULL && opts->xo_replay != NULL) {
+		fprintf(stderr, "Replay requires a connection, it can't be "
+			"used with --open\n");
+		return false;
+	}
+
+	if (opts->xo_reconnect_min > opts->xo_reconnect_max) {
+		fprintf(stderr, "--reconnect-min must not exceed "
+			"--reconnect-max\n");
+		return false;
+	}
+
+	if (opts->xo_swarm > 0 &&
+	    (opts->xo_open != NULL || opts->xo_replay != NULL ||
+	     opts->xo_raw_mode)) {
+		fprintf(stderr, "Swarm can't be used with --open, --replay "
+			"or --noauth\n");
+		return false;
+	}
+
 	arg_nr = argc - optind;
-	if (arg_nr < 1 || arg_nr > 2)
+	/* JID isn't needed to view a capture file. */
+	if (arg_nr < (opts->xo_open == NULL ? 1 : 0) || arg_nr > 2)
 		return false;
 
-	opts->xo_jid = strdup(argv[optind]);
+	if (arg_nr > 0)
+		opts->xo_jid = strdup(argv[optind]);
 	if (arg_nr > 1)
 		opts->xo_passwd = strdup(argv[optind + 1]);
+	if (opts->xo_swarm > 0 && !xc_swarm_jid_is_valid(opts->xo_jid)) {
+		fprintf(stderr, "Swarm requires a JID template with a single "
+			"%%d: %s\n", opts->xo_jid);
+		return false;
+	}
 
 	/* Parse UI string */
 	opts->xo_ui_type = xc_ui_name_to_type(opts->xo_ui);
@@ -481,6 +1490,12 @@ static void xc_options_fini(struct xc_options *opts)
 {
 	free(opts->xo_jid);
 	free(opts->xo_host);
+	free(opts->xo_recorder);
+	free(opts->xo_capture);
+	free(opts->xo_open);
+	free(opts->xo_replay);
+	free(opts->xo_rtt_stats);
+	free(opts->xo_timings);
 	if (opts->xo_passwd != NULL) {
 		memset(opts->xo_passwd, 0, strlen(opts->xo_passwd));
 		free(opts->xo_passwd);
@@ -499,16 +1514,281 @@ static struct sigaction xc_sigaction = {
 	.sa_handler = xc_sighandler,
 };
 
+static void xc_dump_sighandler(int signo)
+{
+	xc_dump_request(g_ctx);
+}
+
+static struct sigaction xc_dump_sigaction = {
+	.sa_handler = xc_dump_sighandler,
+	.sa_flags = SA_RESTART,
+};
+
+static bool xc_attr_is(const char *payload, uint32_t off, uint32_t len,
+		       const char *value)
+{
+	return strlen(value) == len && memcmp(payload + off, value, len) == 0;
+}
+
+static void xc_stats_timer_cb(struct xc_timer *timer, void *userdata)
+{
+	struct xc_ctx *ctx = userdata;
+	char           p50[16];
+	char           p99[16];
+	char           resume[16];
+	char           stats[192];
+	size_t         len;
+	uint64_t       now = xc_time_ms();
+
+	/* UI is updated by the next tap after the prelogin. */
+	if (ctx->c_prelogin)
+		return;
+
+	/* Swarm doesn't have the console connection, it is sampled. */
+	if (ctx->c_swarm != NULL) {
+		xc_swarm_stats(ctx->c_swarm, now, stats, sizeof(stats));
+		xc_ui_stats_set(ctx->c_ui, stats);
+		xc_timer_arm(&ctx->c_wheel, timer, now + XC_SWARM_STATS_PERIOD);
+		return;
+	}
+
+	len = (size_t)snprintf(stats, sizeof(stats), "%s", ctx->c_login);
+	if (ctx->c_resume_tries > 0 && len < sizeof(stats)) {
+		resume[0] = '\0';
+		if (ctx->c_resume_nr > 0) {
+			xc_rtt_format(resume, sizeof(resume),
+				      ctx->c_resume_time / 1000);
+		}
+		len += (size_t)snprintf(stats + len, sizeof(stats) - len,
+					"%sresumed %u/%u%s%s",
+					len > 0 ? ", " : "", ctx->c_resume_nr,
+					ctx->c_resume_tries,
+					ctx->c_resume_nr > 0 ? " last " : "",
+					resume);
+	}
+	if (ctx->c_rtt.rt_total > 0 && len < sizeof(stats)) {
+		xc_rtt_format(p50, sizeof(p50),
+			      xc_rtt_percentile(&ctx->c_rtt, 50));
+		xc_rtt_format(p99, sizeof(p99),
+			      xc_rtt_percentile(&ctx->c_rtt, 99));
+		snprintf(stats + len, sizeof(stats) - len,
+			 "%sRTT p50 %s p99 %s", len > 0 ? ", " : "", p50, p99);
+	}
+	xc_ui_stats_set(ctx->c_ui, stats);
+}
+
+/* Matches replies to requests by id. */
+static void xc_rtt_tap(struct xc_ctx          *ctx,
+		       const struct xc_record *rec,
+		       void                   *userdata)
+{
+	const char *payload = xc_store_payload(&ctx->c_store, rec);
+	const char *id = payload + rec->rec_id_off;
+	uint32_t    off = rec->rec_type_off;
+	uint32_t    len = rec->rec_type_len;
+
+	if (rec->rec_id_len == 0 ||
+	    !xc_attr_is(payload, rec->rec_name_off, rec->rec_name_len, "iq"))
+		return;
+
+	if (rec->rec_dir == XC_DIR_SENT) {
+		if (xc_attr_is(payload, off, len, "get") ||
+		    xc_attr_is(payload, off, len, "set"))
+			xc_rtt_sent(&ctx->c_rtt, id, rec->rec_id_len,
+				    rec->rec_time);
+	} else if ((xc_attr_is(payload, off, len, "result") ||
+		    xc_attr_is(payload, off, len, "error")) &&
+		   xc_rtt_received(&ctx->c_rtt, id, rec->rec_id_len,
+				   rec->rec_time)) {
+		xc_stats_update(ctx);
+	}
+}
+
+/*
+ * Detects phases of the negotiation which libstrophe does itself. Stream
+ * header is sent right after connect and after TLS handshake.
+ */
+static void xc_phases_tap(struct xc_ctx          *ctx,
+			  const struct xc_record *rec,
+			  void                   *userdata)
+{
+	const char       *payload = xc_store_payload(&ctx->c_store, rec);
+	struct xc_phases *ph = xc_phases_cur(ctx);
+	uint32_t          off = rec->rec_name_off;
+	uint32_t          len = rec->rec_name_len;
+
+	if (ctx->c_conn == NULL || rec->rec_conn != ph->ph_conn ||
+	    ph->ph_is_done)
+		return;
+
+	if (rec->rec_dir == XC_DIR_SENT) {
+		if (!xc_attr_is(payload, off, len, "stream:stream"))
+			return;
+		xc_phase(ctx, xc_phases_is_marked(ph, XC_PHASE_TLS_PROCEED) ?
+			      XC_PHASE_TLS_DONE : XC_PHASE_CONNECTED);
+	} else if (xc_attr_is(payload, off, len, "stream:features")) {
+		xc_phase(ctx, XC_PHASE_FEATURES);
+	} else if (xc_attr_is(payload, off, len, "proceed")) {
+		xc_phase(ctx, XC_PHASE_TLS_PROCEED);
+	} else if (xc_attr_is(payload, off, len, "success")) {
+		xc_phase(ctx, XC_PHASE_SASL);
+	}
+}
+
+/*
+ * Counts stream management resumptions. libstrophe resumes sessions itself,
+ * so attempts and their results are detected from the traffic.
+ */
+static void xc_sm_tap(struct xc_ctx          *ctx,
+		      const struct xc_record *rec,
+		      void                   *userdata)
+{
+	const char *payload = xc_store_payload(&ctx->c_store, rec);
+	uint32_t    off = rec->rec_name_off;
+	uint32_t    len = rec->rec_name_len;
+
+	if (ctx->c_conn == NULL || rec->rec_conn != ctx->c_conn_id ||
+	    !xc_attr_is(payload, rec->rec_ns_off, rec->rec_ns_len, XC_NS_SM))
+		return;
+
+	if (rec->rec_dir == XC_DIR_SENT) {
+		if (xc_attr_is(payload, off, len, "resume")) {
+			++ctx->c_resume_tries;
+			ctx->c_resume_pending = true;
+		}
+		return;
+	}
+	if (!ctx->c_resume_pending)
+		return;
+	if (xc_attr_is(payload, off, len, "resumed")) {
+		++ctx->c_resume_nr;
+		ctx->c_resume_time = rec->rec_time -
+				     xc_phases_cur(ctx)->ph_time[XC_PHASE_START];
+	} else if (!xc_attr_is(payload, off, len, "failed")) {
+		return;
+	}
+	ctx->c_resume_pending = false;
+	xc_stats_update(ctx);
+}
+
+static void xc_capture_tap(struct xc_ctx          *ctx,
+			   const struct xc_record *rec,
+			   void                   *userdata)
+{
+	xc_capture_add(userdata, rec, xc_store_payload(&ctx->c_store, rec));
+}
+
+static void xc_rtt_dump(struct xc_ctx *ctx, const char *path)
+{
+	FILE *stream = xc_streq(path, "-") ? stdout : fopen(path, "w");
+
+	if (stream == NULL) {
+		fprintf(stderr, "Error: failed to open %s: %s\n", path,
+			strerror(errno));
+		return;
+	}
+	xc_rtt_print(&ctx->c_rtt, stream);
+	if (stream != stdout)
+		fclose(stream);
+}
+
+static void *xc_prelogin_thread(void *arg)
+{
+	struct xc_ctx *ctx = arg;
+
+	while (!atomic_load(&ctx->c_prelogin_stop))
+		xmpp_run_once(ctx->c_ctx, XC_PRELOGIN_TIMEOUT);
+	return NULL;
+}
+
+/*
+ * Resolves the server, connects and negotiates TLS in raw mode while the
+ * password is typed. The helper thread owns libstrophe context until
+ * xc_prelogin_stop().
+ */
+static int xc_prelogin_start(struct xc_ctx     *ctx,
+			     struct xc_options *opts,
+			     pthread_t         *thread)
+{
+	sigset_t set;
+	sigset_t oldset;
+	int      rc;
+
+	ctx->c_prelogin = true;
+	ctx->c_prelogin_seq = xc_store_next(&ctx->c_store);
+	atomic_init(&ctx->c_prelogin_stop, false);
+
+	rc = xc_connect(ctx, opts, false);
+	if (rc == 0) {
+		/* Signals must be delivered to the main thread. */
+		sigfillset(&set);
+		pthread_sigmask(SIG_SETMASK, &set, &oldset);
+		rc = -pthread_create(thread, NULL, xc_prelogin_thread, ctx);
+		pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	}
+	if (rc != 0) {
+		if (ctx->c_conn != NULL)
+			xmpp_conn_release(ctx->c_conn);
+		ctx->c_conn = NULL;
+		ctx->c_prelogin = false;
+	}
+	return rc;
+}
+
+static void xc_prelogin_stop(struct xc_ctx *ctx, pthread_t thread)
+{
+	atomic_store(&ctx->c_prelogin_stop, true);
+	pthread_join(thread, NULL);
+	xc_phase(ctx, XC_PHASE_PASSWD);
+}
+
+/*
+ * Prints the traffic of the prelogin and starts the login. libstrophe can't
+ * take over a raw connection, so it logs in over a new one with its own
+ * SASL mechanism selection, resource binding and stream management. The
+ * address found by the prelogin saves the name resolution.
+ */
+static int xc_prelogin_finish(struct xc_ctx *ctx, struct xc_options *opts)
+{
+	uint64_t seq = MAX(ctx->c_prelogin_seq, xc_store_first(&ctx->c_store));
+
+	for (; seq < xc_store_next(&ctx->c_store); ++seq)
+		xc_ui_print(ctx->c_ui, xc_store_get(&ctx->c_store, seq));
+	xc_stats_update(ctx);
+
+	/* Disconnect event is ignored while c_prelogin is set. */
+	xmpp_conn_release(ctx->c_conn);
+	ctx->c_conn = NULL;
+	ctx->c_prelogin = false;
+	return xc_connect(ctx, opts, true);
+}
+
 int main(int argc, char **argv)
 {
-	struct xc_options opts;
-	struct xc_ui      ui;
-	struct xc_ctx     ctx;
-	xmpp_log_t        log;
-	bool              result;
-	int               rc;
+	struct xc_options      opts;
+	struct xc_capture      capture;
+	struct xc_capture_file file;
+	struct xc_replay       replay;
+	struct xc_swarm        swarm;
+	struct xc_ui           ui;
+	struct xc_ctx          ctx;
+	pthread_t              prelogin_thread;
+	bool                   prelogin = false;
+	size_t                 store_size;
+	size_t                 store_recs;
+	bool                   result;
+	int                    rc;
 
 	memset(&ctx, 0, sizeof(ctx));
+	ctx.c_fd = -1;
+	atomic_init(&ctx.c_dump_pending, false);
+	rc = xc_wake_init(&ctx);
+	assert(rc == 0);
+	xc_wheel_init(&ctx.c_wheel, xc_time_ms());
+	xc_timer_init(&ctx.c_stats_timer, xc_stats_timer_cb, &ctx);
+	xc_timer_init(&ctx.c_reconnect_timer, xc_reconnect_cb, &ctx);
+	rc = xc_rtt_init(&ctx.c_rtt, XC_RTT_PENDING_MAX);
+	assert(rc == 0);
 
 	result = xc_options_parse(argc, argv, &opts);
 	if (!result || opts.xo_help) {
@@ -521,6 +1801,73 @@ int main(int argc, char **argv)
 		exit(EXIT_SUCCESS);
 	}
 
+	/*
+	 * The store must keep at least the scrollback. It is the flight
+	 * recorder as well, the ring evicts the oldest traffic. These are
+	 * limits, the store starts small and grows with the traffic.
+	 */
+	ctx.c_scrollback = opts.xo_scrollback;
+	ctx.c_dump_path = opts.xo_recorder;
+	store_size = MAX(XC_STORE_ARENA_SIZE,
+			 opts.xo_scrollback * XC_SCROLLBACK_LINE_SIZE);
+	store_recs = MAX(XC_STORE_RECORDS_MAX, opts.xo_scrollback);
+	if (opts.xo_recorder != NULL) {
+		store_size = MAX(store_size, opts.xo_recorder_size << 20);
+		store_recs = MAX(store_recs,
+				 store_size / XC_RECORDER_RECORD_SIZE);
+	}
+	rc = xc_store_init(&ctx.c_store, store_size, store_recs);
+	assert(rc == 0);
+	rc = xc_tap_add(&ctx, xc_rtt_tap, NULL)
+	  ?: xc_tap_add(&ctx, xc_phases_tap, NULL)
+	  ?: xc_tap_add(&ctx, xc_sm_tap, NULL);
+	assert(rc == 0);
+
+	if (opts.xo_capture != NULL) {
+		rc = xc_capture_open(&capture, opts.xo_capture,
+				     opts.xo_capture_fsync);
+		if (rc != 0) {
+			fprintf(stderr, "Error: failed to open %s: %s\n",
+				opts.xo_capture, strerror(-rc));
+			exit(EXIT_FAILURE);
+		}
+		rc = xc_tap_add(&ctx, xc_capture_tap, &capture);
+		assert(rc == 0);
+	}
+	if (opts.xo_open != NULL) {
+		rc = xc_capture_file_open(&file, opts.xo_open);
+		if (rc != 0) {
+			fprintf(stderr, "Error: failed to open %s: %s\n",
+				opts.xo_open, strerror(-rc));
+			exit(EXIT_FAILURE);
+		}
+		/* Older records are loaded when the UI pages back. */
+		ctx.c_file = &file;
+		xc_file_load(&ctx, file.cf_records_nr -
+				   MIN(file.cf_records_nr,
+				       xc_file_window(&ctx)));
+	}
+	if (opts.xo_timings != NULL) {
+		ctx.c_timings = fopen(opts.xo_timings, "w");
+		if (ctx.c_timings == NULL) {
+			fprintf(stderr, "Error: failed to open %s: %s\n",
+				opts.xo_timings, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		/* Lines are written as attempts finish. */
+		setvbuf(ctx.c_timings, NULL, _IOLBF, 0);
+	}
+	if (opts.xo_replay != NULL) {
+		rc = xc_replay_init(&replay, &ctx, opts.xo_replay,
+				    opts.xo_replay_speed);
+		if (rc != 0) {
+			fprintf(stderr, "Error: failed to open %s: %s\n",
+				opts.xo_replay, strerror(-rc));
+			exit(EXIT_FAILURE);
+		}
+		ctx.c_replay = &replay;
+	}
+
 	rc = xc_ui_init(&ui, opts.xo_ui_type);
 	assert(rc == 0);
 	if (xc_ui_type(&ui) != XC_UI_GTK) {
@@ -528,44 +1875,143 @@ int main(int argc, char **argv)
 		verbose_level = false;
 	}
 
-	log = (xmpp_log_t){
+	ctx.c_log = (xmpp_log_t){
 		.handler = &xc_log_cb,
 		.userdata = &ctx,
 	};
 	xmpp_initialize();
-	ctx.c_ctx = xmpp_ctx_new(NULL, &log);
+	/* Debug messages of the swarm are formatted only when printed. */
+	ctx.c_ctx = xmpp_ctx_new(NULL, opts.xo_swarm == 0 || verbose_level ?
+				       &ctx.c_log : NULL);
 	assert(ctx.c_ctx != NULL);
 
 	/* Check password. */
-	if (opts.xo_passwd == NULL) {
+	if (opts.xo_passwd == NULL && opts.xo_open == NULL) {
 		char *node = xmpp_jid_node(ctx.c_ctx, opts.xo_jid);
 
 		if (node != NULL && !opts.xo_raw_mode) {
+			/* Network round trips overlap with typing. */
+			prelogin = opts.xo_swarm == 0 &&
+				   xc_prelogin_start(&ctx, &opts,
+						     &prelogin_thread) == 0;
 			(void)xc_ui_get_passwd(&ui, &opts.xo_passwd);
+			if (prelogin)
+				xc_prelogin_stop(&ctx, prelogin_thread);
 			xmpp_free(ctx.c_ctx, node);
 		}
 	}
 
 	ctx.c_ui = &ui;
 	xc_ui_ctx_set(&ui, &ctx);
-	rc = xc_connect(&ctx, &opts, true);
-	assert(rc == 0);
+	if (opts.xo_swarm > 0) {
+		struct xc_swarm_conf conf = {
+			.swc_jid             = opts.xo_jid,
+			.swc_passwd          = opts.xo_passwd,
+			.swc_host            = opts.xo_host,
+			.swc_port            = opts.xo_port,
+			.swc_flags           = xc_conn_flags(&opts),
+			.swc_nr              = opts.xo_swarm,
+			.swc_rate            = opts.xo_swarm_rate,
+			.swc_threads         = opts.xo_swarm_threads,
+			.swc_reconnect_min   = opts.xo_reconnect_min,
+			.swc_reconnect_max   = opts.xo_reconnect_max,
+			.swc_reconnect_tries = opts.xo_reconnect_tries,
+		};
+		unsigned nr_max;
+
+		nr_max = xc_swarm_nr_max(&conf);
+		if (conf.swc_nr > nr_max) {
+			fprintf(stderr, "Error: at most %u connections fit "
+				"FD_SETSIZE of select(2) used by libstrophe\n",
+				nr_max);
+			exit(EXIT_FAILURE);
+		}
+		rc = xc_swarm_init(&swarm, ctx.c_ctx, &ctx.c_wheel, &conf);
+		if (rc != 0) {
+			fprintf(stderr, "Error: failed to create %u "
+				"connections: %s\n", opts.xo_swarm,
+				strerror(-rc));
+			exit(EXIT_FAILURE);
+		}
+		ctx.c_swarm = &swarm;
+		/* Input isn't sent anywhere. */
+		xc_ui_offline(&ui);
+		rc = xc_swarm_start(&swarm);
+		if (rc != 0) {
+			fprintf(stderr, "Error: failed to start the swarm: "
+				"%s\n", strerror(-rc));
+			xc_swarm_fini(&swarm);
+			exit(EXIT_FAILURE);
+		}
+		xc_timer_arm(&ctx.c_wheel, &ctx.c_stats_timer,
+			     xc_time_ms() + XC_SWARM_STATS_PERIOD);
+	} else if (opts.xo_open != NULL) {
+		xc_ui_offline(&ui);
+	} else if (prelogin) {
+		rc = xc_prelogin_finish(&ctx, &opts);
+		assert(rc == 0);
+	} else {
+		rc = xc_connect(&ctx, &opts, true);
+		assert(rc == 0);
+	}
 
 	g_ctx = &ctx;
 	rc = sigaction(SIGTERM, &xc_sigaction, NULL)
 	  ?: sigaction(SIGINT, &xc_sigaction, NULL);
 	assert(rc == 0);
+	if (ctx.c_dump_path != NULL) {
+		rc = sigaction(SIGUSR1, &xc_dump_sigaction, NULL);
+		assert(rc == 0);
+	}
 	rc = signal(SIGPIPE, SIG_IGN) == SIG_ERR ? -1 : 0;
 	assert(rc == 0);
 
 	/* Run main event loops */
 	xc_ui_run(&ui);
 
-	xmpp_conn_release(ctx.c_conn);
+	if (ctx.c_conn != NULL)
+		xmpp_conn_release(ctx.c_conn);
+#ifdef HAVE_XMPP_CONN_GET_SM_STATE
+	if (ctx.c_sm_state != NULL)
+		xmpp_free_sm_state(ctx.c_sm_state);
+#endif
+	if (ctx.c_swarm != NULL) {
+		fprintf(stderr, "Swarm: %lu logins, %lu failed attempts\n",
+			xc_swarm_logins(&swarm), xc_swarm_failures(&swarm));
+		xc_swarm_fini(&swarm);
+	}
 	xmpp_ctx_free(ctx.c_ctx);
 	xmpp_shutdown();
 
 	xc_ui_fini(&ui);
+	if (opts.xo_rtt_stats != NULL)
+		xc_rtt_dump(&ctx, opts.xo_rtt_stats);
+	if (opts.xo_capture != NULL) {
+		if (xc_capture_dropped(&capture) > 0) {
+			fprintf(stderr, "Warning: %zu records were dropped "
+				"from %s\n", xc_capture_dropped(&capture),
+				opts.xo_capture);
+		}
+		rc = xc_capture_close(&capture);
+		if (rc != 0) {
+			fprintf(stderr, "Error: failed to write %s: %s\n",
+				opts.xo_capture, strerror(-rc));
+		}
+	}
+	if (opts.xo_replay != NULL) {
+		fprintf(stderr, "Replayed %lu stanzas%s\n",
+			replay.rp_sent_nr, xc_replay_is_done(&replay) ?
+			"" : ", the replay was interrupted");
+		xc_replay_fini(&replay);
+	}
+	xc_wheel_fini(&ctx.c_wheel);
+	if (ctx.c_timings != NULL)
+		fclose(ctx.c_timings);
+	if (opts.xo_open != NULL)
+		xc_capture_file_close(&file);
+	xc_store_fini(&ctx.c_store);
+	xc_rtt_fini(&ctx.c_rtt);
+	xc_wake_fini(&ctx);
 	xc_options_fini(&opts);
 
 	return 0;